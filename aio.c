@@ -112,11 +112,16 @@ void qemu_aio_flush(void)
 
 void qemu_aio_wait(void)
 {
-    int ret;
-
     if (qemu_bh_poll())
         return;
 
+    qemu_aio_wait_fds();
+}
+
+int qemu_aio_wait_fds(void)
+{
+    int ret;
+
     do {
         AioHandler *node;
         fd_set rdfds, wrfds;
@@ -150,7 +155,7 @@ void qemu_aio_wait(void)
 
         /* No AIO operations?  Get us out of here */
         if (max_fd == -1)
-            break;
+            return 0;
 
         /* wait until next event */
         ret = select(max_fd, &rdfds, &wrfds, NULL, NULL);
@@ -190,4 +195,6 @@ void qemu_aio_wait(void)
             walking_handlers = 0;
         }
     } while (ret == 0);
+
+    return 1;
 }
@@ -30,6 +30,7 @@
 #include "qemu-common.h"
 #include "monitor.h"
 #include "block_int.h"
+#include "replay.h"
 
 #ifdef HOST_BSD
 #include <sys/types.h>
@@ -48,6 +49,7 @@
 #define SECTOR_SIZE (1 << SECTOR_BITS)
 
 static AIOPool vectored_aio_pool;
+static AIOPool replay_aio_pool;
 
 typedef struct BlockDriverAIOCBSync {
     BlockDriverAIOCB common;
@@ -66,6 +68,12 @@ static int bdrv_read_em(BlockDriverState *bs, int64_t sector_num,
                         uint8_t *buf, int nb_sectors);
 static int bdrv_write_em(BlockDriverState *bs, int64_t sector_num,
                          const uint8_t *buf, int nb_sectors);
+static BlockDriverAIOCB *bdrv_do_aio_read(BlockDriverState *bs,
+        int64_t sector_num, uint8_t *buf, int nb_sectors,
+        BlockDriverCompletionFunc *cb, void *opaque);
+static BlockDriverAIOCB *bdrv_do_aio_write(BlockDriverState *bs,
+        int64_t sector_num, const uint8_t *buf, int nb_sectors,
+        BlockDriverCompletionFunc *cb, void *opaque);
 
 BlockDriverState *bdrv_first;
 
@@ -1350,9 +1358,9 @@ BlockDriverAIOCB *bdrv_aio_writev(BlockDriverState *bs, int64_t sector_num,
                               cb, opaque, 1);
 }
 
-BlockDriverAIOCB *bdrv_aio_read(BlockDriverState *bs, int64_t sector_num,
-                                uint8_t *buf, int nb_sectors,
-                                BlockDriverCompletionFunc *cb, void *opaque)
+static BlockDriverAIOCB *bdrv_do_aio_read(BlockDriverState *bs,
+        int64_t sector_num, uint8_t *buf, int nb_sectors,
+        BlockDriverCompletionFunc *cb, void *opaque)
 {
     BlockDriver *drv = bs->drv;
     BlockDriverAIOCB *ret;
@@ -1373,9 +1381,9 @@ BlockDriverAIOCB *bdrv_aio_read(BlockDriverState *bs, int64_t sector_num,
     return ret;
 }
 
-BlockDriverAIOCB *bdrv_aio_write(BlockDriverState *bs, int64_t sector_num,
-                                 const uint8_t *buf, int nb_sectors,
-                                 BlockDriverCompletionFunc *cb, void *opaque)
+static BlockDriverAIOCB *bdrv_do_aio_write(BlockDriverState *bs,
+        int64_t sector_num, const uint8_t *buf, int nb_sectors,
+        BlockDriverCompletionFunc *cb, void *opaque)
 {
     BlockDriver *drv = bs->drv;
     BlockDriverAIOCB *ret;
@@ -1398,6 +1406,87 @@ BlockDriverAIOCB *bdrv_aio_write(BlockDriverState *bs, int64_t sector_num,
     return ret;
 }
 
+/* Under record/replay the completion of a request that a device issued
+   is an input: it is held back until the log says it happened.  Requests
+   that block drivers issue on their backing files are part of the outer
+   request and are left alone.  */
+typedef struct ReplayAIOCB {
+    BlockDriverAIOCB common;
+    BlockDriverAIOCB *aiocb;
+    ReplayBlockReq req;
+} ReplayAIOCB;
+
+static void bdrv_aio_replay_cb(void *opaque, int ret)
+{
+    ReplayAIOCB *acb = opaque;
+
+    acb->req.ret = ret;
+    replay_block_done(&acb->req);
+}
+
+static void bdrv_aio_replay_complete(ReplayBlockReq *req)
+{
+    ReplayAIOCB *acb = container_of(req, ReplayAIOCB, req);
+
+    acb->common.cb(acb->common.opaque, req->ret);
+    qemu_aio_release(acb);
+}
+
+static void bdrv_aio_cancel_replay(BlockDriverAIOCB *_acb)
+{
+    ReplayAIOCB *acb = container_of(_acb, ReplayAIOCB, common);
+
+    if (!acb->req.done)
+        bdrv_aio_cancel(acb->aiocb);
+    replay_block_cancel(&acb->req);
+    qemu_aio_release(acb);
+}
+
+static BlockDriverAIOCB *bdrv_aio_replay(BlockDriverState *bs,
+                                         int64_t sector_num, uint8_t *buf,
+                                         int nb_sectors,
+                                         BlockDriverCompletionFunc *cb,
+                                         void *opaque, int is_write)
+{
+    ReplayAIOCB *acb = qemu_aio_get_pool(&replay_aio_pool, bs, cb, opaque);
+
+    acb->req.complete = bdrv_aio_replay_complete;
+    replay_block_submit(&acb->req);
+    if (is_write) {
+        acb->aiocb = bdrv_do_aio_write(bs, sector_num, buf, nb_sectors,
+                                       bdrv_aio_replay_cb, acb);
+    } else {
+        acb->aiocb = bdrv_do_aio_read(bs, sector_num, buf, nb_sectors,
+                                      bdrv_aio_replay_cb, acb);
+    }
+    if (!acb->aiocb) {
+        replay_block_cancel(&acb->req);
+        qemu_aio_release(acb);
+        return NULL;
+    }
+    return &acb->common;
+}
+
+BlockDriverAIOCB *bdrv_aio_read(BlockDriverState *bs, int64_t sector_num,
+                                uint8_t *buf, int nb_sectors,
+                                BlockDriverCompletionFunc *cb, void *opaque)
+{
+    if (replay_mode != REPLAY_NONE && bs->device_name[0] != '\0')
+        return bdrv_aio_replay(bs, sector_num, buf, nb_sectors,
+                               cb, opaque, 0);
+    return bdrv_do_aio_read(bs, sector_num, buf, nb_sectors, cb, opaque);
+}
+
+BlockDriverAIOCB *bdrv_aio_write(BlockDriverState *bs, int64_t sector_num,
+                                 const uint8_t *buf, int nb_sectors,
+                                 BlockDriverCompletionFunc *cb, void *opaque)
+{
+    if (replay_mode != REPLAY_NONE && bs->device_name[0] != '\0')
+        return bdrv_aio_replay(bs, sector_num, (uint8_t *)buf, nb_sectors,
+                               cb, opaque, 1);
+    return bdrv_do_aio_write(bs, sector_num, buf, nb_sectors, cb, opaque);
+}
+
 void bdrv_aio_cancel(BlockDriverAIOCB *acb)
 {
     acb->pool->cancel(acb);
@@ -1470,8 +1559,8 @@ static int bdrv_read_em(BlockDriverState *bs, int64_t sector_num,
     BlockDriverAIOCB *acb;
 
     async_ret = NOT_DONE;
-    acb = bdrv_aio_read(bs, sector_num, buf, nb_sectors,
-                        bdrv_rw_em_cb, &async_ret);
+    acb = bdrv_do_aio_read(bs, sector_num, buf, nb_sectors,
+                           bdrv_rw_em_cb, &async_ret);
     if (acb == NULL)
         return -1;
 
@@ -1489,8 +1578,8 @@ static int bdrv_write_em(BlockDriverState *bs, int64_t sector_num,
     BlockDriverAIOCB *acb;
 
     async_ret = NOT_DONE;
-    acb = bdrv_aio_write(bs, sector_num, buf, nb_sectors,
-                         bdrv_rw_em_cb, &async_ret);
+    acb = bdrv_do_aio_write(bs, sector_num, buf, nb_sectors,
+                            bdrv_rw_em_cb, &async_ret);
     if (acb == NULL)
         return -1;
     while (async_ret == NOT_DONE) {
@@ -1503,6 +1592,8 @@ void bdrv_init(void)
 {
     aio_pool_init(&vectored_aio_pool, sizeof(VectorTranslationAIOCB),
                   bdrv_aio_cancel_vector);
+    aio_pool_init(&replay_aio_pool, sizeof(ReplayAIOCB),
+                  bdrv_aio_cancel_replay);
 
     bdrv_register(&bdrv_raw);
     bdrv_register(&bdrv_host_device);
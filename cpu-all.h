@@ -744,6 +744,14 @@ void page_set_flags(target_ulong start, target_ulong end, int flags);
 int page_check_range(target_ulong start, target_ulong len, int flags);
 
 void cpu_exec_init_all(unsigned long tb_size);
+void tb_cache_open(const char *filename, const char *config);
+void tb_cache_save(void);
+void tb_perf_open(int perf_map, int jitdump);
+extern int tcg_optimize_enabled;
+extern int tb_trace_threshold;
+extern int tb_prof_enabled;
+void tb_prof_enable(int enable);
+void tb_prof_reset(void);
 CPUState *cpu_copy(CPUState *env);
 
 void cpu_dump_state(CPUState *env, FILE *f,
@@ -843,6 +851,8 @@ void cpu_outl(CPUState *env, int addr, int val);
 int cpu_inb(CPUState *env, int addr);
 int cpu_inw(CPUState *env, int addr);
 int cpu_inl(CPUState *env, int addr);
+int cpu_in_data(int addr, int size, uint32_t *val);
+int cpu_out_data(int addr, int size, uint32_t val);
 #endif
 
 /* address in the RAM (different from a physical address) */
@@ -984,6 +994,9 @@ void cpu_physical_sync_dirty_bitmap(target_phys_addr_t start_addr, target_phys_a
 
 void dump_exec_info(FILE *f,
                     int (*cpu_fprintf)(FILE *f, const char *fmt, ...));
+void dump_tb_profile(FILE *f,
+                     int (*cpu_fprintf)(FILE *f, const char *fmt, ...),
+                     int count);
 
 /* Coalesced MMIO regions are areas where write operations can be reordered.
  * This usually implies that write operations are side-effect free.  This allows
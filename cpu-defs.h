@@ -96,9 +96,25 @@ typedef uint64_t target_phys_addr_t;
 #define TB_JMP_ADDR_MASK (TB_JMP_PAGE_SIZE - 1)
 #define TB_JMP_PAGE_MASK (TB_JMP_CACHE_SIZE - TB_JMP_PAGE_SIZE)
 
+/* Each MMU mode has room for CPU_TLB_SIZE direct mapped entries.  When
+   the TCG backend of the host looks up the index mask in env->tlb_mask
+   (CPU_TLB_DYNAMIC), only part of the table is used: its size is
+   adjusted at each flush from the number of misses since the previous
+   one, between CPU_TLB_MIN_BITS and CPU_TLB_BITS.  */
+#if defined(__x86_64__)
+#define CPU_TLB_DYNAMIC
+#define CPU_TLB_BITS 12
+#define CPU_TLB_MIN_BITS 6
+#define CPU_TLB_DEFAULT_BITS 8
+#else
 #define CPU_TLB_BITS 8
+#endif
 #define CPU_TLB_SIZE (1 << CPU_TLB_BITS)
 
+/* Fully associative TLB holding the entries recently evicted from each
+   MMU mode, looked up before calling tlb_fill.  */
+#define CPU_VTLB_SIZE 8
+
 #if TARGET_PHYS_ADDR_BITS == 32 && TARGET_LONG_BITS == 32
 #define CPU_TLB_ENTRY_BITS 4
 #else
@@ -130,6 +146,15 @@ typedef struct CPUTLBEntry {
                    sizeof(target_phys_addr_t))];
 } CPUTLBEntry;
 
+#ifdef CPU_TLB_DYNAMIC
+#define tlb_index(env, mmu_idx, addr)                                   \
+    (((addr) >> TARGET_PAGE_BITS) &                                     \
+     ((env)->tlb_mask[mmu_idx] >> CPU_TLB_ENTRY_BITS))
+#else
+#define tlb_index(env, mmu_idx, addr)                                   \
+    (((addr) >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1))
+#endif
+
 #ifdef WORDS_BIGENDIAN
 typedef struct icount_decr_u16 {
     uint16_t high;
@@ -175,6 +200,14 @@ typedef struct CPUWatchpoint {
     /* The meaning of the MMU modes is defined in the target code. */   \
     CPUTLBEntry tlb_table[NB_MMU_MODES][CPU_TLB_SIZE];                  \
     target_phys_addr_t iotlb[NB_MMU_MODES][CPU_TLB_SIZE];               \
+    /* (number of entries in use - 1) << CPU_TLB_ENTRY_BITS */          \
+    uint32_t tlb_mask[NB_MMU_MODES];                                    \
+    /* misses in tlb_table since the last flush */                     \
+    uint32_t tlb_miss_count[NB_MMU_MODES];                              \
+    CPUTLBEntry tlb_v_table[NB_MMU_MODES][CPU_VTLB_SIZE];               \
+    target_phys_addr_t iotlb_v[NB_MMU_MODES][CPU_VTLB_SIZE];            \
+    /* next victim TLB slot to replace */                              \
+    uint32_t vtlb_index[NB_MMU_MODES];                                  \
     struct TranslationBlock *tb_jmp_cache[TB_JMP_CACHE_SIZE];           \
     /* buffer for temporaries in the code generator */                  \
     long temp_buf[CPU_TEMP_BUF_NLONGS];                                 \
@@ -132,7 +132,7 @@ static TranslationBlock *tb_find_slow(target_ulong pc,
     phys_pc = get_phys_addr_code(env, pc);
     phys_page1 = phys_pc & TARGET_PAGE_MASK;
     phys_page2 = -1;
-    h = tb_phys_hash_func(phys_pc);
+    h = tb_phys_hash_func(phys_pc, cs_base, flags);
     ptb1 = &tb_phys_hash[h];
     for(;;) {
         tb = *ptb1;
@@ -156,6 +156,10 @@ static TranslationBlock *tb_find_slow(target_ulong pc,
         ptb1 = &tb->phys_hash_next;
     }
  not_found:
+    /* try the persistent translation cache */
+    tb = tb_cache_import(env, pc, cs_base, flags, phys_pc);
+    if (tb)
+        goto found;
    /* if no translated code available, then translate it now */
     tb = tb_gen_code(env, pc, cs_base, flags, 0);
 
@@ -180,6 +184,12 @@ static inline TranslationBlock *tb_find_fast(void)
                  tb->flags != flags)) {
         tb = tb_find_slow(pc, cs_base, flags);
     }
+    tb->exec_count++;
+    /* keep hot code out of the next region to be reclaimed */
+    if (unlikely(tb->tc_ptr >= tb_aging_start && tb->tc_ptr < tb_aging_end)) {
+        regs_to_env();
+        tb = tb_promote(env, tb);
+    }
     return tb;
 }
 
@@ -215,6 +225,9 @@ int cpu_exec(CPUState *env1)
     TranslationBlock *tb;
     uint8_t *tc_ptr;
     unsigned long next_tb;
+#ifdef TARGET_HAS_SUPERBLOCKS
+    TranslationBlock *last_tb;
+#endif
 
     if (cpu_halted(env1) == EXCP_HALTED)
         return EXCP_HALTED;
@@ -341,6 +354,9 @@ int cpu_exec(CPUState *env1)
             }
 
             next_tb = 0; /* force lookup of first TB */
+#ifdef TARGET_HAS_SUPERBLOCKS
+            last_tb = NULL;
+#endif
             for(;;) {
                 interrupt_request = env->interrupt_request;
                 if (unlikely(interrupt_request)) {
@@ -566,6 +582,15 @@ int cpu_exec(CPUState *env1)
 #endif
                 spin_lock(&tb_lock);
                 tb = tb_find_fast();
+#ifdef TARGET_HAS_SUPERBLOCKS
+                if (unlikely(tb_trace_threshold) && !use_icount) {
+                    if (tb_invalidated_flag)
+                        last_tb = NULL;
+                    regs_to_env();
+                    tb = tb_trace_profile(env, last_tb, tb);
+                    last_tb = tb;
+                }
+#endif
                 /* Note: we do it here to avoid a gcc bug on Mac OS X when
                    doing it in tb_find_slow */
                 if (tb_invalidated_flag) {
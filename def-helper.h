@@ -3,7 +3,10 @@
 
    Targets should use DEF_HELPER_N and DEF_HELPER_FLAGS_N to declare helper
    functions.  Names should be specified without the helper_ prefix, and
-   the return and argument types specified.  3 basic types are understood
+   the return and argument types specified.  The flags are TCG_CALL_*
+   values from tcg.h telling what the helper does with the TCG globals
+   (TCG_CALL_CONST, TCG_CALL_PURE, TCG_CALL_NO_READ_GLOBALS and
+   TCG_CALL_NO_WRITE_GLOBALS).  3 basic types are understood
    (i32, i64 and ptr).  Additional aliases are provided for convenience and
    to match the types used by the C helper implementation.
 
@@ -307,6 +307,84 @@ const char *lookup_symbol(target_ulong orig_addr)
     return symbol;
 }
 
+struct map_sym {
+    target_ulong addr;
+    char *name;
+};
+
+static int map_sym_cmp(const void *a, const void *b)
+{
+    const struct map_sym *sa = a, *sb = b;
+
+    return sa->addr < sb->addr ? -1 : sa->addr > sb->addr ? 1 : 0;
+}
+
+/* A System.map gives no symbol sizes: an address belongs to the last
+   symbol at or below it.  */
+static const char *lookup_map_symbol(struct syminfo *s, target_ulong orig_addr)
+{
+    struct map_sym *syms = s->disas_symtab.map;
+    int lo, hi, mid;
+
+    if (s->disas_num_syms == 0 || orig_addr < syms[0].addr)
+        return "";
+    lo = 0;
+    hi = s->disas_num_syms - 1;
+    while (lo < hi) {
+        mid = (lo + hi + 1) >> 1;
+        if (syms[mid].addr <= orig_addr)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return syms[lo].name;
+}
+
+/* Add the text symbols of a System.map file ("address type name" lines,
+   as written by nm) to the symbol tables.  They are searched after the
+   ELF symbols.  Returns the number of symbols found, or -1 if the file
+   cannot be read.  */
+int load_symbol_map(const char *filename)
+{
+    FILE *f;
+    char line[512], name[256], type;
+    unsigned long long addr;
+    struct map_sym *syms;
+    struct syminfo *s, **ps;
+    int n, size;
+
+    f = fopen(filename, "r");
+    if (!f)
+        return -1;
+    syms = NULL;
+    n = 0;
+    size = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%llx %c %255s", &addr, &type, name) != 3)
+            continue;
+        if (type != 't' && type != 'T' && type != 'w' && type != 'W')
+            continue;
+        if (n == size) {
+            size = size ? size * 2 : 1024;
+            syms = qemu_realloc(syms, size * sizeof(*syms));
+        }
+        syms[n].addr = addr;
+        syms[n].name = qemu_strdup(name);
+        n++;
+    }
+    fclose(f);
+    qsort(syms, n, sizeof(*syms), map_sym_cmp);
+
+    s = qemu_mallocz(sizeof(*s));
+    s->lookup_symbol = lookup_map_symbol;
+    s->disas_num_syms = n;
+    s->disas_symtab.map = syms;
+    for (ps = &syminfos; *ps; ps = &(*ps)->next)
+        ;
+    *ps = s;
+    return n;
+}
+
 #if !defined(CONFIG_USER_ONLY)
 
 #include "monitor.h"
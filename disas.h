@@ -16,9 +16,13 @@ void monitor_disas(Monitor *mon, CPUState *env,
 /* Look up symbol for debugging purpose.  Returns "" if unknown. */
 const char *lookup_symbol(target_ulong orig_addr);
 
+/* Add the text symbols of a System.map file to the symbol tables. */
+int load_symbol_map(const char *filename);
+
 struct syminfo;
 struct elf32_sym;
 struct elf64_sym;
+struct map_sym;
 
 typedef const char *(*lookup_symbol_t)(struct syminfo *s, target_ulong orig_addr);
 
@@ -28,6 +32,7 @@ struct syminfo {
     union {
       struct elf32_sym *elf32;
       struct elf64_sym *elf64;
+      struct map_sym *map;
     } disas_symtab;
     const char *disas_strtab;
     struct syminfo *next;
@@ -57,6 +57,19 @@ extern uint16_t gen_opc_icount[OPC_BUF_SIZE];
 extern target_ulong gen_opc_jump_pc[2];
 extern uint32_t gen_opc_hflags[OPC_BUF_SIZE];
 
+#ifdef TARGET_HAS_PC_MAP
+/* On targets whose gen_pc_load() only needs gen_opc_pc[], the
+   translator always fills gen_opc_pc[] and cpu_gen_code() stores after
+   the host code of the TB where each guest instruction starts, so that
+   cpu_restore_state() does not have to translate the TB again.  Each
+   entry holds the offset of the instruction in the host code (from
+   tb->tc_ptr), its offset from tb->pc and the number of guest
+   instructions before it in the TB.  Entries are sorted by host offset
+   and stored as signed LEB128 deltas from the previous entry, which
+   takes 3 bytes for most instructions.  */
+#define TB_PC_MAP_MAX_SIZE (2 * OPC_BUF_SIZE * 3)
+#endif
+
 #include "qemu-log.h"
 
 void gen_intermediate_code(CPUState *env, struct TranslationBlock *tb);
@@ -79,6 +92,10 @@ void cpu_io_recompile(CPUState *env, void *retaddr);
 TranslationBlock *tb_gen_code(CPUState *env, 
                               target_ulong pc, target_ulong cs_base, int flags,
                               int cflags);
+#define TB_TRACE_MAX_BLOCKS 16
+TranslationBlock *tb_trace_profile(CPUState *env, TranslationBlock *prev,
+                                   TranslationBlock *tb);
+void tb_prof_tlb_miss(unsigned long retaddr);
 void cpu_exec_init(CPUState *env);
 void QEMU_NORETURN cpu_loop_exit(void);
 int page_unprotect(target_ulong address, unsigned long pc, void *puc);
@@ -101,8 +118,11 @@ static inline int tlb_set_page(CPUState *env1, target_ulong vaddr,
 
 #define CODE_GEN_ALIGN           16 /* must be >= of the size of a icache line */
 
+/* initial size of the physical TB hash table; it doubles whenever it
+   holds more TBs than buckets, up to CODE_GEN_PHYS_HASH_MAX_BITS */
 #define CODE_GEN_PHYS_HASH_BITS     15
 #define CODE_GEN_PHYS_HASH_SIZE     (1 << CODE_GEN_PHYS_HASH_BITS)
+#define CODE_GEN_PHYS_HASH_MAX_BITS 22
 
 #define MIN_CODE_GEN_BUFFER_SIZE     (1024 * 1024)
 
@@ -122,6 +142,19 @@ static inline int tlb_set_page(CPUState *env1, target_ulong vaddr,
 #define USE_DIRECT_JUMP
 #endif
 
+/* execution profile of the code starting at a guest PC, shared by all
+   its translations.  The counters are updated by the generated code
+   while the profiler is enabled (see tb_prof_enable()).  */
+typedef struct TBProfile {
+    target_ulong pc;
+    uint64_t entries;    /* times the code was entered */
+    uint64_t exits;      /* returns to cpu_exec */
+    uint64_t helpers;    /* helper calls */
+    uint64_t tlb_misses; /* softmmu TLB misses */
+    uint32_t icount;     /* guest instructions of the last translation */
+    struct TBProfile *next;
+} TBProfile;
+
 struct TranslationBlock {
     target_ulong pc;   /* simulated PC corresponding to this block (EIP + CS base) */
     target_ulong cs_base; /* CS base for this block */
@@ -155,6 +188,20 @@ struct TranslationBlock {
     struct TranslationBlock *jmp_next[2];
     struct TranslationBlock *jmp_first;
     uint32_t icount;
+    uint32_t exec_count; /* number of times entered from cpu_exec */
+    /* superblock formation: while the TB is profiled, the TBs entered
+       after it and how often (the last count is for any other TB) */
+    struct TranslationBlock *trace_succ[2];
+    uint32_t trace_succ_count[3];
+    /* for a superblock, the number of guest blocks it covers and, in
+       bit n, whether block n is left through its taken branch */
+    uint8_t trace_blocks;
+    uint32_t trace_taken;
+    TBProfile *prof; /* counters updated by the code, or NULL */
+#ifdef TARGET_HAS_PC_MAP
+    uint8_t *pc_map; /* NULL if the TB is too large for one */
+    uint16_t pc_map_size; /* number of entries */
+#endif
 };
 
 static inline unsigned int tb_jmp_cache_hash_page(target_ulong pc)
@@ -172,21 +219,46 @@ static inline unsigned int tb_jmp_cache_hash_func(target_ulong pc)
 	    | (tmp & TB_JMP_ADDR_MASK));
 }
 
-static inline unsigned int tb_phys_hash_func(unsigned long pc)
+extern TranslationBlock **tb_phys_hash;
+extern unsigned int tb_phys_hash_bits;
+
+/* Mix the whole TB key into 32 bits.  Instructions are aligned and
+   guest pages are large, so the low bits of the PC alone are a poor
+   index.  The top bits of the result select the bucket.  */
+static inline uint32_t tb_phys_hash_key(target_ulong phys_pc,
+                                        target_ulong cs_base, uint64_t flags)
+{
+    uint64_t h;
+
+    h = (uint64_t)phys_pc ^ ((uint64_t)cs_base << 16)
+        ^ (flags * 0xff51afd7ed558ccdULL);
+    h *= 0x9e3779b97f4a7c15ULL;
+    return h >> 32;
+}
+
+static inline unsigned int tb_phys_hash_func(target_ulong phys_pc,
+                                             target_ulong cs_base,
+                                             uint64_t flags)
 {
-    return pc & (CODE_GEN_PHYS_HASH_SIZE - 1);
+    return tb_phys_hash_key(phys_pc, cs_base, flags)
+        >> (32 - tb_phys_hash_bits);
 }
 
 TranslationBlock *tb_alloc(target_ulong pc);
 void tb_free(TranslationBlock *tb);
 void tb_flush(CPUState *env);
+TranslationBlock *tb_promote(CPUState *env, TranslationBlock *tb);
+TranslationBlock *tb_cache_import(CPUState *env, target_ulong pc,
+                                  target_ulong cs_base, uint64_t flags,
+                                  target_ulong phys_pc);
 void tb_link_phys(TranslationBlock *tb,
                   target_ulong phys_pc, target_ulong phys_page2);
 void tb_phys_invalidate(TranslationBlock *tb, target_ulong page_addr);
 
-extern TranslationBlock *tb_phys_hash[CODE_GEN_PHYS_HASH_SIZE];
 extern uint8_t *code_gen_ptr;
 extern int code_gen_max_blocks;
+extern uint8_t *tb_aging_start;
+extern uint8_t *tb_aging_end;
 
 #if defined(USE_DIRECT_JUMP)
 
@@ -279,6 +351,8 @@ extern int tb_invalidated_flag;
 
 void tlb_fill(target_ulong addr, int is_write, int mmu_idx,
               void *retaddr);
+int tlb_victim_hit(CPUState *env, int mmu_idx, int index, size_t elt_ofs,
+                   target_ulong page);
 
 #include "softmmu_defs.h"
 
@@ -309,6 +383,11 @@ static inline target_ulong get_phys_addr_code(CPUState *env1, target_ulong addr)
 {
     return addr;
 }
+
+static inline void *get_host_addr_code(CPUState *env1, target_ulong addr)
+{
+    return g2h(addr & TARGET_PAGE_MASK);
+}
 #else
 /* NOTE: this function can trigger an exception */
 /* NOTE2: the returned address is not exactly the physical address: it
@@ -317,11 +396,13 @@ static inline target_ulong get_phys_addr_code(CPUState *env1, target_ulong addr)
 {
     int mmu_idx, page_index, pd;
 
-    page_index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
     mmu_idx = cpu_mmu_index_code(env1);
+    page_index = tlb_index(env1, mmu_idx, addr);
     if (unlikely(env1->tlb_table[mmu_idx][page_index].addr_code !=
                  (addr & TARGET_PAGE_MASK))) {
         ldub_code(addr);
+        /* the fill may have flushed the TLB and changed its size */
+        page_index = tlb_index(env1, mmu_idx, addr);
     }
     pd = env1->tlb_table[mmu_idx][page_index].addr_code & ~TARGET_PAGE_MASK;
     if (pd > IO_MEM_ROM && !(pd & IO_MEM_ROMD)) {
@@ -334,6 +415,27 @@ static inline target_ulong get_phys_addr_code(CPUState *env1, target_ulong addr)
     return addr + env1->tlb_table[mmu_idx][page_index].addend - (unsigned long)phys_ram_base;
 }
 
+/* Return a host pointer to the start of the guest page holding the code
+   at ADDR, or NULL if the page is not plain RAM or ROM (I/O, ROM devices,
+   watchpoints) and the code has to be read with the ld*_code accessors.
+   The page must be in the code TLB, e.g. because the code at ADDR was
+   just read.  */
+static inline void *get_host_addr_code(CPUState *env1, target_ulong addr)
+{
+    int mmu_idx, page_index, pd;
+    CPUTLBEntry *te;
+
+    mmu_idx = cpu_mmu_index_code(env1);
+    page_index = tlb_index(env1, mmu_idx, addr);
+    te = &env1->tlb_table[mmu_idx][page_index];
+    if (te->addr_code != (addr & TARGET_PAGE_MASK))
+        return NULL;
+    pd = env1->iotlb[mmu_idx][page_index] & ~TARGET_PAGE_MASK;
+    if (pd != IO_MEM_NOTDIRTY && pd != IO_MEM_ROM)
+        return NULL;
+    return (void *)(unsigned long)((addr & TARGET_PAGE_MASK) + te->addend);
+}
+
 /* Deterministic execution requires that IO only be performed on the last
    instruction of a TB so that interrupts take effect immediately.  */
 static inline int can_do_io(CPUState *env)
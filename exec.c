@@ -37,6 +37,8 @@
 #include "exec-all.h"
 #include "qemu-common.h"
 #include "tcg.h"
+#include "disas.h"
+#include "elf.h"
 #include "hw/hw.h"
 #include "osdep.h"
 #include "kvm.h"
@@ -82,7 +84,11 @@
 
 static TranslationBlock *tbs;
 int code_gen_max_blocks;
-TranslationBlock *tb_phys_hash[CODE_GEN_PHYS_HASH_SIZE];
+TranslationBlock **tb_phys_hash;
+unsigned int tb_phys_hash_bits;
+/* number of TBs in tb_phys_hash */
+static int tb_phys_hash_count;
+static void tb_phys_hash_resize(unsigned int bits);
 static int nb_tbs;
 /* any access to the tbs or the page table must use this lock */
 spinlock_t tb_lock = SPIN_LOCK_UNLOCKED;
@@ -106,13 +112,49 @@ static unsigned long code_gen_buffer_size;
 static unsigned long code_gen_buffer_max_size;
 uint8_t *code_gen_ptr;
 
+/* The code buffer is split in regions which are filled in turn.  When
+   the buffer is full, only the oldest region is reclaimed: its TBs are
+   invalidated and allocation restarts at its beginning.  Each region
+   owns a slice of tbs[], so TBs stay sorted by tc_ptr within a region
+   and tb_find_pc keeps working.  Hot TBs found in the region that will
+   be reclaimed next are retranslated into the current one.  */
+#define CODE_GEN_MAX_REGIONS 8
+/* Number of entries from cpu_exec for a TB to be worth promoting.  */
+#define TB_PROMOTE_THRESHOLD 64
+
+typedef struct CodeGenRegion {
+    uint8_t *start;
+    uint8_t *ptr;       /* end of the generated code (not maintained
+                           for the current region, see code_gen_ptr) */
+    uint8_t *max_ptr;   /* no new TB is started past this point */
+    int first_tb;       /* index of its first slot in tbs[] */
+    int nb_tbs;
+} CodeGenRegion;
+
+static CodeGenRegion code_gen_regions[CODE_GEN_MAX_REGIONS];
+static int nb_code_gen_regions;
+static int code_gen_cur_region;
+static unsigned long code_gen_region_size;
+static int code_gen_region_max_blocks;
+/* TBs in this range are in the next region to be reclaimed.  */
+uint8_t *tb_aging_start;
+uint8_t *tb_aging_end;
+
 #if !defined(CONFIG_USER_ONLY)
 ram_addr_t phys_ram_size;
 int phys_ram_fd;
 uint8_t *phys_ram_base;
 uint8_t *phys_ram_dirty;
 static int in_migration;
-static ram_addr_t phys_ram_alloc_offset = 0;
+
+/* Allocated ranges of phys_ram_base, sorted by offset.  */
+typedef struct RAMBlock {
+    ram_addr_t offset;
+    ram_addr_t length;
+    struct RAMBlock *next;
+} RAMBlock;
+
+static RAMBlock *ram_blocks;
 #endif
 
 CPUState *first_cpu;
@@ -145,6 +187,21 @@ typedef struct PhysPageDesc {
     ram_addr_t region_offset;
 } PhysPageDesc;
 
+/* The physical memory map is a sorted array of disjoint page ranges.
+   Inside a range, region_offset advances with the address, and so does
+   phys_offset for RAM and ROM backed ranges.  Unassigned pages are not
+   stored. */
+typedef struct PhysRange {
+    target_phys_addr_t start;
+    target_phys_addr_t last;    /* address of the last page */
+    ram_addr_t phys_offset;     /* descriptor of the first page */
+    ram_addr_t region_offset;
+} PhysRange;
+
+#define PHYS_MAP_L1_BITS 10
+#define PHYS_MAP_L1_SIZE (1 << PHYS_MAP_L1_BITS)
+#define PHYS_MAP_L1_SHIFT (TARGET_PHYS_ADDR_SPACE_BITS - PHYS_MAP_L1_BITS)
+
 #define L2_BITS 10
 
 #define L1_BITS_ ((TARGET_PHYS_ADDR_SPACE_BITS - TARGET_PAGE_BITS) % L2_BITS)
@@ -167,7 +224,12 @@ unsigned long qemu_host_page_mask;
    a two level map this limits the size of RAM memory that can contains
    target code.  In practice this is large enough (>= 4GB) */
 static PageDesc *l1_map[L1_SIZE];
-static PhysPageDesc **l1_phys_map;
+
+static PhysRange *phys_map;
+static unsigned int phys_map_nb, phys_map_max;
+/* for each slice of the address space, the first range that may cover it */
+static unsigned int phys_map_l1[PHYS_MAP_L1_SIZE + 1];
+static unsigned int phys_map_last;
 
 #if !defined(CONFIG_USER_ONLY)
 static void io_mem_init(void);
@@ -190,6 +252,9 @@ static int log_append = 0;
 static int tlb_flush_count;
 static int tb_flush_count;
 static int tb_phys_invalidate_count;
+static int tb_reclaim_count;
+static int tb_promote_count;
+static int tlb_victim_hit_count;
 
 #define SUBPAGE_IDX(addr) ((addr) & ~TARGET_PAGE_MASK)
 typedef struct subpage_t {
@@ -248,8 +313,6 @@ static void page_init(void)
     while ((1 << qemu_host_page_bits) < qemu_host_page_size)
         qemu_host_page_bits++;
     qemu_host_page_mask = ~(qemu_host_page_size - 1);
-    l1_phys_map = qemu_vmalloc(L1_SIZE * sizeof(void *));
-    memset(l1_phys_map, 0, L1_SIZE * sizeof(void *));
 
 #if !defined(_WIN32) && defined(CONFIG_USER_ONLY)
     {
@@ -334,49 +397,67 @@ static inline PageDesc *page_find(target_ulong index)
     return p + (index & (L2_SIZE - 1));
 }
 
-static PhysPageDesc *phys_page_find_alloc(target_phys_addr_t index, int alloc)
+static inline int phys_offset_is_linear(ram_addr_t phys_offset)
 {
-    void **lp, **p;
-    PhysPageDesc *pd;
-    int i;
+    return (phys_offset & ~TARGET_PAGE_MASK) <= IO_MEM_ROM ||
+        (phys_offset & IO_MEM_ROMD);
+}
 
-    /* Level 1.  */
-    p = (void **)l1_phys_map;
-    lp = p + ((index >> L1_SHIFT) & (L1_SIZE - 1));
+/* descriptor of the page at 'addr' inside range 'r' */
+static inline void phys_range_desc(const PhysRange *r, target_phys_addr_t addr,
+                                   PhysPageDesc *pd)
+{
+    target_phys_addr_t delta = addr - r->start;
 
-    /* Level 2..n-1 */
-    for (i = (L1_SHIFT / L2_BITS) - 1; i > 0; i--) {
-        p = *lp;
-        if (!p) {
-            /* allocate if not found */
-            if (!alloc)
-                return NULL;
-            p = qemu_vmalloc(sizeof(void *) * L2_SIZE);
-            memset(p, 0, sizeof(void *) * L2_SIZE);
-            *lp = p;
-        }
-        lp = p + ((index >> (i * L2_BITS)) & (L2_SIZE - 1));
-    }
+    pd->phys_offset = r->phys_offset;
+    if (phys_offset_is_linear(r->phys_offset))
+        pd->phys_offset += delta;
+    pd->region_offset = r->region_offset + delta;
+}
 
-    pd = *lp;
-    if (!pd) {
-        int i;
-        /* allocate if not found */
-        if (!alloc)
-            return NULL;
-        pd = qemu_vmalloc(sizeof(PhysPageDesc) * L2_SIZE);
-        *lp = pd;
-        for (i = 0; i < L2_SIZE; i++) {
-          pd[i].phys_offset = IO_MEM_UNASSIGNED;
-          pd[i].region_offset = (index + i) << TARGET_PAGE_BITS;
-        }
+/* index of the first range in [lo, hi) ending at or after 'addr' */
+static inline unsigned int phys_map_search(target_phys_addr_t addr,
+                                           unsigned int lo, unsigned int hi)
+{
+    unsigned int mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) >> 1;
+        if (phys_map[mid].last < addr)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
-    return ((PhysPageDesc *)pd) + (index & (L2_SIZE - 1));
+    return lo;
 }
 
-static inline PhysPageDesc *phys_page_find(target_phys_addr_t index)
+/* Fill 'pd' with the descriptor of physical page 'index'.  Returns NULL
+   if the page is unassigned. */
+static PhysPageDesc *phys_page_find(target_phys_addr_t index, PhysPageDesc *pd)
 {
-    return phys_page_find_alloc(index, 0);
+    target_phys_addr_t addr = index << TARGET_PAGE_BITS;
+    target_phys_addr_t bucket;
+    unsigned int i;
+    PhysRange *r;
+
+    if (phys_map_last < phys_map_nb) {
+        r = &phys_map[phys_map_last];
+        if (addr >= r->start && addr <= r->last) {
+            phys_range_desc(r, addr, pd);
+            return pd;
+        }
+    }
+    bucket = addr >> PHYS_MAP_L1_SHIFT;
+    if (bucket < PHYS_MAP_L1_SIZE)
+        i = phys_map_search(addr, phys_map_l1[bucket],
+                            phys_map_l1[bucket + 1]);
+    else
+        i = phys_map_search(addr, 0, phys_map_nb);
+    if (i >= phys_map_nb || phys_map[i].start > addr)
+        return NULL;
+    phys_map_last = i;
+    phys_range_desc(&phys_map[i], addr, pd);
+    return pd;
 }
 
 #if !defined(CONFIG_USER_ONLY)
@@ -399,6 +480,35 @@ static void tlb_unprotect_code_phys(CPUState *env, ram_addr_t ram_addr,
 static uint8_t static_code_gen_buffer[DEFAULT_CODE_GEN_BUFFER_SIZE];
 #endif
 
+#if !defined(CONFIG_USER_ONLY) && defined(__linux__)
+#define USE_TB_CACHE
+static void *tb_cache_map(void *start, unsigned long size);
+static void tb_cache_load(void);
+static void tb_cache_reset(void);
+static void tb_cache_reset_range(int first, int n);
+static const char *tb_cache_filename;
+#endif
+
+#ifdef __linux__
+#define USE_PERF_MAP
+static FILE *perf_map_file;
+static int jitdump_fd = -1;
+static void tb_perf_record(const uint8_t *code, unsigned long size,
+                           target_ulong pc);
+static void tb_perf_record_tb(TranslationBlock *tb);
+static void tb_perf_map_rewrite(void);
+#endif
+
+#ifdef USE_TB_CACHE
+/* Size of the tbs[] array, which lives right after the code buffer when
+   the translation cache is used.  */
+static unsigned long tbs_size(unsigned long buffer_size)
+{
+    return TARGET_PAGE_ALIGN((buffer_size / CODE_GEN_AVG_BLOCK_SIZE) *
+                             sizeof(TranslationBlock));
+}
+#endif
+
 static void code_gen_alloc(unsigned long tb_size)
 {
 #ifdef USE_STATIC_CODE_GEN_BUFFER
@@ -424,10 +534,16 @@ static void code_gen_alloc(unsigned long tb_size)
     {
         int flags;
         void *start = NULL;
+        unsigned long size;
 
         flags = MAP_PRIVATE | MAP_ANONYMOUS;
 #if defined(__x86_64__)
         flags |= MAP_32BIT;
+#ifdef USE_TB_CACHE
+        /* The persistent cache needs the same address at each run.  */
+        if (tb_cache_filename)
+            start = (void *) 0x50000000UL;
+#endif
         /* Cannot map more than that */
         if (code_gen_buffer_size > (800 * 1024 * 1024))
             code_gen_buffer_size = (800 * 1024 * 1024);
@@ -444,9 +560,18 @@ static void code_gen_alloc(unsigned long tb_size)
         if (code_gen_buffer_size > 16 * 1024 * 1024)
             code_gen_buffer_size = 16 * 1024 * 1024;
 #endif
-        code_gen_buffer = mmap(start, code_gen_buffer_size,
-                               PROT_WRITE | PROT_READ | PROT_EXEC,
-                               flags, -1, 0);
+        size = code_gen_buffer_size;
+        code_gen_buffer = NULL;
+#ifdef USE_TB_CACHE
+        if (tb_cache_filename) {
+            size += tbs_size(code_gen_buffer_size);
+            code_gen_buffer = tb_cache_map(start, size);
+        }
+#endif
+        if (!code_gen_buffer)
+            code_gen_buffer = mmap(start, size,
+                                   PROT_WRITE | PROT_READ | PROT_EXEC,
+                                   flags, -1, 0);
         if (code_gen_buffer == MAP_FAILED) {
             fprintf(stderr, "Could not allocate dynamic translator buffer\n");
             exit(1);
@@ -483,9 +608,43 @@ static void code_gen_alloc(unsigned long tb_size)
     code_gen_buffer_max_size = code_gen_buffer_size - 
         code_gen_max_block_size();
     code_gen_max_blocks = code_gen_buffer_size / CODE_GEN_AVG_BLOCK_SIZE;
+#ifdef USE_TB_CACHE
+    if (tb_cache_filename) {
+        tbs = (TranslationBlock *)(code_gen_buffer + code_gen_buffer_size);
+        return;
+    }
+#endif
     tbs = qemu_malloc(code_gen_max_blocks * sizeof(TranslationBlock));
 }
 
+/* Split the code buffer and tbs[] in regions.  Small buffers get fewer
+   regions so that each one still holds a reasonable number of TBs.  */
+static void code_gen_regions_init(void)
+{
+    CodeGenRegion *r;
+    int i, n;
+
+    n = CODE_GEN_MAX_REGIONS;
+    while (n > 1 &&
+           code_gen_buffer_size / n < 4 * code_gen_max_block_size())
+        n >>= 1;
+    nb_code_gen_regions = n;
+    code_gen_region_size = (code_gen_buffer_size / n) & ~(CODE_GEN_ALIGN - 1);
+    code_gen_region_max_blocks = code_gen_max_blocks / n;
+    for (i = 0; i < n; i++) {
+        r = &code_gen_regions[i];
+        r->start = code_gen_buffer + i * code_gen_region_size;
+        r->ptr = r->start;
+        r->max_ptr = r->start + code_gen_region_size
+            - code_gen_max_block_size();
+        r->first_tb = i * code_gen_region_max_blocks;
+        r->nb_tbs = 0;
+    }
+    code_gen_cur_region = 0;
+    code_gen_ptr = code_gen_buffer;
+    tb_aging_start = tb_aging_end = NULL;
+}
+
 /* Must be called before using the QEMU cpus. 'tb_size' is the size
    (in bytes) allocated to the translation buffer. Zero means default
    size. */
@@ -493,8 +652,12 @@ void cpu_exec_init_all(unsigned long tb_size)
 {
     cpu_gen_init();
     code_gen_alloc(tb_size);
-    code_gen_ptr = code_gen_buffer;
+    code_gen_regions_init();
+    tb_phys_hash_resize(CODE_GEN_PHYS_HASH_BITS);
     page_init();
+#ifdef USE_TB_CACHE
+    tb_cache_load();
+#endif
 #if !defined(CONFIG_USER_ONLY)
     io_mem_init();
 #endif
@@ -533,7 +696,7 @@ static int cpu_common_load(QEMUFile *f, void *opaque, int version_id)
 void cpu_exec_init(CPUState *env)
 {
     CPUState **penv;
-    int cpu_index;
+    int cpu_index, i;
 
 #if defined(CONFIG_USER_ONLY)
     cpu_list_lock();
@@ -548,6 +711,11 @@ void cpu_exec_init(CPUState *env)
     env->cpu_index = cpu_index;
     TAILQ_INIT(&env->breakpoints);
     TAILQ_INIT(&env->watchpoints);
+#ifdef CPU_TLB_DYNAMIC
+    for (i = 0; i < NB_MMU_MODES; i++)
+        env->tlb_mask[i] = ((1 << CPU_TLB_DEFAULT_BITS) - 1)
+            << CPU_TLB_ENTRY_BITS;
+#endif
     *penv = env;
 #if defined(CONFIG_USER_ONLY)
     cpu_list_unlock();
@@ -602,20 +770,113 @@ void tb_flush(CPUState *env1)
         cpu_abort(env1, "Internal error: code buffer overflow\n");
 
     nb_tbs = 0;
+    code_gen_regions_init();
+#ifdef USE_TB_CACHE
+    tb_cache_reset();
+#endif
 
     for(env = first_cpu; env != NULL; env = env->next_cpu) {
         memset (env->tb_jmp_cache, 0, TB_JMP_CACHE_SIZE * sizeof (void *));
     }
 
-    memset (tb_phys_hash, 0, CODE_GEN_PHYS_HASH_SIZE * sizeof (void *));
+    memset (tb_phys_hash, 0, (1 << tb_phys_hash_bits) * sizeof (void *));
+    tb_phys_hash_count = 0;
     page_flush_tb();
+#ifdef USE_PERF_MAP
+    if (perf_map_file)
+        tb_perf_map_rewrite();
+#endif
 
-    code_gen_ptr = code_gen_buffer;
     /* XXX: flush processor icache at this point if cache flush is
        expensive */
     tb_flush_count++;
 }
 
+/* Return true if TB is still reachable through tb_phys_hash.  */
+static int tb_is_linked(TranslationBlock *tb)
+{
+    TranslationBlock *tb1;
+    unsigned int h;
+
+    h = tb_phys_hash_func(tb->page_addr[0] + (tb->pc & ~TARGET_PAGE_MASK),
+                          tb->cs_base, tb->flags);
+    for (tb1 = tb_phys_hash[h]; tb1 != NULL; tb1 = tb1->phys_hash_next) {
+        if (tb1 == tb)
+            return 1;
+    }
+    return 0;
+}
+
+/* The current region is full: continue in the oldest one, invalidating
+   the TBs it holds.  Jumps into them from other regions are reset by
+   tb_phys_invalidate.  */
+static void tb_reclaim(CPUState *env1)
+{
+    CodeGenRegion *r, *next;
+    int i;
+
+    if (nb_code_gen_regions == 1) {
+        tb_flush(env1);
+        return;
+    }
+    code_gen_regions[code_gen_cur_region].ptr = code_gen_ptr;
+    code_gen_cur_region = (code_gen_cur_region + 1) % nb_code_gen_regions;
+    r = &code_gen_regions[code_gen_cur_region];
+    for (i = 0; i < r->nb_tbs; i++) {
+        if (tb_is_linked(&tbs[r->first_tb + i]))
+            tb_phys_invalidate(&tbs[r->first_tb + i], -1);
+    }
+#ifdef USE_TB_CACHE
+    tb_cache_reset_range(r->first_tb, r->nb_tbs);
+#endif
+    if (r->nb_tbs > 0)
+        tb_reclaim_count++;
+    nb_tbs -= r->nb_tbs;
+    r->nb_tbs = 0;
+    r->ptr = r->start;
+    code_gen_ptr = r->start;
+#ifdef USE_PERF_MAP
+    if (perf_map_file)
+        tb_perf_map_rewrite();
+#endif
+
+    next = &code_gen_regions[(code_gen_cur_region + 1) % nb_code_gen_regions];
+    tb_aging_start = next->start;
+    tb_aging_end = next->ptr;
+}
+
+static TranslationBlock *tb_gen_code_trace(CPUState *env, target_ulong pc,
+                                           target_ulong cs_base, int flags,
+                                           int cflags, int trace_blocks,
+                                           uint32_t trace_taken);
+
+/* TB is about to be executed from the next region to be reclaimed.  If
+   it is hot, translate it again in the current region so that it
+   survives the reclaim.  */
+TranslationBlock *tb_promote(CPUState *env, TranslationBlock *tb)
+{
+    target_ulong pc, cs_base;
+    uint64_t flags;
+    uint32_t exec_count, trace_taken;
+    int trace_blocks;
+
+    if (tb->exec_count < TB_PROMOTE_THRESHOLD || tb->cflags != 0)
+        return tb;
+    pc = tb->pc;
+    cs_base = tb->cs_base;
+    flags = tb->flags;
+    exec_count = tb->exec_count;
+    trace_blocks = tb->trace_blocks;
+    trace_taken = tb->trace_taken;
+    tb_phys_invalidate(tb, -1);
+    tb = tb_gen_code_trace(env, pc, cs_base, flags, 0,
+                           trace_blocks, trace_taken);
+    tb->exec_count = exec_count;
+    env->tb_jmp_cache[tb_jmp_cache_hash_func(pc)] = tb;
+    tb_promote_count++;
+    return tb;
+}
+
 #ifdef DEBUG_TB_CHECK
 
 static void tb_invalidate_check(target_ulong address)
@@ -623,7 +884,7 @@ static void tb_invalidate_check(target_ulong address)
     TranslationBlock *tb;
     int i;
     address &= TARGET_PAGE_MASK;
-    for(i = 0;i < CODE_GEN_PHYS_HASH_SIZE; i++) {
+    for(i = 0;i < (1 << tb_phys_hash_bits); i++) {
         for(tb = tb_phys_hash[i]; tb != NULL; tb = tb->phys_hash_next) {
             if (!(address + TARGET_PAGE_SIZE <= tb->pc ||
                   address >= tb->pc + tb->size)) {
@@ -640,7 +901,7 @@ static void tb_page_check(void)
     TranslationBlock *tb;
     int i, flags1, flags2;
 
-    for(i = 0;i < CODE_GEN_PHYS_HASH_SIZE; i++) {
+    for(i = 0;i < (1 << tb_phys_hash_bits); i++) {
         for(tb = tb_phys_hash[i]; tb != NULL; tb = tb->phys_hash_next) {
             flags1 = page_get_flags(tb->pc);
             flags2 = page_get_flags(tb->pc + tb->size - 1);
@@ -751,9 +1012,10 @@ void tb_phys_invalidate(TranslationBlock *tb, target_ulong page_addr)
 
     /* remove the TB from the hash list */
     phys_pc = tb->page_addr[0] + (tb->pc & ~TARGET_PAGE_MASK);
-    h = tb_phys_hash_func(phys_pc);
+    h = tb_phys_hash_func(phys_pc, tb->cs_base, tb->flags);
     tb_remove(&tb_phys_hash[h], tb,
               offsetof(TranslationBlock, phys_hash_next));
+    tb_phys_hash_count--;
 
     /* remove the TB from the page list */
     if (tb->page_addr[0] != page_addr) {
@@ -852,9 +1114,10 @@ static void build_page_bitmap(PageDesc *p)
     }
 }
 
-TranslationBlock *tb_gen_code(CPUState *env,
-                              target_ulong pc, target_ulong cs_base,
-                              int flags, int cflags)
+static TranslationBlock *tb_gen_code_trace(CPUState *env, target_ulong pc,
+                                           target_ulong cs_base, int flags,
+                                           int cflags, int trace_blocks,
+                                           uint32_t trace_taken)
 {
     TranslationBlock *tb;
     uint8_t *tc_ptr;
@@ -864,8 +1127,8 @@ TranslationBlock *tb_gen_code(CPUState *env,
     phys_pc = get_phys_addr_code(env, pc);
     tb = tb_alloc(pc);
     if (!tb) {
-        /* flush must be done */
-        tb_flush(env);
+        /* reclaim must be done */
+        tb_reclaim(env);
         /* cannot fail at this point */
         tb = tb_alloc(pc);
         /* Don't forget to invalidate previous TB info.  */
@@ -876,7 +1139,13 @@ TranslationBlock *tb_gen_code(CPUState *env,
     tb->cs_base = cs_base;
     tb->flags = flags;
     tb->cflags = cflags;
+    tb->trace_blocks = trace_blocks;
+    tb->trace_taken = trace_taken;
     cpu_gen_code(env, tb, &code_gen_size);
+#ifdef USE_PERF_MAP
+    if (perf_map_file || jitdump_fd >= 0)
+        tb_perf_record(tc_ptr, code_gen_size, pc);
+#endif
     code_gen_ptr = (void *)(((unsigned long)code_gen_ptr + code_gen_size + CODE_GEN_ALIGN - 1) & ~(CODE_GEN_ALIGN - 1));
 
     /* check next page if needed */
@@ -889,6 +1158,171 @@ TranslationBlock *tb_gen_code(CPUState *env,
     return tb;
 }
 
+TranslationBlock *tb_gen_code(CPUState *env,
+                              target_ulong pc, target_ulong cs_base,
+                              int flags, int cflags)
+{
+    return tb_gen_code_trace(env, pc, cs_base, flags, cflags, 0, 0);
+}
+
+/* Superblocks.  Until a TB has been entered tb_trace_threshold times
+   from cpu_exec, the dispatcher counts which TB follows it.  It is
+   then translated again together with the blocks that most often
+   follow it: conditional branches leaving the path become side exits
+   to the dispatcher.  The path is described by the number of guest
+   blocks and, for each block, whether it is left through the taken
+   side of its final branch, so that gen_intermediate_code_pc() can
+   regenerate the same code.  All blocks must lie in the page of the
+   first one and after it, so that [pc, pc + size[ covers the guest
+   code for self-modifying code detection.  */
+int tb_trace_threshold;
+static int tb_trace_count;
+
+static TranslationBlock *tb_gen_trace(CPUState *env, TranslationBlock *head)
+{
+    TranslationBlock *cur, *next, *tb;
+    target_ulong pc, cs_base, path[TB_TRACE_MAX_BLOCKS];
+    uint64_t flags;
+    uint32_t total, taken;
+    int i, n, nb_blocks;
+
+    if (head->cflags != 0 || env->singlestep_enabled)
+        return head;
+    pc = head->pc;
+    cs_base = head->cs_base;
+    flags = head->flags;
+    taken = 0;
+    nb_blocks = 1;
+    path[0] = pc;
+    for (cur = head; nb_blocks < TB_TRACE_MAX_BLOCKS; cur = next) {
+        /* follow the successor seen at least 3 times out of 4 */
+        total = cur->trace_succ_count[0] + cur->trace_succ_count[1] +
+            cur->trace_succ_count[2];
+        n = cur->trace_succ_count[1] > cur->trace_succ_count[0];
+        next = cur->trace_succ[n];
+        if (!next || cur->trace_succ_count[n] * 4 < total * 3)
+            break;
+        if (next->trace_blocks || next->cs_base != cs_base ||
+            next->flags != flags || next->pc <= pc ||
+            (next->pc & TARGET_PAGE_MASK) != (pc & TARGET_PAGE_MASK))
+            break;
+        for (i = 0; i < nb_blocks; i++) {
+            if (path[i] == next->pc)
+                break;
+        }
+        if (i < nb_blocks)
+            break;
+        if (next->pc != cur->pc + cur->size)
+            taken |= 1 << (nb_blocks - 1);
+        path[nb_blocks++] = next->pc;
+    }
+    if (nb_blocks < 2)
+        return head;
+
+    tb_phys_invalidate(head, -1);
+    tb = tb_gen_code_trace(env, pc, cs_base, flags, 0, nb_blocks, taken);
+    tb->exec_count = tb_trace_threshold;
+    env->tb_jmp_cache[tb_jmp_cache_hash_func(pc)] = tb;
+    tb_trace_count++;
+    return tb;
+}
+
+/* 'tb' is about to be executed, right after 'prev' if not NULL.  */
+TranslationBlock *tb_trace_profile(CPUState *env, TranslationBlock *prev,
+                                   TranslationBlock *tb)
+{
+    if (prev && !prev->trace_blocks &&
+        prev->exec_count <= tb_trace_threshold) {
+        if (prev->trace_succ[0] == tb) {
+            prev->trace_succ_count[0]++;
+        } else if (prev->trace_succ[1] == tb) {
+            prev->trace_succ_count[1]++;
+        } else if (!prev->trace_succ[0]) {
+            prev->trace_succ[0] = tb;
+            prev->trace_succ_count[0] = 1;
+        } else if (!prev->trace_succ[1]) {
+            prev->trace_succ[1] = tb;
+            prev->trace_succ_count[1] = 1;
+        } else {
+            prev->trace_succ_count[2]++;
+        }
+    }
+    if (tb->exec_count == tb_trace_threshold && !tb->trace_blocks)
+        tb = tb_gen_trace(env, tb);
+    return tb;
+}
+
+/* Execution profile.  While it is enabled, the code of each TB counts
+   its entries, exits to cpu_exec and helper calls in the TBProfile of
+   its guest PC, and the softmmu slow path counts TLB misses in the
+   profile of the TB doing the access.  The profiles are kept across
+   translations, so tb_flush() does not lose them.  */
+#define TB_PROF_HASH_BITS 12
+#define TB_PROF_HASH_SIZE (1 << TB_PROF_HASH_BITS)
+
+int tb_prof_enabled;
+static TBProfile *tb_prof_hash[TB_PROF_HASH_SIZE];
+static int tb_prof_count;
+
+static TBProfile *tb_prof_get(target_ulong pc)
+{
+    TBProfile **pp, *p;
+
+    pp = &tb_prof_hash[(pc ^ (pc >> TB_PROF_HASH_BITS)) &
+                       (TB_PROF_HASH_SIZE - 1)];
+    for (p = *pp; p; p = p->next) {
+        if (p->pc == pc)
+            return p;
+    }
+    p = qemu_mallocz(sizeof(*p));
+    p->pc = pc;
+    p->next = *pp;
+    *pp = p;
+    tb_prof_count++;
+    return p;
+}
+
+/* Start or stop profiling.  The translations are flushed so that the
+   code is generated again with or without the counters.  */
+void tb_prof_enable(int enable)
+{
+    enable = !!enable;
+    if (enable == tb_prof_enabled)
+        return;
+    tb_prof_enabled = enable;
+    if (first_cpu)
+        tb_flush(first_cpu);
+}
+
+/* Clear the counters.  The profiles themselves stay allocated, as the
+   generated code may still refer to them.  */
+void tb_prof_reset(void)
+{
+    TBProfile *p;
+    int i;
+
+    for (i = 0; i < TB_PROF_HASH_SIZE; i++) {
+        for (p = tb_prof_hash[i]; p; p = p->next) {
+            p->entries = 0;
+            p->exits = 0;
+            p->helpers = 0;
+            p->tlb_misses = 0;
+        }
+    }
+}
+
+/* The TLB missed for an access done by the code at 'retaddr'.  */
+void tb_prof_tlb_miss(unsigned long retaddr)
+{
+    TranslationBlock *tb;
+
+    if (!retaddr)
+        return;
+    tb = tb_find_pc(retaddr);
+    if (tb && tb->prof)
+        tb->prof->tlb_misses++;
+}
+
 /* invalidate all TBs which intersect with the target physical page
    starting in range [start;end[. NOTE: start and end must refer to
    the same physical page. 'is_cpu_write_access' should be true if called
@@ -1147,28 +1581,67 @@ static inline void tb_alloc_page(TranslationBlock *tb,
    too many translation blocks or too much generated code. */
 TranslationBlock *tb_alloc(target_ulong pc)
 {
+    CodeGenRegion *r = &code_gen_regions[code_gen_cur_region];
     TranslationBlock *tb;
 
-    if (nb_tbs >= code_gen_max_blocks ||
-        (code_gen_ptr - code_gen_buffer) >= code_gen_buffer_max_size)
+    if (r->nb_tbs >= code_gen_region_max_blocks ||
+        code_gen_ptr >= r->max_ptr)
         return NULL;
-    tb = &tbs[nb_tbs++];
+    tb = &tbs[r->first_tb + r->nb_tbs++];
+    nb_tbs++;
     tb->pc = pc;
     tb->cflags = 0;
+    tb->exec_count = 0;
+    tb->trace_succ[0] = NULL;
+    tb->trace_succ[1] = NULL;
+    memset(tb->trace_succ_count, 0, sizeof(tb->trace_succ_count));
+    tb->trace_blocks = 0;
+    tb->trace_taken = 0;
+    tb->prof = tb_prof_enabled ? tb_prof_get(pc) : NULL;
     return tb;
 }
 
 void tb_free(TranslationBlock *tb)
 {
+    CodeGenRegion *r = &code_gen_regions[code_gen_cur_region];
+
     /* In practice this is mostly used for single use temporary TB
        Ignore the hard cases and just back up if this TB happens to
        be the last one generated.  */
-    if (nb_tbs > 0 && tb == &tbs[nb_tbs - 1]) {
+    if (r->nb_tbs > 0 && tb == &tbs[r->first_tb + r->nb_tbs - 1]) {
         code_gen_ptr = tb->tc_ptr;
+        r->nb_tbs--;
         nb_tbs--;
     }
 }
 
+/* Allocate the physical TB hash table with 2^bits buckets and move the
+   existing TBs to it.  */
+static void tb_phys_hash_resize(unsigned int bits)
+{
+    TranslationBlock **old_hash, **ptb, *tb, *next;
+    unsigned int old_bits, i, h;
+
+    old_hash = tb_phys_hash;
+    old_bits = tb_phys_hash_bits;
+    tb_phys_hash = qemu_mallocz((1 << bits) * sizeof(TranslationBlock *));
+    tb_phys_hash_bits = bits;
+    if (!old_hash)
+        return;
+    for (i = 0; i < (1 << old_bits); i++) {
+        for (tb = old_hash[i]; tb != NULL; tb = next) {
+            next = tb->phys_hash_next;
+            h = tb_phys_hash_func(tb->page_addr[0]
+                                  + (tb->pc & ~TARGET_PAGE_MASK),
+                                  tb->cs_base, tb->flags);
+            ptb = &tb_phys_hash[h];
+            tb->phys_hash_next = *ptb;
+            *ptb = tb;
+        }
+    }
+    qemu_free(old_hash);
+}
+
 /* add a new TB and link it to the physical page tables. phys_page2 is
    (-1) to indicate that only one page contains the TB. */
 void tb_link_phys(TranslationBlock *tb,
@@ -1180,11 +1653,16 @@ void tb_link_phys(TranslationBlock *tb,
     /* Grab the mmap lock to stop another thread invalidating this TB
        before we are done.  */
     mmap_lock();
+    /* keep the chains short */
+    if (tb_phys_hash_count >= (1 << tb_phys_hash_bits) &&
+        tb_phys_hash_bits < CODE_GEN_PHYS_HASH_MAX_BITS)
+        tb_phys_hash_resize(tb_phys_hash_bits + 1);
     /* add in the physical hash table */
-    h = tb_phys_hash_func(phys_pc);
+    h = tb_phys_hash_func(phys_pc, tb->cs_base, tb->flags);
     ptb = &tb_phys_hash[h];
     tb->phys_hash_next = *ptb;
     *ptb = tb;
+    tb_phys_hash_count++;
 
     /* add in the page list */
     tb_alloc_page(tb, 0, phys_pc & TARGET_PAGE_MASK);
@@ -1209,25 +1687,708 @@ void tb_link_phys(TranslationBlock *tb,
     mmap_unlock();
 }
 
+#ifdef USE_TB_CACHE
+/* Persistent translation cache.
+
+   The code buffer and the tbs[] array are mapped from a file at the same
+   host address at each run, so that the generated code (which contains
+   absolute addresses of helpers, of the prologue and of TBs) can be used
+   as is.  The cache is only accepted for the very same executable and
+   configuration.  Saved TBs are not linked at startup: tb_find_slow
+   imports them on demand after checking that the guest code they were
+   translated from is unchanged.  */
+
+#define TB_CACHE_MAGIC   0x51544243     /* "QTBC" */
+#define TB_CACHE_VERSION 4
+#define TB_CACHE_HDR_SIZE 4096
+
+#define TB_CACHE_DEAD    0
+#define TB_CACHE_LIVE    1
+
+typedef struct TBCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    char config[128];
+    /* Identity of the executable.  */
+    uint64_t exe_size;
+    uint64_t exe_mtime;
+    uint64_t exe_ino;
+    uint64_t prologue_addr;
+    uint32_t prologue_sum;
+    uint32_t tb_struct_size;
+    /* Code buffer.  */
+    uint64_t buffer_addr;
+    uint64_t buffer_size;
+    uint32_t nb_regions;
+    uint32_t cur_region;
+    uint64_t region_code_size[CODE_GEN_MAX_REGIONS];
+    uint32_t region_nb_tbs[CODE_GEN_MAX_REGIONS];
+    int32_t use_icount;
+    int32_t tcg_optimize;
+    /* Guest code of the TBs, after the mapped area.  */
+    uint64_t guest_size;
+} TBCacheHeader;
+
+static TBCacheHeader tb_cache_hdr;
+static uint32_t tb_cache_saved_prologue_sum;
+static int tb_cache_fd = -1;
+static int tb_cache_mapped;
+/* Not yet imported TBs, chained by the top CODE_GEN_PHYS_HASH_BITS of
+   their tb_phys_hash_key.  */
+static int *tb_cache_hash;
+static int *tb_cache_next;
+static uint8_t *tb_cache_state;
+static uint32_t *tb_cache_guest_off;
+static uint8_t *tb_cache_guest;
+static unsigned long tb_cache_hits;
+
+static uint32_t tb_cache_prologue_sum(void)
+{
+    uint32_t sum = 0;
+    int i;
+
+    for (i = 0; i < sizeof(code_gen_prologue); i++)
+        sum = (sum << 5) + sum + code_gen_prologue[i];
+    return sum;
+}
+
+static void tb_cache_fill_header(TBCacheHeader *h, const char *config)
+{
+    struct stat st;
+
+    memset(h, 0, sizeof(*h));
+    h->magic = TB_CACHE_MAGIC;
+    h->version = TB_CACHE_VERSION;
+    pstrcpy(h->config, sizeof(h->config), config);
+    if (stat("/proc/self/exe", &st) == 0) {
+        h->exe_size = st.st_size;
+        h->exe_mtime = st.st_mtime;
+        h->exe_ino = st.st_ino;
+    }
+    h->prologue_addr = (unsigned long)code_gen_prologue;
+    h->tb_struct_size = sizeof(TranslationBlock);
+    h->use_icount = use_icount;
+    h->tcg_optimize = tcg_optimize_enabled;
+}
+
+/* Select FILENAME as translation cache.  CONFIG describes everything
+   that changes the generated code apart from the executable (machine,
+   cpu model...).  Must be called before cpu_exec_init_all.  */
+void tb_cache_open(const char *filename, const char *config)
+{
+    TBCacheHeader h;
+
+    tb_cache_filename = filename;
+    tb_cache_fill_header(&tb_cache_hdr, config);
+
+    tb_cache_fd = open(filename, O_RDONLY);
+    if (tb_cache_fd < 0)
+        return;
+    if (pread(tb_cache_fd, &h, sizeof(h), 0) != sizeof(h)
+        || h.magic != TB_CACHE_MAGIC || h.version != TB_CACHE_VERSION
+        || strcmp(h.config, tb_cache_hdr.config) != 0
+        || h.exe_size != tb_cache_hdr.exe_size
+        || h.exe_mtime != tb_cache_hdr.exe_mtime
+        || h.exe_ino != tb_cache_hdr.exe_ino
+        || h.prologue_addr != tb_cache_hdr.prologue_addr
+        || h.tb_struct_size != tb_cache_hdr.tb_struct_size
+        || h.use_icount != tb_cache_hdr.use_icount
+        || h.tcg_optimize != tb_cache_hdr.tcg_optimize) {
+        /* Stale: it will be replaced at exit.  */
+        close(tb_cache_fd);
+        tb_cache_fd = -1;
+        return;
+    }
+    tb_cache_hdr.buffer_addr = h.buffer_addr;
+    tb_cache_hdr.buffer_size = h.buffer_size;
+    tb_cache_hdr.nb_regions = h.nb_regions;
+    tb_cache_hdr.cur_region = h.cur_region;
+    memcpy(tb_cache_hdr.region_code_size, h.region_code_size,
+           sizeof(h.region_code_size));
+    memcpy(tb_cache_hdr.region_nb_tbs, h.region_nb_tbs,
+           sizeof(h.region_nb_tbs));
+    tb_cache_hdr.guest_size = h.guest_size;
+    tb_cache_saved_prologue_sum = h.prologue_sum;
+}
+
+/* Map the saved code buffer and tbs[].  Returns NULL if the cache cannot
+   be used, in which case the caller allocates an empty buffer.  */
+static void *tb_cache_map(void *start, unsigned long size)
+{
+    void *p;
+
+    if (tb_cache_fd < 0)
+        return NULL;
+    /* The prologue has been generated by cpu_gen_init.  */
+    if (tb_cache_hdr.buffer_size != code_gen_buffer_size
+        || tb_cache_saved_prologue_sum != tb_cache_prologue_sum())
+        goto fail;
+    p = mmap((void *)(unsigned long)tb_cache_hdr.buffer_addr, size,
+             PROT_WRITE | PROT_READ | PROT_EXEC, MAP_PRIVATE,
+             tb_cache_fd, TB_CACHE_HDR_SIZE);
+    if (p == MAP_FAILED)
+        goto fail;
+    if ((unsigned long)p != tb_cache_hdr.buffer_addr) {
+        munmap(p, size);
+        goto fail;
+    }
+    tb_cache_mapped = 1;
+    return p;
+ fail:
+    close(tb_cache_fd);
+    tb_cache_fd = -1;
+    return NULL;
+}
+
+/* Read the TB states and guest code, and make the saved TBs available
+   to tb_cache_import.  */
+static void tb_cache_load(void)
+{
+    unsigned long off;
+    int n, i, ok;
+    unsigned int h;
+    TranslationBlock *tb;
+    CodeGenRegion *r;
+
+    if (!tb_cache_filename)
+        return;
+    tb_cache_hash = qemu_mallocz(CODE_GEN_PHYS_HASH_SIZE * sizeof(int));
+    tb_cache_next = qemu_malloc(code_gen_max_blocks * sizeof(int));
+    tb_cache_state = qemu_mallocz(code_gen_max_blocks);
+    tb_cache_guest_off = qemu_mallocz(code_gen_max_blocks * sizeof(uint32_t));
+    tb_cache_reset();
+    if (!tb_cache_mapped) {
+        if (tb_cache_fd >= 0)
+            close(tb_cache_fd);
+        tb_cache_fd = -1;
+        return;
+    }
+
+    n = code_gen_max_blocks;
+    ok = tb_cache_hdr.nb_regions == nb_code_gen_regions
+        && tb_cache_hdr.cur_region < nb_code_gen_regions;
+    for (i = 0; ok && i < nb_code_gen_regions; i++) {
+        if (tb_cache_hdr.region_code_size[i] > code_gen_region_size
+            || tb_cache_hdr.region_nb_tbs[i] > code_gen_region_max_blocks)
+            ok = 0;
+    }
+    off = TB_CACHE_HDR_SIZE + code_gen_buffer_size
+        + tbs_size(code_gen_buffer_size);
+    tb_cache_guest = qemu_malloc(tb_cache_hdr.guest_size + 1);
+    if (!ok
+        || pread(tb_cache_fd, tb_cache_state, n, off) != n
+        || pread(tb_cache_fd, tb_cache_guest_off, n * sizeof(uint32_t),
+                 off + n) != n * sizeof(uint32_t)
+        || pread(tb_cache_fd, tb_cache_guest, tb_cache_hdr.guest_size,
+                 off + n + n * sizeof(uint32_t)) != tb_cache_hdr.guest_size) {
+        fprintf(stderr, "qemu: translation cache %s is truncated\n",
+                tb_cache_filename);
+        memset(tb_cache_state, 0, code_gen_max_blocks);
+        close(tb_cache_fd);
+        tb_cache_fd = -1;
+        return;
+    }
+    close(tb_cache_fd);
+    tb_cache_fd = -1;
+
+    for (i = 0; i < nb_code_gen_regions; i++) {
+        r = &code_gen_regions[i];
+        r->ptr = r->start + tb_cache_hdr.region_code_size[i];
+        r->nb_tbs = tb_cache_hdr.region_nb_tbs[i];
+        nb_tbs += r->nb_tbs;
+    }
+    code_gen_cur_region = tb_cache_hdr.cur_region;
+    code_gen_ptr = code_gen_regions[code_gen_cur_region].ptr;
+    r = &code_gen_regions[(code_gen_cur_region + 1) % nb_code_gen_regions];
+    if (nb_code_gen_regions > 1) {
+        tb_aging_start = r->start;
+        tb_aging_end = r->ptr;
+    }
+    for (i = n - 1; i >= 0; i--) {
+        if (tb_cache_state[i] != TB_CACHE_LIVE)
+            continue;
+        tb = &tbs[i];
+        if (tb_cache_guest_off[i] + tb->size > tb_cache_hdr.guest_size) {
+            tb_cache_state[i] = TB_CACHE_DEAD;
+            continue;
+        }
+        h = tb_phys_hash_key(tb->page_addr[0] + (tb->pc & ~TARGET_PAGE_MASK),
+                             tb->cs_base, tb->flags)
+            >> (32 - CODE_GEN_PHYS_HASH_BITS);
+        tb_cache_next[i] = tb_cache_hash[h];
+        tb_cache_hash[h] = i;
+    }
+}
+
+/* Forget the saved TBs (their slots are about to be reused).  */
+static void tb_cache_reset(void)
+{
+    int i;
+
+    if (!tb_cache_hash)
+        return;
+    for (i = 0; i < CODE_GEN_PHYS_HASH_SIZE; i++)
+        tb_cache_hash[i] = -1;
+    memset(tb_cache_state, 0, code_gen_max_blocks);
+}
+
+/* Forget the saved TBs in slots [first, first + n[ (their region is
+   being reclaimed).  They are unchained lazily by tb_cache_import.  */
+static void tb_cache_reset_range(int first, int n)
+{
+    if (!tb_cache_state)
+        return;
+    memset(tb_cache_state + first, TB_CACHE_DEAD, n);
+}
+
+/* Copy the guest code translated by TB.  */
+static void tb_cache_read_guest(TranslationBlock *tb, uint8_t *buf)
+{
+    target_ulong offset = tb->pc & ~TARGET_PAGE_MASK;
+    int len;
+
+    len = tb->size;
+    if (offset + len > TARGET_PAGE_SIZE)
+        len = TARGET_PAGE_SIZE - offset;
+    /* page_addr[] are offsets in phys_ram_base, not guest physical
+       addresses.  */
+    memcpy(buf, phys_ram_base + tb->page_addr[0] + offset, len);
+    if (len < tb->size)
+        memcpy(buf + len, phys_ram_base + tb->page_addr[1], tb->size - len);
+}
+
+/* Look for a saved TB for this CPU state and link it if the guest code
+   it was translated from is unchanged.  */
+TranslationBlock *tb_cache_import(CPUState *env, target_ulong pc,
+                                  target_ulong cs_base, uint64_t flags,
+                                  target_ulong phys_pc)
+{
+    TranslationBlock *tb;
+    target_ulong phys_page2;
+    uint8_t buf[2 * TARGET_PAGE_SIZE];
+    int *pidx, i;
+
+    /* saved TBs do not update the execution profile */
+    if (!tb_cache_hash || tb_prof_enabled)
+        return NULL;
+    pidx = &tb_cache_hash[tb_phys_hash_key(phys_pc, cs_base, flags)
+                          >> (32 - CODE_GEN_PHYS_HASH_BITS)];
+    while ((i = *pidx) >= 0) {
+        if (tb_cache_state[i] != TB_CACHE_LIVE) {
+            /* Its region has been reclaimed since.  */
+            *pidx = tb_cache_next[i];
+            continue;
+        }
+        tb = &tbs[i];
+        if (tb->pc != pc || tb->cs_base != cs_base || tb->flags != flags
+            || tb->cflags != 0
+            || tb->page_addr[0] != (phys_pc & TARGET_PAGE_MASK)) {
+            pidx = &tb_cache_next[i];
+            continue;
+        }
+        phys_page2 = -1;
+        if (tb->page_addr[1] != -1) {
+            phys_page2 = get_phys_addr_code(env, (pc & TARGET_PAGE_MASK)
+                                            + TARGET_PAGE_SIZE);
+            if (tb->page_addr[1] != phys_page2) {
+                pidx = &tb_cache_next[i];
+                continue;
+            }
+        }
+        /* Whatever the outcome, this entry is consumed.  */
+        *pidx = tb_cache_next[i];
+        tb_cache_state[i] = TB_CACHE_DEAD;
+        tb_cache_read_guest(tb, buf);
+        if (memcmp(buf, tb_cache_guest + tb_cache_guest_off[i], tb->size))
+            return NULL;
+        tb->exec_count = 0;
+        tb->trace_succ[0] = NULL;
+        tb->trace_succ[1] = NULL;
+        memset(tb->trace_succ_count, 0, sizeof(tb->trace_succ_count));
+        tb_link_phys(tb, phys_pc, phys_page2);
+        tb_cache_hits++;
+#ifdef USE_PERF_MAP
+        if (perf_map_file || jitdump_fd >= 0)
+            tb_perf_record_tb(tb);
+#endif
+        return tb;
+    }
+    return NULL;
+}
+
+/* Write the current translations to the cache file.  */
+void tb_cache_save(void)
+{
+    TBCacheHeader h;
+    TranslationBlock *tb;
+    uint8_t *state, *guest;
+    uint32_t *guest_off;
+    unsigned long guest_size, off;
+    char *tmp;
+    int fd, i, n, ok;
+    CodeGenRegion *r;
+
+    if (!tb_cache_filename || !code_gen_buffer)
+        return;
+
+    n = code_gen_max_blocks;
+    state = qemu_mallocz(n + 1);
+    guest_off = qemu_mallocz((n + 1) * sizeof(uint32_t));
+    guest_size = 0;
+    for (i = 0; i < (1 << tb_phys_hash_bits); i++)
+        for (tb = tb_phys_hash[i]; tb; tb = tb->phys_hash_next)
+            if (tb->cflags == 0 && !tb->prof)
+                state[tb - tbs] = TB_CACHE_LIVE;
+    for (i = 0; i < n; i++) {
+        if (tb_cache_state[i] == TB_CACHE_LIVE)
+            state[i] = TB_CACHE_LIVE;
+        if (state[i] == TB_CACHE_LIVE) {
+            guest_off[i] = guest_size;
+            guest_size += tbs[i].size;
+        }
+    }
+    guest = qemu_malloc(guest_size + 1);
+    for (i = 0; i < n; i++) {
+        if (state[i] != TB_CACHE_LIVE)
+            continue;
+        if (tb_cache_state[i] == TB_CACHE_LIVE)
+            memcpy(guest + guest_off[i],
+                   tb_cache_guest + tb_cache_guest_off[i], tbs[i].size);
+        else
+            tb_cache_read_guest(&tbs[i], guest + guest_off[i]);
+    }
+
+    h = tb_cache_hdr;
+    h.prologue_sum = tb_cache_prologue_sum();
+    h.buffer_addr = (unsigned long)code_gen_buffer;
+    h.buffer_size = code_gen_buffer_size;
+    h.nb_regions = nb_code_gen_regions;
+    h.cur_region = code_gen_cur_region;
+    code_gen_regions[code_gen_cur_region].ptr = code_gen_ptr;
+    for (i = 0; i < nb_code_gen_regions; i++) {
+        r = &code_gen_regions[i];
+        h.region_code_size[i] = r->ptr - r->start;
+        h.region_nb_tbs[i] = r->nb_tbs;
+    }
+    h.guest_size = guest_size;
+
+    tmp = qemu_malloc(strlen(tb_cache_filename) + 8);
+    sprintf(tmp, "%s.tmp", tb_cache_filename);
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ok = 0;
+    if (fd >= 0) {
+        off = TB_CACHE_HDR_SIZE + code_gen_buffer_size
+            + tbs_size(code_gen_buffer_size);
+        ok = pwrite(fd, &h, sizeof(h), 0) == sizeof(h);
+        for (i = 0; ok && i < nb_code_gen_regions; i++) {
+            r = &code_gen_regions[i];
+            ok = pwrite(fd, r->start, h.region_code_size[i],
+                        TB_CACHE_HDR_SIZE + (r->start - code_gen_buffer))
+                   == h.region_code_size[i]
+                && pwrite(fd, &tbs[r->first_tb],
+                          r->nb_tbs * sizeof(TranslationBlock),
+                          TB_CACHE_HDR_SIZE + code_gen_buffer_size
+                          + r->first_tb * sizeof(TranslationBlock))
+                   == r->nb_tbs * sizeof(TranslationBlock);
+        }
+        ok = ok
+            && pwrite(fd, state, n, off) == n
+            && pwrite(fd, guest_off, n * sizeof(uint32_t), off + n)
+               == n * sizeof(uint32_t)
+            && pwrite(fd, guest, guest_size, off + n + n * sizeof(uint32_t))
+               == guest_size;
+        close(fd);
+    }
+    if (!ok || rename(tmp, tb_cache_filename) < 0) {
+        fprintf(stderr, "qemu: could not write translation cache %s\n",
+                tb_cache_filename);
+        unlink(tmp);
+    }
+    qemu_free(tmp);
+    qemu_free(guest);
+    qemu_free(guest_off);
+    qemu_free(state);
+}
+
+#else
+
+void tb_cache_open(const char *filename, const char *config)
+{
+    fprintf(stderr, "qemu: translation cache not supported on this host\n");
+}
+
+TranslationBlock *tb_cache_import(CPUState *env, target_ulong pc,
+                                  target_ulong cs_base, uint64_t flags,
+                                  target_ulong phys_pc)
+{
+    return NULL;
+}
+
+void tb_cache_save(void)
+{
+}
+
+#endif /* USE_TB_CACHE */
+
+#ifdef USE_PERF_MAP
+
+/* Host profiler support.  With -perfmap, /tmp/perf-<pid>.map names the
+   host code of each TB after its guest PC and symbol, in the format perf
+   uses for code generated at run time.  The file is written again when
+   TBs are discarded, so it only describes live code.  With -jitdump,
+   each translation is also appended with its code to a jitdump file
+   (see perf-inject(1)); its timestamps let perf attribute samples to
+   the right TB when the code buffer is reused.  */
+
+#define JITDUMP_MAGIC     0x4A695444
+#define JITDUMP_CODE_LOAD 0
+
+typedef struct JITDumpHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+} JITDumpHeader;
+
+typedef struct JITDumpCodeLoad {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+    /* followed by the name and the code */
+} JITDumpCodeLoad;
+
+static uint64_t jitdump_code_index;
+
+static uint64_t jitdump_timestamp(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void tb_perf_name(char *buf, int buf_size, target_ulong pc)
+{
+    const char *symbol = lookup_symbol(pc);
+
+    if (symbol[0] != '\0')
+        snprintf(buf, buf_size, "%s:" TARGET_FMT_lx, symbol, pc);
+    else
+        snprintf(buf, buf_size, "guest:" TARGET_FMT_lx, pc);
+}
+
+static void tb_perf_map_write(const uint8_t *code, unsigned long size,
+                              const char *name)
+{
+    fprintf(perf_map_file, "%lx %lx %s\n", (unsigned long)code, size, name);
+}
+
+static void jitdump_write(const uint8_t *code, unsigned long size,
+                          const char *name)
+{
+    JITDumpCodeLoad r;
+    int name_len = strlen(name) + 1;
+
+    r.id = JITDUMP_CODE_LOAD;
+    r.total_size = sizeof(r) + name_len + size;
+    r.timestamp = jitdump_timestamp();
+    r.pid = getpid();
+    r.tid = r.pid;
+    r.vma = (unsigned long)code;
+    r.code_addr = (unsigned long)code;
+    r.code_size = size;
+    r.code_index = jitdump_code_index++;
+    if (write(jitdump_fd, &r, sizeof(r)) != sizeof(r)
+        || write(jitdump_fd, name, name_len) != name_len
+        || write(jitdump_fd, code, size) != size) {
+        fprintf(stderr, "qemu: could not write jitdump file\n");
+        close(jitdump_fd);
+        jitdump_fd = -1;
+    }
+}
+
+/* The host code at [code, code + size[ was generated for guest 'pc'.  */
+static void tb_perf_record(const uint8_t *code, unsigned long size,
+                           target_ulong pc)
+{
+    char name[256];
+
+    tb_perf_name(name, sizeof(name), pc);
+    if (perf_map_file)
+        tb_perf_map_write(code, size, name);
+    if (jitdump_fd >= 0)
+        jitdump_write(code, size, name);
+}
+
+/* Size of the host code of a TB of a region, up to the next one.  */
+static unsigned long tb_code_size(CodeGenRegion *r, int i)
+{
+    uint8_t *end;
+
+    if (i + 1 < r->nb_tbs)
+        end = tbs[r->first_tb + i + 1].tc_ptr;
+    else if (r == &code_gen_regions[code_gen_cur_region])
+        end = code_gen_ptr;
+    else
+        end = r->ptr;
+    return end - tbs[r->first_tb + i].tc_ptr;
+}
+
+static void tb_perf_record_tb(TranslationBlock *tb)
+{
+    CodeGenRegion *r;
+    int i, n;
+
+    n = tb - tbs;
+    for (i = 0; i < nb_code_gen_regions; i++) {
+        r = &code_gen_regions[i];
+        if (n >= r->first_tb && n < r->first_tb + r->nb_tbs) {
+            tb_perf_record(tb->tc_ptr, tb_code_size(r, n - r->first_tb),
+                           tb->pc);
+            return;
+        }
+    }
+}
+
+/* Describe the prologue and the TBs of the code buffer from scratch.  */
+static void tb_perf_map_rewrite(void)
+{
+    CodeGenRegion *r;
+    TranslationBlock *tb;
+    char name[256];
+    int i, j;
+
+    fflush(perf_map_file);
+    if (ftruncate(fileno(perf_map_file), 0) < 0)
+        return;
+    rewind(perf_map_file);
+    tb_perf_map_write(code_gen_prologue, sizeof(code_gen_prologue),
+                      "qemu_prologue");
+    for (i = 0; i < nb_code_gen_regions; i++) {
+        r = &code_gen_regions[i];
+        for (j = 0; j < r->nb_tbs; j++) {
+            tb = &tbs[r->first_tb + j];
+            tb_perf_name(name, sizeof(name), tb->pc);
+            tb_perf_map_write(tb->tc_ptr, tb_code_size(r, j), name);
+        }
+    }
+}
+
+static uint32_t jitdump_elf_mach(void)
+{
+#if defined(__x86_64__)
+    return EM_X86_64;
+#elif defined(__i386__)
+    return EM_386;
+#elif defined(__powerpc64__)
+    return EM_PPC64;
+#elif defined(__powerpc__)
+    return EM_PPC;
+#elif defined(__arm__)
+    return EM_ARM;
+#elif defined(__sparc__)
+    return EM_SPARC;
+#else
+    return EM_NONE;
+#endif
+}
+
+/* Start describing the generated code for host profilers.  Must be
+   called after cpu_exec_init_all.  */
+void tb_perf_open(int perf_map, int jitdump)
+{
+    char filename[64];
+    JITDumpHeader h;
+    void *marker;
+
+    if (perf_map) {
+        snprintf(filename, sizeof(filename), "/tmp/perf-%d.map", getpid());
+        perf_map_file = fopen(filename, "w");
+        if (!perf_map_file) {
+            fprintf(stderr, "qemu: could not create %s\n", filename);
+        } else {
+            setvbuf(perf_map_file, NULL, _IOLBF, 0);
+            tb_perf_map_rewrite();
+        }
+    }
+    if (jitdump) {
+        snprintf(filename, sizeof(filename), "/tmp/jit-%d.dump", getpid());
+        jitdump_fd = open(filename, O_CREAT | O_TRUNC | O_RDWR, 0666);
+        if (jitdump_fd < 0) {
+            fprintf(stderr, "qemu: could not create %s\n", filename);
+            return;
+        }
+        memset(&h, 0, sizeof(h));
+        h.magic = JITDUMP_MAGIC;
+        h.version = 1;
+        h.total_size = sizeof(h);
+        h.elf_mach = jitdump_elf_mach();
+        h.pid = getpid();
+        h.timestamp = jitdump_timestamp();
+        marker = MAP_FAILED;
+        if (write(jitdump_fd, &h, sizeof(h)) == sizeof(h)) {
+            /* perf finds the file through this executable mapping */
+            marker = mmap(NULL, getpagesize(), PROT_READ | PROT_EXEC,
+                          MAP_PRIVATE, jitdump_fd, 0);
+        }
+        if (marker == MAP_FAILED) {
+            fprintf(stderr, "qemu: could not write %s\n", filename);
+            close(jitdump_fd);
+            jitdump_fd = -1;
+            return;
+        }
+        jitdump_write(code_gen_prologue, sizeof(code_gen_prologue),
+                      "qemu_prologue");
+    }
+}
+
+#else
+
+void tb_perf_open(int perf_map, int jitdump)
+{
+    fprintf(stderr, "qemu: perf map not supported on this host\n");
+}
+
+#endif /* USE_PERF_MAP */
+
 /* find the TB 'tb' such that tb[0].tc_ptr <= tc_ptr <
    tb[1].tc_ptr. Return NULL if not found */
 TranslationBlock *tb_find_pc(unsigned long tc_ptr)
 {
-    int m_min, m_max, m;
+    int m_min, m_max, m, i;
     unsigned long v;
-    TranslationBlock *tb;
+    TranslationBlock *tb, *region_tbs;
+    CodeGenRegion *r;
+    uint8_t *end;
 
     if (nb_tbs <= 0)
         return NULL;
-    if (tc_ptr < (unsigned long)code_gen_buffer ||
-        tc_ptr >= (unsigned long)code_gen_ptr)
+    if (tc_ptr < (unsigned long)code_gen_buffer)
+        return NULL;
+    i = (tc_ptr - (unsigned long)code_gen_buffer) / code_gen_region_size;
+    if (i >= nb_code_gen_regions)
+        return NULL;
+    r = &code_gen_regions[i];
+    end = i == code_gen_cur_region ? code_gen_ptr : r->ptr;
+    if (r->nb_tbs <= 0 || tc_ptr >= (unsigned long)end)
         return NULL;
     /* binary search (cf Knuth) */
+    region_tbs = &tbs[r->first_tb];
     m_min = 0;
-    m_max = nb_tbs - 1;
+    m_max = r->nb_tbs - 1;
     while (m_min <= m_max) {
         m = (m_min + m_max) >> 1;
-        tb = &tbs[m];
+        tb = &region_tbs[m];
         v = (unsigned long)tb->tc_ptr;
         if (v == tc_ptr)
             return tb;
@@ -1237,7 +2398,7 @@ TranslationBlock *tb_find_pc(unsigned long tc_ptr)
             m_min = m + 1;
         }
     }
-    return &tbs[m_max];
+    return &region_tbs[m_max];
 }
 
 static void tb_reset_jump_recursive(TranslationBlock *tb);
@@ -1293,10 +2454,10 @@ static void breakpoint_invalidate(CPUState *env, target_ulong pc)
     target_phys_addr_t addr;
     target_ulong pd;
     ram_addr_t ram_addr;
-    PhysPageDesc *p;
+    PhysPageDesc desc, *p;
 
     addr = cpu_get_phys_page_debug(env, pc);
-    p = phys_page_find(addr >> TARGET_PAGE_BITS);
+    p = phys_page_find(addr >> TARGET_PAGE_BITS, &desc);
     if (!p) {
         pd = IO_MEM_UNASSIGNED;
     } else {
@@ -1712,11 +2873,61 @@ static inline void tlb_flush_jmp_cache(CPUState *env, target_ulong addr)
 	    TB_JMP_PAGE_SIZE * sizeof(TranslationBlock *));
 }
 
+/* number of entries in use in the TLB of a MMU mode */
+static inline int tlb_size(CPUState *env, int mmu_idx)
+{
+#ifdef CPU_TLB_DYNAMIC
+    return (env->tlb_mask[mmu_idx] >> CPU_TLB_ENTRY_BITS) + 1;
+#else
+    return CPU_TLB_SIZE;
+#endif
+}
+
+/* Choose the size of the TLB of a MMU mode for the next period, from
+   the number of misses since the last flush: more misses than entries
+   means conflict misses, very few means a flush is costlier than it
+   needs to be.  */
+static void tlb_resize(CPUState *env, int mmu_idx)
+{
+#ifdef CPU_TLB_DYNAMIC
+    int size = tlb_size(env, mmu_idx);
+    uint32_t misses = env->tlb_miss_count[mmu_idx];
+
+    if (size < (1 << CPU_TLB_MIN_BITS))
+        size = 1 << CPU_TLB_DEFAULT_BITS; /* cleared by a CPU reset */
+    else if (misses > size && size < CPU_TLB_SIZE)
+        size <<= 1;
+    else if (misses < size / 8 && size > (1 << CPU_TLB_MIN_BITS))
+        size >>= 1;
+    env->tlb_mask[mmu_idx] = (size - 1) << CPU_TLB_ENTRY_BITS;
+#endif
+    env->tlb_miss_count[mmu_idx] = 0;
+}
+
+/* invalidate the main and victim TLBs of a MMU mode, resizing it */
+static void tlb_flush_mmu(CPUState *env, int mmu_idx)
+{
+    int i, size;
+
+    tlb_resize(env, mmu_idx);
+    size = tlb_size(env, mmu_idx);
+    for(i = 0; i < size; i++) {
+        env->tlb_table[mmu_idx][i].addr_read = -1;
+        env->tlb_table[mmu_idx][i].addr_write = -1;
+        env->tlb_table[mmu_idx][i].addr_code = -1;
+    }
+    for(i = 0; i < CPU_VTLB_SIZE; i++) {
+        env->tlb_v_table[mmu_idx][i].addr_read = -1;
+        env->tlb_v_table[mmu_idx][i].addr_write = -1;
+        env->tlb_v_table[mmu_idx][i].addr_code = -1;
+    }
+}
+
 /* NOTE: if flush_global is true, also flush global entries (not
    implemented yet) */
 void tlb_flush(CPUState *env, int flush_global)
 {
-    int i;
+    int mmu_idx;
 
 #if defined(DEBUG_TLB)
     printf("tlb_flush:\n");
@@ -1725,30 +2936,8 @@ void tlb_flush(CPUState *env, int flush_global)
        links while we are modifying them */
     env->current_tb = NULL;
 
-    for(i = 0; i < CPU_TLB_SIZE; i++) {
-        env->tlb_table[0][i].addr_read = -1;
-        env->tlb_table[0][i].addr_write = -1;
-        env->tlb_table[0][i].addr_code = -1;
-        env->tlb_table[1][i].addr_read = -1;
-        env->tlb_table[1][i].addr_write = -1;
-        env->tlb_table[1][i].addr_code = -1;
-#if (NB_MMU_MODES >= 3)
-        env->tlb_table[2][i].addr_read = -1;
-        env->tlb_table[2][i].addr_write = -1;
-        env->tlb_table[2][i].addr_code = -1;
-#endif
-#if (NB_MMU_MODES >= 4)
-        env->tlb_table[3][i].addr_read = -1;
-        env->tlb_table[3][i].addr_write = -1;
-        env->tlb_table[3][i].addr_code = -1;
-#endif
-#if (NB_MMU_MODES >= 5)
-        env->tlb_table[4][i].addr_read = -1;
-        env->tlb_table[4][i].addr_write = -1;
-        env->tlb_table[4][i].addr_code = -1;
-#endif
-
-    }
+    for(mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++)
+        tlb_flush_mmu(env, mmu_idx);
 
     memset (env->tb_jmp_cache, 0, TB_JMP_CACHE_SIZE * sizeof (void *));
 
@@ -1760,14 +2949,20 @@ void tlb_flush(CPUState *env, int flush_global)
     tlb_flush_count++;
 }
 
-static inline void tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr)
+/* true if the entry maps the page 'addr' for some access type */
+static inline int tlb_entry_is_page(CPUTLBEntry *tlb_entry, target_ulong addr)
 {
-    if (addr == (tlb_entry->addr_read &
-                 (TARGET_PAGE_MASK | TLB_INVALID_MASK)) ||
+    return addr == (tlb_entry->addr_read &
+                    (TARGET_PAGE_MASK | TLB_INVALID_MASK)) ||
         addr == (tlb_entry->addr_write &
                  (TARGET_PAGE_MASK | TLB_INVALID_MASK)) ||
         addr == (tlb_entry->addr_code &
-                 (TARGET_PAGE_MASK | TLB_INVALID_MASK))) {
+                 (TARGET_PAGE_MASK | TLB_INVALID_MASK));
+}
+
+static inline void tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr)
+{
+    if (tlb_entry_is_page(tlb_entry, addr)) {
         tlb_entry->addr_read = -1;
         tlb_entry->addr_write = -1;
         tlb_entry->addr_code = -1;
@@ -1776,7 +2971,7 @@ static inline void tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr)
 
 void tlb_flush_page(CPUState *env, target_ulong addr)
 {
-    int i;
+    int i, mmu_idx;
 
 #if defined(DEBUG_TLB)
     printf("tlb_flush_page: " TARGET_FMT_lx "\n", addr);
@@ -1786,18 +2981,12 @@ void tlb_flush_page(CPUState *env, target_ulong addr)
     env->current_tb = NULL;
 
     addr &= TARGET_PAGE_MASK;
-    i = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
-    tlb_flush_entry(&env->tlb_table[0][i], addr);
-    tlb_flush_entry(&env->tlb_table[1][i], addr);
-#if (NB_MMU_MODES >= 3)
-    tlb_flush_entry(&env->tlb_table[2][i], addr);
-#endif
-#if (NB_MMU_MODES >= 4)
-    tlb_flush_entry(&env->tlb_table[3][i], addr);
-#endif
-#if (NB_MMU_MODES >= 5)
-    tlb_flush_entry(&env->tlb_table[4][i], addr);
-#endif
+    for(mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        i = tlb_index(env, mmu_idx, addr);
+        tlb_flush_entry(&env->tlb_table[mmu_idx][i], addr);
+        for(i = 0; i < CPU_VTLB_SIZE; i++)
+            tlb_flush_entry(&env->tlb_v_table[mmu_idx][i], addr);
+    }
 
     tlb_flush_jmp_cache(env, addr);
 
@@ -1842,7 +3031,7 @@ void cpu_physical_memory_reset_dirty(ram_addr_t start, ram_addr_t end,
 {
     CPUState *env;
     unsigned long length, start1;
-    int i, mask, len;
+    int i, mask, len, mmu_idx, size;
     uint8_t *p;
 
     start &= TARGET_PAGE_MASK;
@@ -1873,22 +3062,15 @@ void cpu_physical_memory_reset_dirty(ram_addr_t start, ram_addr_t end,
        when accessing the range */
     start1 = start + (unsigned long)phys_ram_base;
     for(env = first_cpu; env != NULL; env = env->next_cpu) {
-        for(i = 0; i < CPU_TLB_SIZE; i++)
-            tlb_reset_dirty_range(&env->tlb_table[0][i], start1, length);
-        for(i = 0; i < CPU_TLB_SIZE; i++)
-            tlb_reset_dirty_range(&env->tlb_table[1][i], start1, length);
-#if (NB_MMU_MODES >= 3)
-        for(i = 0; i < CPU_TLB_SIZE; i++)
-            tlb_reset_dirty_range(&env->tlb_table[2][i], start1, length);
-#endif
-#if (NB_MMU_MODES >= 4)
-        for(i = 0; i < CPU_TLB_SIZE; i++)
-            tlb_reset_dirty_range(&env->tlb_table[3][i], start1, length);
-#endif
-#if (NB_MMU_MODES >= 5)
-        for(i = 0; i < CPU_TLB_SIZE; i++)
-            tlb_reset_dirty_range(&env->tlb_table[4][i], start1, length);
-#endif
+        for(mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+            size = tlb_size(env, mmu_idx);
+            for(i = 0; i < size; i++)
+                tlb_reset_dirty_range(&env->tlb_table[mmu_idx][i],
+                                      start1, length);
+            for(i = 0; i < CPU_VTLB_SIZE; i++)
+                tlb_reset_dirty_range(&env->tlb_v_table[mmu_idx][i],
+                                      start1, length);
+        }
     }
 }
 
@@ -1925,23 +3107,15 @@ static inline void tlb_update_dirty(CPUTLBEntry *tlb_entry)
 /* update the TLB according to the current state of the dirty bits */
 void cpu_tlb_update_dirty(CPUState *env)
 {
-    int i;
-    for(i = 0; i < CPU_TLB_SIZE; i++)
-        tlb_update_dirty(&env->tlb_table[0][i]);
-    for(i = 0; i < CPU_TLB_SIZE; i++)
-        tlb_update_dirty(&env->tlb_table[1][i]);
-#if (NB_MMU_MODES >= 3)
-    for(i = 0; i < CPU_TLB_SIZE; i++)
-        tlb_update_dirty(&env->tlb_table[2][i]);
-#endif
-#if (NB_MMU_MODES >= 4)
-    for(i = 0; i < CPU_TLB_SIZE; i++)
-        tlb_update_dirty(&env->tlb_table[3][i]);
-#endif
-#if (NB_MMU_MODES >= 5)
-    for(i = 0; i < CPU_TLB_SIZE; i++)
-        tlb_update_dirty(&env->tlb_table[4][i]);
-#endif
+    int i, mmu_idx, size;
+
+    for(mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        size = tlb_size(env, mmu_idx);
+        for(i = 0; i < size; i++)
+            tlb_update_dirty(&env->tlb_table[mmu_idx][i]);
+        for(i = 0; i < CPU_VTLB_SIZE; i++)
+            tlb_update_dirty(&env->tlb_v_table[mmu_idx][i]);
+    }
 }
 
 static inline void tlb_set_dirty1(CPUTLBEntry *tlb_entry, target_ulong vaddr)
@@ -1954,21 +3128,43 @@ static inline void tlb_set_dirty1(CPUTLBEntry *tlb_entry, target_ulong vaddr)
    so that it is no longer dirty */
 static inline void tlb_set_dirty(CPUState *env, target_ulong vaddr)
 {
-    int i;
+    int i, mmu_idx;
 
     vaddr &= TARGET_PAGE_MASK;
-    i = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
-    tlb_set_dirty1(&env->tlb_table[0][i], vaddr);
-    tlb_set_dirty1(&env->tlb_table[1][i], vaddr);
-#if (NB_MMU_MODES >= 3)
-    tlb_set_dirty1(&env->tlb_table[2][i], vaddr);
-#endif
-#if (NB_MMU_MODES >= 4)
-    tlb_set_dirty1(&env->tlb_table[3][i], vaddr);
-#endif
-#if (NB_MMU_MODES >= 5)
-    tlb_set_dirty1(&env->tlb_table[4][i], vaddr);
-#endif
+    for(mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        i = tlb_index(env, mmu_idx, vaddr);
+        tlb_set_dirty1(&env->tlb_table[mmu_idx][i], vaddr);
+    }
+}
+
+/* Look for the page in the victim TLB of mmu_idx, comparing the address
+   field at elt_ofs.  On a hit, swap the entry with the one at 'index' in
+   the main TLB and return 1.  */
+int tlb_victim_hit(CPUState *env, int mmu_idx, int index, size_t elt_ofs,
+                   target_ulong page)
+{
+    CPUTLBEntry *vte, tmp;
+    target_phys_addr_t iotlb;
+    target_ulong cmp;
+    int vidx;
+
+    for(vidx = 0; vidx < CPU_VTLB_SIZE; vidx++) {
+        vte = &env->tlb_v_table[mmu_idx][vidx];
+        cmp = *(target_ulong *)((uint8_t *)vte + elt_ofs);
+        if (cmp != -1 &&
+            (cmp & (TARGET_PAGE_MASK | TLB_INVALID_MASK)) == page) {
+            tmp = env->tlb_table[mmu_idx][index];
+            env->tlb_table[mmu_idx][index] = *vte;
+            *vte = tmp;
+            iotlb = env->iotlb[mmu_idx][index];
+            env->iotlb[mmu_idx][index] = env->iotlb_v[mmu_idx][vidx];
+            env->iotlb_v[mmu_idx][vidx] = iotlb;
+            env->tlb_miss_count[mmu_idx]++;
+            tlb_victim_hit_count++;
+            return 1;
+        }
+    }
+    return 0;
 }
 
 /* add a new TLB entry. At most one entry for a given virtual address
@@ -1979,18 +3175,18 @@ int tlb_set_page_exec(CPUState *env, target_ulong vaddr,
                       target_phys_addr_t paddr, int prot,
                       int mmu_idx, int is_softmmu)
 {
-    PhysPageDesc *p;
+    PhysPageDesc desc, *p;
     unsigned long pd;
     unsigned int index;
     target_ulong address;
     target_ulong code_address;
     target_phys_addr_t addend;
-    int ret;
+    int ret, i;
     CPUTLBEntry *te;
     CPUWatchpoint *wp;
     target_phys_addr_t iotlb;
 
-    p = phys_page_find(paddr >> TARGET_PAGE_BITS);
+    p = phys_page_find(paddr >> TARGET_PAGE_BITS, &desc);
     if (!p) {
         pd = IO_MEM_UNASSIGNED;
     } else {
@@ -2042,9 +3238,28 @@ int tlb_set_page_exec(CPUState *env, target_ulong vaddr,
         }
     }
 
-    index = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
-    env->iotlb[mmu_idx][index] = iotlb - vaddr;
+#ifdef CPU_TLB_DYNAMIC
+    /* a guest that rarely flushes would otherwise never get a larger
+       TLB: grow it as soon as it keeps missing */
+    if (env->tlb_miss_count[mmu_idx] > 16 * tlb_size(env, mmu_idx) &&
+        tlb_size(env, mmu_idx) < CPU_TLB_SIZE)
+        tlb_flush_mmu(env, mmu_idx);
+#endif
+    index = tlb_index(env, mmu_idx, vaddr);
     te = &env->tlb_table[mmu_idx][index];
+    /* keep the entry we replace in the victim TLB, and drop any older
+       copy of this page from it */
+    for(i = 0; i < CPU_VTLB_SIZE; i++)
+        tlb_flush_entry(&env->tlb_v_table[mmu_idx][i], vaddr);
+    if (!tlb_entry_is_page(te, vaddr) &&
+        (te->addr_read != -1 || te->addr_write != -1 ||
+         te->addr_code != -1)) {
+        i = env->vtlb_index[mmu_idx]++ % CPU_VTLB_SIZE;
+        env->tlb_v_table[mmu_idx][i] = *te;
+        env->iotlb_v[mmu_idx][i] = env->iotlb[mmu_idx][index];
+    }
+    env->tlb_miss_count[mmu_idx]++;
+    env->iotlb[mmu_idx][index] = iotlb - vaddr;
     te->addend = addend - vaddr;
     if (prot & PAGE_READ) {
         te->addr_read = address;
@@ -2272,6 +3487,84 @@ static int subpage_register (subpage_t *mmio, uint32_t start, uint32_t end,
                              ram_addr_t memory, ram_addr_t region_offset);
 static void *subpage_init (target_phys_addr_t base, ram_addr_t *phys,
                            ram_addr_t orig_memory, ram_addr_t region_offset);
+/* rebuild the per-slice hints used by phys_page_find() */
+static void phys_map_compile(void)
+{
+    unsigned int b, i = 0;
+
+    for (b = 0; b < PHYS_MAP_L1_SIZE; b++) {
+        target_phys_addr_t base = (target_phys_addr_t)b << PHYS_MAP_L1_SHIFT;
+
+        while (i < phys_map_nb && phys_map[i].last < base)
+            i++;
+        phys_map_l1[b] = i;
+    }
+    phys_map_l1[PHYS_MAP_L1_SIZE] = phys_map_nb;
+    phys_map_last = 0;
+}
+
+/* map pages [start, last] to 'phys_offset', replacing whatever covered
+   them.  IO_MEM_UNASSIGNED removes the pages from the map. */
+static void phys_map_set(target_phys_addr_t start, target_phys_addr_t last,
+                         ram_addr_t phys_offset, ram_addr_t region_offset)
+{
+    PhysRange pieces[3], *r;
+    PhysPageDesc pd;
+    unsigned int i, j, k, n = 0;
+
+    i = phys_map_search(start, 0, phys_map_nb);
+    for (j = i; j < phys_map_nb && phys_map[j].start <= last; j++)
+        ;
+    if (i < j && phys_map[i].start < start) {
+        pieces[n] = phys_map[i];
+        pieces[n].last = start - TARGET_PAGE_SIZE;
+        n++;
+    }
+    if (phys_offset != IO_MEM_UNASSIGNED) {
+        pieces[n].start = start;
+        pieces[n].last = last;
+        pieces[n].phys_offset = phys_offset;
+        pieces[n].region_offset = region_offset;
+        n++;
+    }
+    if (i < j && phys_map[j - 1].last > last) {
+        r = &pieces[n++];
+        phys_range_desc(&phys_map[j - 1], last + TARGET_PAGE_SIZE, &pd);
+        r->start = last + TARGET_PAGE_SIZE;
+        r->last = phys_map[j - 1].last;
+        r->phys_offset = pd.phys_offset;
+        r->region_offset = pd.region_offset;
+    }
+
+    if (phys_map_nb - (j - i) + n > phys_map_max) {
+        phys_map_max = phys_map_max ? phys_map_max * 2 : 64;
+        phys_map = qemu_realloc(phys_map, phys_map_max * sizeof(PhysRange));
+    }
+    memmove(&phys_map[i + n], &phys_map[j],
+            (phys_map_nb - j) * sizeof(PhysRange));
+    memcpy(&phys_map[i], pieces, n * sizeof(PhysRange));
+    phys_map_nb = phys_map_nb - (j - i) + n;
+
+    /* merge with the neighbours when the descriptors line up */
+    k = i > 0 ? i - 1 : 0;
+    j = i + n + 1 < phys_map_nb ? i + n + 1 : phys_map_nb;
+    for (i = k; i + 1 < j; ) {
+        r = &phys_map[i];
+        phys_range_desc(r, r[1].start, &pd);
+        if (r->last + TARGET_PAGE_SIZE == r[1].start &&
+            pd.phys_offset == r[1].phys_offset &&
+            pd.region_offset == r[1].region_offset) {
+            r->last = r[1].last;
+            memmove(&r[1], &r[2], (phys_map_nb - i - 2) * sizeof(PhysRange));
+            phys_map_nb--;
+            j--;
+        } else {
+            i++;
+        }
+    }
+    phys_map_compile();
+}
+
 #define CHECK_SUBPAGE(addr, start_addr, start_addr2, end_addr, end_addr2, \
                       need_subpage)                                     \
     do {                                                                \
@@ -2305,10 +3598,12 @@ void cpu_register_physical_memory_offset(target_phys_addr_t start_addr,
                                          ram_addr_t region_offset)
 {
     target_phys_addr_t addr, end_addr;
-    PhysPageDesc *p;
+    PhysPageDesc desc, *p;
+    PhysRange run = { 0, 0, 0, 0 };
     CPUState *env;
     ram_addr_t orig_size = size;
     void *subpage;
+    int run_valid = 0;
 
 #ifdef USE_KQEMU
     /* XXX: should not depend on cpu context */
@@ -2327,58 +3622,60 @@ void cpu_register_physical_memory_offset(target_phys_addr_t start_addr,
     size = (size + TARGET_PAGE_SIZE - 1) & TARGET_PAGE_MASK;
     end_addr = start_addr + (target_phys_addr_t)size;
     for(addr = start_addr; addr != end_addr; addr += TARGET_PAGE_SIZE) {
-        p = phys_page_find(addr >> TARGET_PAGE_BITS);
-        if (p && p->phys_offset != IO_MEM_UNASSIGNED) {
+        target_phys_addr_t page = addr & TARGET_PAGE_MASK;
+        target_phys_addr_t start_addr2, end_addr2;
+        int need_subpage = 0;
+
+        p = phys_page_find(addr >> TARGET_PAGE_BITS, &desc);
+        CHECK_SUBPAGE(addr, start_addr, start_addr2, end_addr, end_addr2,
+                      need_subpage);
+        if (p && p->phys_offset != IO_MEM_UNASSIGNED &&
+            (need_subpage || phys_offset & IO_MEM_SUBWIDTH)) {
             ram_addr_t orig_memory = p->phys_offset;
-            target_phys_addr_t start_addr2, end_addr2;
-            int need_subpage = 0;
-
-            CHECK_SUBPAGE(addr, start_addr, start_addr2, end_addr, end_addr2,
-                          need_subpage);
-            if (need_subpage || phys_offset & IO_MEM_SUBWIDTH) {
-                if (!(orig_memory & IO_MEM_SUBPAGE)) {
-                    subpage = subpage_init((addr & TARGET_PAGE_MASK),
-                                           &p->phys_offset, orig_memory,
-                                           p->region_offset);
-                } else {
-                    subpage = io_mem_opaque[(orig_memory & ~TARGET_PAGE_MASK)
-                                            >> IO_MEM_SHIFT];
-                }
-                subpage_register(subpage, start_addr2, end_addr2, phys_offset,
-                                 region_offset);
-                p->region_offset = 0;
+
+            if (!(orig_memory & IO_MEM_SUBPAGE)) {
+                subpage = subpage_init(page, &desc.phys_offset, orig_memory,
+                                       desc.region_offset);
+                phys_map_set(page, page, desc.phys_offset, 0);
             } else {
-                p->phys_offset = phys_offset;
-                if ((phys_offset & ~TARGET_PAGE_MASK) <= IO_MEM_ROM ||
-                    (phys_offset & IO_MEM_ROMD))
-                    phys_offset += TARGET_PAGE_SIZE;
+                subpage = io_mem_opaque[(orig_memory & ~TARGET_PAGE_MASK)
+                                        >> IO_MEM_SHIFT];
             }
+            subpage_register(subpage, start_addr2, end_addr2, phys_offset,
+                             region_offset);
+        } else if (!p && !phys_offset_is_linear(phys_offset) &&
+                   (need_subpage || phys_offset & IO_MEM_SUBWIDTH)) {
+            subpage = subpage_init(page, &desc.phys_offset, IO_MEM_UNASSIGNED,
+                                   page);
+            subpage_register(subpage, start_addr2, end_addr2,
+                             phys_offset, region_offset);
+            phys_map_set(page, page, desc.phys_offset, 0);
         } else {
-            p = phys_page_find_alloc(addr >> TARGET_PAGE_BITS, 1);
-            p->phys_offset = phys_offset;
-            p->region_offset = region_offset;
-            if ((phys_offset & ~TARGET_PAGE_MASK) <= IO_MEM_ROM ||
-                (phys_offset & IO_MEM_ROMD)) {
-                phys_offset += TARGET_PAGE_SIZE;
-            } else {
-                target_phys_addr_t start_addr2, end_addr2;
-                int need_subpage = 0;
-
-                CHECK_SUBPAGE(addr, start_addr, start_addr2, end_addr,
-                              end_addr2, need_subpage);
-
-                if (need_subpage || phys_offset & IO_MEM_SUBWIDTH) {
-                    subpage = subpage_init((addr & TARGET_PAGE_MASK),
-                                           &p->phys_offset, IO_MEM_UNASSIGNED,
-                                           addr & TARGET_PAGE_MASK);
-                    subpage_register(subpage, start_addr2, end_addr2,
-                                     phys_offset, region_offset);
-                    p->region_offset = 0;
+            /* whole page: batch contiguous pages into a single range */
+            if (run_valid) {
+                phys_range_desc(&run, page, &desc);
+                if (run.last + TARGET_PAGE_SIZE != page ||
+                    desc.phys_offset != phys_offset ||
+                    desc.region_offset != region_offset) {
+                    phys_map_set(run.start, run.last, run.phys_offset,
+                                 run.region_offset);
+                    run_valid = 0;
                 }
             }
+            if (!run_valid) {
+                run.start = page;
+                run.phys_offset = phys_offset;
+                run.region_offset = region_offset;
+                run_valid = 1;
+            }
+            run.last = page;
         }
+        if (phys_offset_is_linear(phys_offset))
+            phys_offset += TARGET_PAGE_SIZE;
         region_offset += TARGET_PAGE_SIZE;
     }
+    if (run_valid)
+        phys_map_set(run.start, run.last, run.phys_offset, run.region_offset);
 
     /* since each CPU stores ram addresses in its TLB cache, we must
        reset the modified entries */
@@ -2391,9 +3688,9 @@ void cpu_register_physical_memory_offset(target_phys_addr_t start_addr,
 /* XXX: temporary until new memory mapping API */
 ram_addr_t cpu_get_physical_page_desc(target_phys_addr_t addr)
 {
-    PhysPageDesc *p;
+    PhysPageDesc desc, *p;
 
-    p = phys_page_find(addr >> TARGET_PAGE_BITS);
+    p = phys_page_find(addr >> TARGET_PAGE_BITS, &desc);
     if (!p)
         return IO_MEM_UNASSIGNED;
     return p->phys_offset;
@@ -2411,22 +3708,51 @@ void qemu_unregister_coalesced_mmio(target_phys_addr_t addr, ram_addr_t size)
         kvm_uncoalesce_mmio_region(addr, size);
 }
 
-/* XXX: better than nothing */
+/* First fit allocation in phys_ram_base.  Host memory behind a block is
+   only committed when the guest touches it.  */
 ram_addr_t qemu_ram_alloc(ram_addr_t size)
 {
+    RAMBlock **pprev, *block, *new_block;
     ram_addr_t addr;
-    if ((phys_ram_alloc_offset + size) > phys_ram_size) {
+
+    size = TARGET_PAGE_ALIGN(size);
+    addr = 0;
+    for (pprev = &ram_blocks; (block = *pprev) != NULL;
+         pprev = &block->next) {
+        if (block->offset - addr >= size)
+            break;
+        addr = block->offset + block->length;
+    }
+    if (addr + size > phys_ram_size || addr + size < addr) {
         fprintf(stderr, "Not enough memory (requested_size = %" PRIu64 ", max memory = %" PRIu64 ")\n",
                 (uint64_t)size, (uint64_t)phys_ram_size);
         abort();
     }
-    addr = phys_ram_alloc_offset;
-    phys_ram_alloc_offset = TARGET_PAGE_ALIGN(phys_ram_alloc_offset + size);
+
+    new_block = qemu_malloc(sizeof(*new_block));
+    new_block->offset = addr;
+    new_block->length = size;
+    new_block->next = block;
+    *pprev = new_block;
     return addr;
 }
 
 void qemu_ram_free(ram_addr_t addr)
 {
+    RAMBlock **pprev, *block;
+
+    for (pprev = &ram_blocks; (block = *pprev) != NULL;
+         pprev = &block->next) {
+        if (block->offset == addr) {
+            *pprev = block->next;
+            qemu_vmalloc_discard(phys_ram_base + block->offset,
+                                 block->length);
+            qemu_free(block);
+            return;
+        }
+    }
+    fprintf(stderr, "qemu_ram_free: no block at %" PRIx64 "\n",
+            (uint64_t)addr);
 }
 
 static uint32_t unassigned_mem_readb(void *opaque, target_phys_addr_t addr)
@@ -2985,14 +4311,14 @@ void cpu_physical_memory_rw(target_phys_addr_t addr, uint8_t *buf,
     uint32_t val;
     target_phys_addr_t page;
     unsigned long pd;
-    PhysPageDesc *p;
+    PhysPageDesc desc, *p;
 
     while (len > 0) {
         page = addr & TARGET_PAGE_MASK;
         l = (page + TARGET_PAGE_SIZE) - addr;
         if (l > len)
             l = len;
-        p = phys_page_find(page >> TARGET_PAGE_BITS);
+        p = phys_page_find(page >> TARGET_PAGE_BITS, &desc);
         if (!p) {
             pd = IO_MEM_UNASSIGNED;
         } else {
@@ -3082,14 +4408,14 @@ void cpu_physical_memory_write_rom(target_phys_addr_t addr,
     uint8_t *ptr;
     target_phys_addr_t page;
     unsigned long pd;
-    PhysPageDesc *p;
+    PhysPageDesc desc, *p;
 
     while (len > 0) {
         page = addr & TARGET_PAGE_MASK;
         l = (page + TARGET_PAGE_SIZE) - addr;
         if (l > len)
             l = len;
-        p = phys_page_find(page >> TARGET_PAGE_BITS);
+        p = phys_page_find(page >> TARGET_PAGE_BITS, &desc);
         if (!p) {
             pd = IO_MEM_UNASSIGNED;
         } else {
@@ -3117,9 +4443,55 @@ typedef struct {
     void *buffer;
     target_phys_addr_t addr;
     target_phys_addr_t len;
+    target_phys_addr_t size;    /* allocated, page aligned */
 } BounceBuffer;
 
-static BounceBuffer bounce;
+/* Mappings that do not hit RAM are served from a pool of bounce buffers.
+   Each mapping gets its own buffer, sized to the request and limited by
+   the memory left in the pool. */
+#define BOUNCE_MAX_BUFFERS 16
+#define BOUNCE_POOL_SIZE   (256 * 1024)
+
+static BounceBuffer bounce[BOUNCE_MAX_BUFFERS];
+static target_phys_addr_t bounce_pool_used;
+
+static BounceBuffer *bounce_alloc(target_phys_addr_t addr,
+                                  target_phys_addr_t len)
+{
+    BounceBuffer *b;
+    target_phys_addr_t size;
+    int i;
+
+    for (i = 0; i < BOUNCE_MAX_BUFFERS; i++) {
+        if (!bounce[i].buffer)
+            break;
+    }
+    if (i == BOUNCE_MAX_BUFFERS || bounce_pool_used >= BOUNCE_POOL_SIZE)
+        return NULL;
+    size = TARGET_PAGE_ALIGN(len);
+    if (size > BOUNCE_POOL_SIZE - bounce_pool_used) {
+        size = BOUNCE_POOL_SIZE - bounce_pool_used;
+        len = size;
+    }
+    b = &bounce[i];
+    b->buffer = qemu_memalign(TARGET_PAGE_SIZE, size);
+    b->addr = addr;
+    b->len = len;
+    b->size = size;
+    bounce_pool_used += size;
+    return b;
+}
+
+static BounceBuffer *bounce_find(void *buffer)
+{
+    int i;
+
+    for (i = 0; i < BOUNCE_MAX_BUFFERS; i++) {
+        if (bounce[i].buffer && bounce[i].buffer == buffer)
+            return &bounce[i];
+    }
+    return NULL;
+}
 
 typedef struct MapClient {
     void *opaque;
@@ -3176,15 +4548,16 @@ void *cpu_physical_memory_map(target_phys_addr_t addr,
     uint8_t *ptr;
     target_phys_addr_t page;
     unsigned long pd;
-    PhysPageDesc *p;
+    PhysPageDesc desc, *p;
     unsigned long addr1;
+    BounceBuffer *b;
 
     while (len > 0) {
         page = addr & TARGET_PAGE_MASK;
         l = (page + TARGET_PAGE_SIZE) - addr;
         if (l > len)
             l = len;
-        p = phys_page_find(page >> TARGET_PAGE_BITS);
+        p = phys_page_find(page >> TARGET_PAGE_BITS, &desc);
         if (!p) {
             pd = IO_MEM_UNASSIGNED;
         } else {
@@ -3192,16 +4565,20 @@ void *cpu_physical_memory_map(target_phys_addr_t addr,
         }
 
         if ((pd & ~TARGET_PAGE_MASK) != IO_MEM_RAM) {
-            if (done || bounce.buffer) {
+            /* bounce the rest of the request in one go, whatever it
+               covers, so that mixed RAM/MMIO ranges map in one piece */
+            if (done) {
+                break;
+            }
+            b = bounce_alloc(addr, len);
+            if (!b) {
                 break;
             }
-            bounce.buffer = qemu_memalign(TARGET_PAGE_SIZE, TARGET_PAGE_SIZE);
-            bounce.addr = addr;
-            bounce.len = l;
             if (!is_write) {
-                cpu_physical_memory_rw(addr, bounce.buffer, l, 0);
+                cpu_physical_memory_rw(addr, b->buffer, b->len, 0);
             }
-            ptr = bounce.buffer;
+            *plen = b->len;
+            return b->buffer;
         } else {
             addr1 = (pd & TARGET_PAGE_MASK) + (addr & ~TARGET_PAGE_MASK);
             ptr = phys_ram_base + addr1;
@@ -3227,7 +4604,10 @@ void *cpu_physical_memory_map(target_phys_addr_t addr,
 void cpu_physical_memory_unmap(void *buffer, target_phys_addr_t len,
                                int is_write, target_phys_addr_t access_len)
 {
-    if (buffer != bounce.buffer) {
+    BounceBuffer *b;
+
+    b = bounce_find(buffer);
+    if (!b) {
         if (is_write) {
             unsigned long addr1 = (uint8_t *)buffer - phys_ram_base;
             while (access_len) {
@@ -3249,10 +4629,11 @@ void cpu_physical_memory_unmap(void *buffer, target_phys_addr_t len,
         return;
     }
     if (is_write) {
-        cpu_physical_memory_write(bounce.addr, bounce.buffer, access_len);
+        cpu_physical_memory_write(b->addr, b->buffer, access_len);
     }
-    qemu_free(bounce.buffer);
-    bounce.buffer = NULL;
+    qemu_free(b->buffer);
+    b->buffer = NULL;
+    bounce_pool_used -= b->size;
     cpu_notify_map_clients();
 }
 
@@ -3263,9 +4644,9 @@ uint32_t ldl_phys(target_phys_addr_t addr)
     uint8_t *ptr;
     uint32_t val;
     unsigned long pd;
-    PhysPageDesc *p;
+    PhysPageDesc desc, *p;
 
-    p = phys_page_find(addr >> TARGET_PAGE_BITS);
+    p = phys_page_find(addr >> TARGET_PAGE_BITS, &desc);
     if (!p) {
         pd = IO_MEM_UNASSIGNED;
     } else {
@@ -3295,9 +4676,9 @@ uint64_t ldq_phys(target_phys_addr_t addr)
     uint8_t *ptr;
     uint64_t val;
     unsigned long pd;
-    PhysPageDesc *p;
+    PhysPageDesc desc, *p;
 
-    p = phys_page_find(addr >> TARGET_PAGE_BITS);
+    p = phys_page_find(addr >> TARGET_PAGE_BITS, &desc);
     if (!p) {
         pd = IO_MEM_UNASSIGNED;
     } else {
@@ -3350,9 +4731,9 @@ void stl_phys_notdirty(target_phys_addr_t addr, uint32_t val)
     int io_index;
     uint8_t *ptr;
     unsigned long pd;
-    PhysPageDesc *p;
+    PhysPageDesc desc, *p;
 
-    p = phys_page_find(addr >> TARGET_PAGE_BITS);
+    p = phys_page_find(addr >> TARGET_PAGE_BITS, &desc);
     if (!p) {
         pd = IO_MEM_UNASSIGNED;
     } else {
@@ -3386,9 +4767,9 @@ void stq_phys_notdirty(target_phys_addr_t addr, uint64_t val)
     int io_index;
     uint8_t *ptr;
     unsigned long pd;
-    PhysPageDesc *p;
+    PhysPageDesc desc, *p;
 
-    p = phys_page_find(addr >> TARGET_PAGE_BITS);
+    p = phys_page_find(addr >> TARGET_PAGE_BITS, &desc);
     if (!p) {
         pd = IO_MEM_UNASSIGNED;
     } else {
@@ -3419,9 +4800,9 @@ void stl_phys(target_phys_addr_t addr, uint32_t val)
     int io_index;
     uint8_t *ptr;
     unsigned long pd;
-    PhysPageDesc *p;
+    PhysPageDesc desc, *p;
 
-    p = phys_page_find(addr >> TARGET_PAGE_BITS);
+    p = phys_page_find(addr >> TARGET_PAGE_BITS, &desc);
     if (!p) {
         pd = IO_MEM_UNASSIGNED;
     } else {
@@ -3565,41 +4946,66 @@ void cpu_io_recompile(CPUState *env, void *retaddr)
 void dump_exec_info(FILE *f,
                     int (*cpu_fprintf)(FILE *f, const char *fmt, ...))
 {
-    int i, target_code_size, max_target_code_size;
+    int i, j, target_code_size, max_target_code_size;
     int direct_jmp_count, direct_jmp2_count, cross_page;
+    int used_buckets, max_chain, long_chains, len;
+    unsigned long code_size;
     TranslationBlock *tb;
+    CodeGenRegion *r;
 
     target_code_size = 0;
     max_target_code_size = 0;
     cross_page = 0;
     direct_jmp_count = 0;
     direct_jmp2_count = 0;
-    for(i = 0; i < nb_tbs; i++) {
-        tb = &tbs[i];
-        target_code_size += tb->size;
-        if (tb->size > max_target_code_size)
-            max_target_code_size = tb->size;
-        if (tb->page_addr[1] != -1)
-            cross_page++;
-        if (tb->tb_next_offset[0] != 0xffff) {
-            direct_jmp_count++;
-            if (tb->tb_next_offset[1] != 0xffff) {
-                direct_jmp2_count++;
+    code_size = 0;
+    for(i = 0; i < nb_code_gen_regions; i++) {
+        r = &code_gen_regions[i];
+        code_size += (i == code_gen_cur_region ? code_gen_ptr : r->ptr)
+            - r->start;
+        for(j = 0; j < r->nb_tbs; j++) {
+            tb = &tbs[r->first_tb + j];
+            target_code_size += tb->size;
+            if (tb->size > max_target_code_size)
+                max_target_code_size = tb->size;
+            if (tb->page_addr[1] != -1)
+                cross_page++;
+            if (tb->tb_next_offset[0] != 0xffff) {
+                direct_jmp_count++;
+                if (tb->tb_next_offset[1] != 0xffff) {
+                    direct_jmp2_count++;
+                }
             }
         }
     }
+    used_buckets = 0;
+    max_chain = 0;
+    long_chains = 0;
+    for(i = 0; i < (1 << tb_phys_hash_bits); i++) {
+        len = 0;
+        for(tb = tb_phys_hash[i]; tb != NULL; tb = tb->phys_hash_next)
+            len++;
+        if (len > 0)
+            used_buckets++;
+        if (len > 4)
+            long_chains++;
+        if (len > max_chain)
+            max_chain = len;
+    }
     /* XXX: avoid using doubles ? */
     cpu_fprintf(f, "Translation buffer state:\n");
     cpu_fprintf(f, "gen code size       %ld/%ld\n",
-                code_gen_ptr - code_gen_buffer, code_gen_buffer_max_size);
+                code_size, code_gen_buffer_max_size);
+    cpu_fprintf(f, "code regions        %d (current %d)\n",
+                nb_code_gen_regions, code_gen_cur_region);
     cpu_fprintf(f, "TB count            %d/%d\n", 
                 nb_tbs, code_gen_max_blocks);
     cpu_fprintf(f, "TB avg target size  %d max=%d bytes\n",
                 nb_tbs ? target_code_size / nb_tbs : 0,
                 max_target_code_size);
     cpu_fprintf(f, "TB avg host size    %d bytes (expansion ratio: %0.1f)\n",
-                nb_tbs ? (code_gen_ptr - code_gen_buffer) / nb_tbs : 0,
-                target_code_size ? (double) (code_gen_ptr - code_gen_buffer) / target_code_size : 0);
+                nb_tbs ? (int)(code_size / nb_tbs) : 0,
+                target_code_size ? (double) code_size / target_code_size : 0);
     cpu_fprintf(f, "cross page TB count %d (%d%%)\n",
             cross_page,
             nb_tbs ? (cross_page * 100) / nb_tbs : 0);
@@ -3608,13 +5014,89 @@ void dump_exec_info(FILE *f,
                 nb_tbs ? (direct_jmp_count * 100) / nb_tbs : 0,
                 direct_jmp2_count,
                 nb_tbs ? (direct_jmp2_count * 100) / nb_tbs : 0);
+    cpu_fprintf(f, "TB hash buckets     %d/%d used, %d TBs\n",
+                used_buckets, 1 << tb_phys_hash_bits, tb_phys_hash_count);
+    cpu_fprintf(f, "TB hash chains      avg %0.2f max %d (%d longer than 4)\n",
+                used_buckets ? (double)tb_phys_hash_count / used_buckets : 0,
+                max_chain, long_chains);
     cpu_fprintf(f, "\nStatistics:\n");
     cpu_fprintf(f, "TB flush count      %d\n", tb_flush_count);
     cpu_fprintf(f, "TB invalidate count %d\n", tb_phys_invalidate_count);
+    cpu_fprintf(f, "TB reclaim count    %d\n", tb_reclaim_count);
+    cpu_fprintf(f, "TB promote count    %d\n", tb_promote_count);
+    if (tb_trace_threshold)
+        cpu_fprintf(f, "superblock count    %d\n", tb_trace_count);
     cpu_fprintf(f, "TLB flush count     %d\n", tlb_flush_count);
+#if !defined(CONFIG_USER_ONLY)
+    cpu_fprintf(f, "TLB victim hits     %d\n", tlb_victim_hit_count);
+    if (first_cpu) {
+        cpu_fprintf(f, "TLB entries        ");
+        for(i = 0; i < NB_MMU_MODES; i++)
+            cpu_fprintf(f, " %d", tlb_size(first_cpu, i));
+        cpu_fprintf(f, "\n");
+    }
+#endif
+#ifdef USE_TB_CACHE
+    if (tb_cache_filename)
+        cpu_fprintf(f, "TB cache imports    %lu\n", tb_cache_hits);
+#endif
     tcg_dump_info(f, cpu_fprintf);
 }
 
+/* estimated number of guest instructions executed */
+static uint64_t tb_prof_weight(const TBProfile *p)
+{
+    return p->entries * p->icount;
+}
+
+static int tb_prof_cmp(const void *a, const void *b)
+{
+    uint64_t wa = tb_prof_weight(*(const TBProfile **)a);
+    uint64_t wb = tb_prof_weight(*(const TBProfile **)b);
+
+    return wa < wb ? 1 : wa > wb ? -1 : 0;
+}
+
+/* Print the 'count' guest PCs where the most guest instructions were
+   executed according to the execution profile.  */
+void dump_tb_profile(FILE *f,
+                     int (*cpu_fprintf)(FILE *f, const char *fmt, ...),
+                     int count)
+{
+    TBProfile **sorted, *p;
+    uint64_t total;
+    int i, n;
+
+    sorted = qemu_malloc((tb_prof_count + 1) * sizeof(TBProfile *));
+    n = 0;
+    total = 0;
+    for (i = 0; i < TB_PROF_HASH_SIZE; i++) {
+        for (p = tb_prof_hash[i]; p; p = p->next) {
+            if (p->entries) {
+                sorted[n++] = p;
+                total += tb_prof_weight(p);
+            }
+        }
+    }
+    qsort(sorted, n, sizeof(TBProfile *), tb_prof_cmp);
+
+    cpu_fprintf(f, "TB profile %s, %d PCs, %" PRIu64 " guest insns\n",
+                tb_prof_enabled ? "enabled" : "disabled", n, total);
+    cpu_fprintf(f, "%-16s %6s %12s %4s %12s %12s %10s  %s\n",
+                "pc", "%insn", "entries", "size", "exits", "helpers",
+                "tlb misses", "symbol");
+    for (i = 0; i < n && i < count; i++) {
+        p = sorted[i];
+        cpu_fprintf(f, "%016" PRIx64 " %6.2f %12" PRIu64 " %4u %12" PRIu64
+                    " %12" PRIu64 " %10" PRIu64 "  %s\n",
+                    (uint64_t)p->pc,
+                    total ? 100.0 * tb_prof_weight(p) / total : 0.0,
+                    p->entries, p->icount, p->exits, p->helpers,
+                    p->tlb_misses, lookup_symbol(p->pc));
+    }
+    qemu_free(sorted);
+}
+
 #if !defined(CONFIG_USER_ONLY)
 
 #define MMUSUFFIX _cmmu
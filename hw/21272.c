@@ -10,12 +10,17 @@
 #include "hw.h"
 #include "devices.h"
 #include "pci.h"
+#include "replay.h"
 
 //#define DEBUG_CCHIP
 //#define DEBUG_PCHIP
 //#define DEBUG_DCHIP
 //#define DEBUG_PCICFG
 
+/* Upper bound of interval timer ticks kept for catch-up, one second
+   at the 1024 Hz rate used by the console.  */
+#define INTIM_MAX_COALESCED 1024
+
 typedef struct PchipState PchipState;
 struct PchipState {
     /* IntAck handler.  */
@@ -24,6 +29,9 @@ struct PchipState {
 
     PCIBus *pci;
 
+    /* Device interrupt lines of the Cchip.  */
+    qemu_irq *irqs;
+
     /* Pchip id.  */
     int num;
 
@@ -48,6 +56,9 @@ struct PchipState {
 struct TyphoonState {
     qemu_irq *irqs;
     qemu_irq *intim_irq;
+    /* Raised while intim_coalesced holds ticks, so that the timer source
+       stops firing until the guest has caught up.  */
+    qemu_irq intim_hold;
     CPUState *cpu[4];
 
     /* Used to reconstruct 64bits accesses.  Low long word first.  */
@@ -58,6 +69,8 @@ struct TyphoonState {
     unsigned char misc_abt;
 
     int b_irq[4];
+    /* Interval timer ticks received while ITINTR was still pending.  */
+    unsigned int intim_coalesced[4];
 
     uint64_t dim[4];
     uint64_t dir[4];
@@ -145,6 +158,16 @@ static uint32_t typhoon_cchip_readl (void *opaque, target_phys_addr_t addr)
     return (uint32_t)val;
 }
 
+static void intim_update_hold(TyphoonState *s)
+{
+    int i;
+
+    for (i = 0; i < 4 && s->cpu[i]; i++)
+        if (s->intim_coalesced[i])
+            break;
+    qemu_set_irq(s->intim_hold, i < 4 && s->cpu[i]);
+}
+
 static void typhoon_cchip_writel (void *opaque,
                                   target_phys_addr_t addr, uint32_t value)
 {
@@ -208,9 +231,15 @@ static void typhoon_cchip_writel (void *opaque,
             int i;
             for (i = 0; i < 4 && s->cpu[i]; i++)
                 if ((val & (0x10 << i))) {
-                    s->b_irq[i] &= ~(1 << 2);
+                    /* Deliver coalesced ticks back to back so that the
+                       guest catches up without losing time.  */
+                    if (s->intim_coalesced[i])
+                        s->intim_coalesced[i]--;
+                    else
+                        s->b_irq[i] &= ~(1 << 2);
                     cpu_alpha_update_irq(s->cpu[i], s->b_irq[i]);
                 }
+            intim_update_hold(s);
         }
         if (val & ~((0xfULL << 40) | (0xffULL << 32) | (1 << 28) | (1ULL << 24)
                     | (0x0f << 12) | (0xf << 16)
@@ -513,14 +542,16 @@ static void pchip_pci_io_writew (void *opaque, target_phys_addr_t addr,
 #ifdef TARGET_WORDS_BIGENDIAN
     value = bswap16(value);
 #endif
-    cpu_outw(NULL, addr, value);
+    if (!cpu_out_data(addr, 2, value))
+        cpu_outw(NULL, addr, value);
 }
 
 static uint32_t pchip_pci_io_readw (void *opaque, target_phys_addr_t addr)
 {
     uint32_t ret;
 
-    ret = cpu_inw(NULL, addr);
+    if (!cpu_in_data(addr, 2, &ret))
+        ret = cpu_inw(NULL, addr);
 #ifdef TARGET_WORDS_BIGENDIAN
     ret = bswap16(ret);
 #endif
@@ -533,14 +564,16 @@ static void pchip_pci_io_writel (void *opaque, target_phys_addr_t addr,
 #ifdef TARGET_WORDS_BIGENDIAN
     value = bswap32(value);
 #endif
-    cpu_outl(NULL, addr, value);
+    if (!cpu_out_data(addr, 4, value))
+        cpu_outl(NULL, addr, value);
 }
 
 static uint32_t pchip_pci_io_readl (void *opaque, target_phys_addr_t addr)
 {
     uint32_t ret;
 
-    ret = cpu_inl(NULL, addr);
+    if (!cpu_in_data(addr, 4, &ret))
+        ret = cpu_inl(NULL, addr);
 #ifdef TARGET_WORDS_BIGENDIAN
     ret = bswap32(ret);
 #endif
@@ -705,6 +738,7 @@ static void cchip_set_irq(void *opaque, int irq, int level)
 #if 0
     qemu_log("cchip_set_irq: irq=%d level=%d\n", irq, level);
 #endif
+    replay_irq(irq, level);
     mask = 1ULL << irq;
     if (level)
         s->drir |= mask;
@@ -734,44 +768,54 @@ static void cchip_set_irq(void *opaque, int irq, int level)
     }
 }
 
+/* LEVEL is the number of interval timer ticks that expired since the
+   previous call (see rtc_periodic_timer).  Ticks that arrive while the
+   previous one is not acknowledged are counted instead of dropped.  */
 static void intim_set_irq(void *opaque, int irq, int level)
 {
     int i;
     TyphoonState *s = opaque;
-    unsigned char old;
-
-#if 0
-    {
-        static int cnt;
-        cnt++;
-        if ((cnt % 1024) == 1023)
-            fprintf(stderr, "Clock!\n");
-    }
-#endif
+    unsigned int ticks;
 
-    if (0 && (s->b_irq[0] & 0x04))
-        fprintf(stderr, "!!Interrupt missed\n");
+    if (level <= 0)
+        return;
+    replay_irq(64, level);
 
     for (i = 0; i < 4 && s->cpu[i]; i++) {
-        old = s->b_irq[i];
-        if (!(old & (1 << 2))) {
+        ticks = level;
+        if (!(s->b_irq[i] & (1 << 2))) {
             s->b_irq[i] |= (1 << 2);
             cpu_alpha_update_irq(s->cpu[i], s->b_irq[i]);
+            ticks--;
         }
+        s->intim_coalesced[i] += ticks;
+        if (s->intim_coalesced[i] > INTIM_MAX_COALESCED)
+            s->intim_coalesced[i] = INTIM_MAX_COALESCED;
     }
+    intim_update_hold(s);
 }
 
 
+/* PCI interrupts are wired as on Clipper (es40): slots 1 to 6 of hose 0
+   get DRIR bits 8 to 31, four per slot; hose 1 uses the bits 32 above.  */
 static int typhoon_map_irq(PCIDevice *pci_dev, int irq_num)
 {
-    return irq_num;
+    int slot = (pci_dev->devfn >> 3) & 0x1f;
+
+    if (slot < 1 || slot > 6) {
+        qemu_log("21272: no interrupt routing for PCI slot %d\n", slot);
+        return 0;
+    }
+    return 8 + (slot - 1) * 4 + irq_num;
 }
 
 static void typhoon_set_irq(qemu_irq *pic, int irq_num, int level)
 {
-    /* Never called (yet).  */
-    fprintf(stderr, "typhoon_set_irq: irq_num=%d, level=%d\n", irq_num, level);
-    exit(4);
+    PchipState *s = (PchipState *)pic;
+
+    if (irq_num < 8)
+        return;
+    qemu_set_irq(s->irqs[irq_num + s->num * 32], level);
 }
 
 TyphoonState *typhoon_21272_init (uint64_t *arr, qemu_irq **irqs,
@@ -847,6 +891,10 @@ TyphoonState *typhoon_21272_init (uint64_t *arr, qemu_irq **irqs,
     s->cpu[0] = cpu0;
     s->irqs = qemu_allocate_irqs(cchip_set_irq, s, 64);
     *irqs = s->irqs;
+    for (i = 0; i < 2; i++) {
+        s->pchip[i].num = i;
+        s->pchip[i].irqs = s->irqs;
+    }
 
     s->intim_irq = qemu_allocate_irqs(intim_set_irq, s, 1);
     *intim_irq = s->intim_irq[0];
@@ -863,6 +911,11 @@ void typhoon_set_iack_handler(TyphoonState *c, int num,
     c->pchip[num].iack_handler_param = param;
 }
 
+void typhoon_set_intim_hold(TyphoonState *c, qemu_irq hold)
+{
+    c->intim_hold = hold;
+}
+
 PCIBus *typhoon_get_pci_bus(TyphoonState *c, int num)
 {
     return c->pchip[num].pci;
@@ -17,48 +17,153 @@
 #include "flash.h"
 #include "block.h"
 #include "qemu-timer.h"
+#include "qemu-aio.h"
 
 //#define DEBUG_FLASH
 
+#define FLASH_SIZE      0x200000
+#define FLASH_SECTORS   (FLASH_SIZE >> 9)
+
+/* Delay after the last write before the content is written back, and
+   maximum delay after the first one if the guest never stops writing.  */
+#define FLASH_QUIET_MS  1000
+#define FLASH_MAX_DELAY_MS 10000
+
 struct Am29f016State {
     BlockDriverState *bs;
     QEMUTimer *timer;
-    int wr_start;
-    int wr_end;
+    /* One bit per 512 bytes sector not yet written to BS.  */
+    uint8_t dirty[FLASH_SECTORS / 8];
+    /* rt_clock time by which the dirty sectors must be written back,
+       0 if none are.  */
+    int64_t deadline;
+    /* Write-back in progress, if any.  */
+    BlockDriverAIOCB *aiocb;
+    uint8_t *aio_buf;
+    int aio_sector;
+    int aio_nb_sectors;
     unsigned char cycle;
     unsigned char cmd;
     unsigned char counter;
     unsigned char prot[8];
-    unsigned char mem[0x200000];
+    unsigned char mem[FLASH_SIZE];
 };
 
-static void am29f016_update(Am29f016State *flash, int offset, int size)
+static void am29f016_set_dirty(Am29f016State *flash, int offset, int size)
 {
-    int len;
-    int res;
+    int sector;
+    int64_t now, expire;
 
     if (!flash->bs)
         return;
 
-    len = (size + (offset & 511) + 511) >> 9;
-    res = bdrv_write(flash->bs, offset >> 9, flash->mem + (offset & ~511), len);
-    qemu_log("am29f016_update: off=0x%06x, size=%d, len=%d, res=%d\n",
-             offset, size, len, res);
+    for (sector = offset >> 9; sector <= (offset + size - 1) >> 9; sector++)
+        flash->dirty[sector >> 3] |= 1 << (sector & 7);
+
+    /* Coalesce everything written until the guest stops writing, but
+       do not postpone the write-back forever.  */
+    now = qemu_get_clock(rt_clock);
+    if (!flash->deadline)
+        flash->deadline = now + FLASH_MAX_DELAY_MS;
+    expire = now + FLASH_QUIET_MS;
+    if (expire > flash->deadline)
+        expire = flash->deadline;
+    qemu_mod_timer(flash->timer, expire);
+}
+
+/* Compute the smallest range covering all the dirty sectors and mark them
+   clean.  Returns the number of sectors, 0 if nothing is dirty.  */
+static int am29f016_take_dirty(Am29f016State *flash, int *first)
+{
+    int i, start, end;
+
+    start = -1;
+    end = -1;
+    for (i = 0; i < FLASH_SECTORS; i++) {
+        if (flash->dirty[i >> 3] & (1 << (i & 7))) {
+            if (start < 0)
+                start = i;
+            end = i;
+        }
+    }
+    if (start < 0)
+        return 0;
+
+    memset(flash->dirty, 0, sizeof(flash->dirty));
+    flash->deadline = 0;
+    *first = start;
+    return end - start + 1;
+}
+
+static void am29f016_aio_cb(void *opaque, int ret)
+{
+    Am29f016State *flash = opaque;
+
+    if (ret < 0) {
+        qemu_log("am29f016: write-back of sectors %d-%d failed (%d)\n",
+                 flash->aio_sector,
+                 flash->aio_sector + flash->aio_nb_sectors - 1, ret);
+        /* Try again at the next quiet period.  */
+        am29f016_set_dirty(flash, flash->aio_sector << 9,
+                           flash->aio_nb_sectors << 9);
+    }
+    qemu_vfree(flash->aio_buf);
+    flash->aio_buf = NULL;
+    flash->aiocb = NULL;
 }
 
+/* Submit the dirty range as a single asynchronous write.  The data is
+   copied so that the guest can keep on writing to the flash.  */
+static void am29f016_timer(void *opaque)
+{
+    Am29f016State *flash = opaque;
+    int first, nb;
+
+    if (flash->aiocb) {
+        /* Wait for the previous write-back.  */
+        qemu_mod_timer(flash->timer, qemu_get_clock(rt_clock) + FLASH_QUIET_MS);
+        return;
+    }
+
+    nb = am29f016_take_dirty(flash, &first);
+    if (nb == 0)
+        return;
+
+    flash->aio_sector = first;
+    flash->aio_nb_sectors = nb;
+    flash->aio_buf = qemu_memalign(512, nb << 9);
+    memcpy(flash->aio_buf, flash->mem + (first << 9), nb << 9);
+    flash->aiocb = bdrv_aio_write(flash->bs, first, flash->aio_buf, nb,
+                                  am29f016_aio_cb, flash);
+    if (!flash->aiocb)
+        am29f016_aio_cb(flash, -EIO);
+}
+
+/* Write everything back synchronously.  Used when the VM stops (shutdown
+   and savevm) so that nothing is lost.  */
 static void am29f016_flush(Am29f016State *flash)
 {
-    if (!flash->bs || flash->wr_start < 0)
+    int first, nb;
+
+    if (!flash->bs)
         return;
 
-    am29f016_update(flash,
-                    flash->wr_start, flash->wr_end - flash->wr_start + 1);
-    flash->wr_start = -1;
+    qemu_del_timer(flash->timer);
+    if (flash->aiocb)
+        qemu_aio_flush();
+
+    nb = am29f016_take_dirty(flash, &first);
+    if (nb == 0)
+        return;
+    if (bdrv_write(flash->bs, first, flash->mem + (first << 9), nb) < 0)
+        qemu_log("am29f016: write-back of sectors %d-%d failed\n",
+                 first, first + nb - 1);
 }
 
-static void am29f016_timer(void *opaque)
+static void am29f016_vm_state_change(void *opaque, int running, int reason)
 {
-    am29f016_flush(opaque);
+    if (!running)
+        am29f016_flush(opaque);
 }
 
 uint8_t am29f016_readb(Am29f016State *s, uint32_t addr)
@@ -168,18 +273,7 @@ void am29f016_writeb(Am29f016State *s, uint32_t addr, uint8_t value)
             s->mem[addr] &= value;
             s->cycle = 0;
             s->cmd = 0;
-            if (s->wr_start >= 0 && addr == s->wr_end + 1) {
-                s->wr_end++;
-            } else if (s->wr_start >= 0 && s->wr_start - 1 == addr) {
-                s->wr_start--;
-            } else {
-                if (s->wr_start >= 0)
-                    am29f016_flush(s);
-                /* Let's wait 1 second before writing on disk.  */
-                s->wr_start = addr;
-                s->wr_end = addr;
-                qemu_mod_timer(s->timer, qemu_get_clock(rt_clock) + 1000);
-            }
+            am29f016_set_dirty(s, addr, 1);
         }
         else if (s->cmd == 0x80 && ad == 0x5555 && value == 0xaa)
             s->cycle = 4;
@@ -203,16 +297,14 @@ void am29f016_writeb(Am29f016State *s, uint32_t addr, uint8_t value)
             /* Erase chip. */
             memset(s->mem, 0xff, sizeof(s->mem));
             s->counter = 10;
-            am29f016_flush(s);
-            am29f016_update(s, 0, sizeof(s->mem));
+            am29f016_set_dirty(s, 0, sizeof(s->mem));
         }
         else if (value == 0x30) {
             /* Erase sector. */
             qemu_log("am29f016: erasing sector %d\n", (int)(addr >> 16));
             memset(&s->mem[addr & 0x1f0000], 0xff, 0x10000);
             s->counter = 4;
-            am29f016_flush(s);
-            am29f016_update(s, addr & 0x1f0000, 0x10000);
+            am29f016_set_dirty(s, addr & 0x1f0000, 0x10000);
         }
         else {
             qemu_log("am29f016: bad write in cycle5: addr=%06x data=%02x\n",
@@ -239,8 +331,8 @@ Am29f016State *am29f016_init(BlockDriverState *bs)
             exit(1);
         }
     }
-    res->wr_start = -1;
     res->timer = qemu_new_timer(rt_clock, am29f016_timer, res);
+    qemu_add_vm_change_state_handler(am29f016_vm_state_change, res);
 
     return res;
 }
@@ -936,6 +936,8 @@ static void es40_init(ram_addr_t ram_size, int vga_ram_size,
     int index;
     ram_addr_t vga_ram_addr;
     RTCState *rtc;
+    ram_addr_t base, size, offset;
+    int i;
 
     if (!cpu_model)
         cpu_model = "21264";
@@ -947,9 +949,25 @@ static void es40_init(ram_addr_t ram_size, int vga_ram_size,
     }
     qemu_register_reset(es40_cpu_reset, env);
 
-    /* Allocate RAM.  */
-    ram_offset = qemu_ram_alloc(ram_size);
-    cpu_register_physical_memory(0, ram_size, ram_offset);
+    /* Allocate RAM, one block per Cchip memory array.  */
+    configure_mem_array(ram_size, arr);
+    ram_offset = 0;
+    base = 0;
+    for (i = 0; i < 4 && (arr[i] & 1); i++) {
+        size = (ram_addr_t)16 << (20 + ((arr[i] >> 12) & 0x0f) - 1);
+        offset = qemu_ram_alloc(size);
+        if (i == 0)
+            ram_offset = offset;
+        cpu_register_physical_memory(base, size, offset);
+        base += size;
+    }
+    if (base < ram_size) {
+        /* Not covered by the arrays.  */
+        offset = qemu_ram_alloc(ram_size - base);
+        if (base == 0)
+            ram_offset = offset;
+        cpu_register_physical_memory(base, ram_size - base, offset);
+    }
 
     /* allocate VGA RAM */
     vga_ram_addr = qemu_ram_alloc(vga_ram_size);
@@ -969,7 +987,6 @@ static void es40_init(ram_addr_t ram_size, int vga_ram_size,
         exit(1);
     }
 
-    configure_mem_array(ram_size, arr);
     typhoon = typhoon_21272_init(arr, &cchip_irqs, &tim_irq, env);
     tigbus_init(arr, flash_bs);
 
@@ -981,9 +998,14 @@ static void es40_init(ram_addr_t ram_size, int vga_ram_size,
                              (int (*)(void *))pic_read_irq, isa_pic);
 
     rtc = rtc_init_sqw(0x70, ali1543_get_irq(ali, 8), tim_irq, 1980);
+    typhoon_set_intim_hold(typhoon, rtc_get_sqw_hold(rtc));
 
     i8042_init(ali1543_get_irq(ali, 1), ali1543_get_irq(ali, 12), 0x60);
 
+    /* Network cards go in the PCI slots of hose 0 (at most 6).  */
+    for (i = 0; i < nb_nics && i < 6; i++)
+        pci_nic_init(hose0, &nd_table[i], PCI_DEVFN(1 + i, 0), "tulip");
+
     if (cirrus_vga_enabled && !nographic) {
         ram_addr_t vga_bios_offset;
         int vga_bios_size, ret;
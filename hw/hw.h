@@ -250,5 +250,10 @@ void qemu_register_boot_set(QEMUBootSetHandler *func, void *opaque);
 /* These should really be in isa.h, but are here to make pc.h happy.  */
 typedef void (IOPortWriteFunc)(void *opaque, uint32_t address, uint32_t data);
 typedef uint32_t (IOPortReadFunc)(void *opaque, uint32_t address);
+/* Data port window: return the address of the device's current position
+   in its transfer buffer and set *END to the end of the data that can be
+   streamed without side effects, or return NULL.  */
+typedef uint8_t **(IOPortDataFunc)(void *opaque, uint32_t address,
+                                   uint8_t **end);
 
 #endif
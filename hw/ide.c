@@ -2792,6 +2792,16 @@ static uint32_t ide_data_readl(void *opaque, uint32_t addr)
     return ret;
 }
 
+static uint8_t **ide_data_window(void *opaque, uint32_t addr, uint8_t **end)
+{
+    IDEState *s = ((IDEState *)opaque)->cur_drive;
+
+    if (!(s->status & DRQ_STAT))
+        return NULL;
+    *end = s->data_end;
+    return &s->data_ptr;
+}
+
 static void ide_dummy_transfer_stop(IDEState *s)
 {
     s->data_ptr = s->io_buffer;
@@ -2877,6 +2887,7 @@ static void ide_init_ioport(IDEState *ide_state, int iobase, int iobase2)
     register_ioport_read(iobase, 2, 2, ide_data_readw, ide_state);
     register_ioport_write(iobase, 4, 4, ide_data_writel, ide_state);
     register_ioport_read(iobase, 4, 4, ide_data_readl, ide_state);
+    register_ioport_data(iobase, 1, ide_data_window, ide_state);
 }
 
 /* save per IDE drive data */
@@ -2974,6 +2985,7 @@ static void ide_map(PCIDevice *pci_dev, int region_num,
             register_ioport_read(addr, 2, 2, ide_data_readw, ide_state);
             register_ioport_write(addr, 4, 4, ide_data_writel, ide_state);
             register_ioport_read(addr, 4, 4, ide_data_readl, ide_state);
+            register_ioport_data(addr, 1, ide_data_window, ide_state);
         }
     }
 }
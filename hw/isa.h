@@ -8,6 +8,8 @@ int register_ioport_read(int start, int length, int size,
                          IOPortReadFunc *func, void *opaque);
 int register_ioport_write(int start, int length, int size,
                           IOPortWriteFunc *func, void *opaque);
+int register_ioport_data(int start, int length,
+                         IOPortDataFunc *func, void *opaque);
 void isa_unassign_ioport(int start, int length);
 
 void isa_mmio_init(target_phys_addr_t base, target_phys_addr_t size);
@@ -30,6 +30,9 @@
 
 //#define DEBUG_CMOS
 
+/* Maximum number of square wave periods reported in one pulse.  */
+#define RTC_MAX_SQW_BURST       1024
+
 #define RTC_SECONDS             0
 #define RTC_SECONDS_ALARM       1
 #define RTC_MINUTES             2
@@ -68,6 +71,10 @@ struct RTCState {
     /* periodic timer */
     QEMUTimer *periodic_timer;
     int64_t next_periodic_time;
+    /* The square wave sink still has unacknowledged periods: the periodic
+       timer is not re-armed until it drops the hold line.  */
+    int sqw_held;
+    int sqw_stalled;
     /* second update */
     int64_t next_second_time;
 #ifdef TARGET_I386
@@ -132,8 +139,29 @@ static void rtc_timer_update(RTCState *s, int64_t current_time)
 static void rtc_periodic_timer(void *opaque)
 {
     RTCState *s = opaque;
-
-    rtc_timer_update(s, s->next_periodic_time);
+    int64_t now, last;
+    int ticks = 1;
+
+    if (s->sqw_irq) {
+        /* Count the periods that expired while the host timer was late
+           and deliver them as a single burst, so that the timer is only
+           re-armed for the next deadline that is still in the future.  */
+        now = qemu_get_clock(vm_clock);
+        do {
+            last = s->next_periodic_time;
+            rtc_timer_update(s, last);
+            if (s->next_periodic_time == last
+                || s->next_periodic_time > now)
+                break;
+            if (ticks == RTC_MAX_SQW_BURST) {
+                rtc_timer_update(s, now);
+                break;
+            }
+            ticks++;
+        } while (1);
+    } else {
+        rtc_timer_update(s, s->next_periodic_time);
+    }
 
 //printf("rtc_periodic_timer\n");
 
@@ -143,8 +171,26 @@ static void rtc_periodic_timer(void *opaque)
     }
     if (s->cmos_data[RTC_REG_B] & REG_B_SQWE) {
         /* Not square wave at all but we don't want 2048Hz interrupts!
-           Must be seen as a pulse.  */
-        qemu_irq_raise(s->sqw_irq);
+           Must be seen as a pulse, whose level is the number of
+           periods elapsed.  */
+        qemu_set_irq(s->sqw_irq, ticks);
+        if (s->sqw_held) {
+            /* Keep next_periodic_time: the periods that expire until the
+               sink catches up are counted when the timer is re-armed.  */
+            qemu_del_timer(s->periodic_timer);
+            s->sqw_stalled = 1;
+        }
+    }
+}
+
+static void rtc_set_sqw_hold(void *opaque, int irq, int level)
+{
+    RTCState *s = opaque;
+
+    s->sqw_held = level;
+    if (!level && s->sqw_stalled) {
+        s->sqw_stalled = 0;
+        qemu_mod_timer(s->periodic_timer, s->next_periodic_time);
     }
 }
 
@@ -573,6 +619,13 @@ RTCState *rtc_init_sqw(int base, qemu_irq irq, qemu_irq sqw_irq, int base_year)
     return s;
 }
 
+/* Input line that the square wave sink raises while it has periods that
+   the guest did not acknowledge yet.  */
+qemu_irq rtc_get_sqw_hold(RTCState *s)
+{
+    return qemu_allocate_irqs(rtc_set_sqw_hold, s, 1)[0];
+}
+
 RTCState *rtc_init(int base, qemu_irq irq, int base_year)
 {
     return rtc_init_sqw(base, irq, NULL, base_year);
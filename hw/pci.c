@@ -781,6 +781,7 @@ static const char * const pci_nic_models[] = {
     "rtl8139",
     "e1000",
     "pcnet",
+    "tulip",
     "virtio",
     NULL
 };
@@ -795,6 +796,7 @@ static PCINICInitFn pci_nic_init_fns[] = {
     pci_rtl8139_init,
     pci_e1000_init,
     pci_pcnet_init,
+    pci_tulip_init,
     virtio_net_init,
     NULL
 };
@@ -249,6 +249,9 @@ PCIDevice *pci_e1000_init(PCIBus *bus, NICInfo *nd, int devfn);
 /* pcnet.c */
 PCIDevice *pci_pcnet_init(PCIBus *bus, NICInfo *nd, int devfn);
 
+/* tulip.c */
+PCIDevice *pci_tulip_init(PCIBus *bus, NICInfo *nd, int devfn);
+
 /* prep_pci.c */
 PCIBus *pci_prep_init(qemu_irq *pic);
 
@@ -267,6 +270,7 @@ TyphoonState *typhoon_21272_init (uint64_t *arr, qemu_irq **irqs,
                                   qemu_irq *intim_irq, void *cpu0);
 void typhoon_set_iack_handler(TyphoonState *c, int num,
                               int (*handler)(void *), void *param);
+void typhoon_set_intim_hold(TyphoonState *c, qemu_irq hold);
 PCIBus *typhoon_get_pci_bus(TyphoonState *c, int num);
 
 /* ali1543.c */
@@ -27,6 +27,7 @@
 #include "isa.h"
 #include "pc.h"
 #include "qemu-timer.h"
+#include "sysemu.h"
 
 //#define DEBUG_SERIAL
 
@@ -97,6 +98,7 @@
 #define XMIT_FIFO           0
 #define RECV_FIFO           1
 #define MAX_XMIT_RETRY      4
+#define XMIT_BUF_LENGTH     256     /* Host side output staging buffer */
 
 struct SerialFIFO {
     uint8_t data[UART_FIFO_LENGTH];
@@ -142,6 +144,14 @@ struct SerialState {
     int poll_msl;
 
     struct QEMUTimer *modem_status_poll;
+
+    /* Bytes that left the tsr but have not been handed to the chardev
+       yet.  They are written out in one go when the flush timer fires
+       or when the buffer fills up. */
+    uint8_t xmit_buf[XMIT_BUF_LENGTH];
+    int xmit_buf_len;
+    int xmit_buf_retry;
+    struct QEMUTimer *flush_timer;
 };
 
 static void serial_receive1(void *opaque, const uint8_t *buf, int size);
@@ -289,6 +299,69 @@ static void serial_update_msl(SerialState *s)
         qemu_mod_timer(s->modem_status_poll, qemu_get_clock(vm_clock) + ticks_per_sec / 100);
 }
 
+/* Hand the staging buffer to the chardev.  Whatever could not be
+   written stays queued and is retried one character time later.  */
+static void serial_flush_xmit(void *opaque)
+{
+    SerialState *s = opaque;
+    int ret;
+
+    if (s->xmit_buf_len == 0)
+        return;
+
+    ret = qemu_chr_write(s->chr, s->xmit_buf, s->xmit_buf_len);
+    if (ret < 0)
+        ret = 0;
+    if (ret < s->xmit_buf_len) {
+        if (s->poll_msl < 0 && ++s->xmit_buf_retry > MAX_XMIT_RETRY) {
+            /* Same policy as for the tsr: do not let a guest stall on
+               an unconnected pipe or pty, drop what we have.  */
+            s->xmit_buf_len = 0;
+            s->xmit_buf_retry = 0;
+            return;
+        }
+        memmove(s->xmit_buf, s->xmit_buf + ret, s->xmit_buf_len - ret);
+        s->xmit_buf_len -= ret;
+        qemu_mod_timer(s->flush_timer,
+                       qemu_get_clock(vm_clock) + s->char_transmit_time);
+        return;
+    }
+    s->xmit_buf_len = 0;
+    s->xmit_buf_retry = 0;
+    qemu_del_timer(s->flush_timer);
+}
+
+/* Queue the byte that just left the tsr.  Returns 0 when the staging
+   buffer is full and the chardev does not accept more data, in which
+   case the caller keeps the byte in the tsr.  */
+static int serial_queue_xmit(SerialState *s, uint8_t ch)
+{
+    if (s->xmit_buf_len == XMIT_BUF_LENGTH) {
+        serial_flush_xmit(s);
+        if (s->xmit_buf_len == XMIT_BUF_LENGTH)
+            return 0;
+    }
+
+    s->xmit_buf[s->xmit_buf_len++] = ch;
+    if (s->xmit_buf_len == XMIT_BUF_LENGTH) {
+        serial_flush_xmit(s);
+    } else if (!qemu_timer_pending(s->flush_timer)) {
+        /* Coalesce everything sent within the time a full FIFO would
+           take to drain on the wire.  */
+        qemu_mod_timer(s->flush_timer, qemu_get_clock(vm_clock) +
+                       s->char_transmit_time * UART_FIFO_LENGTH);
+    }
+    return 1;
+}
+
+static void serial_vm_state_change(void *opaque, int running, int reason)
+{
+    SerialState *s = opaque;
+
+    if (!running)
+        serial_flush_xmit(s);
+}
+
 static void serial_xmit(void *opaque)
 {
     SerialState *s = opaque;
@@ -308,7 +381,7 @@ static void serial_xmit(void *opaque)
     if (s->mcr & UART_MCR_LOOP) {
         /* in loopback mode, say that we just received a char */
         serial_receive1(s, &s->tsr, 1);
-    } else if (qemu_chr_write(s->chr, &s->tsr, 1) != 1) {
+    } else if (!serial_queue_xmit(s, s->tsr)) {
         if ((s->tsr_retry > 0) && (s->tsr_retry <= MAX_XMIT_RETRY)) {
             s->tsr_retry++;
             qemu_mod_timer(s->transmit_timer,  new_xmit_ts + s->char_transmit_time);
@@ -637,6 +710,8 @@ static void serial_save(QEMUFile *f, void *opaque)
 {
     SerialState *s = opaque;
 
+    serial_flush_xmit(s);
+
     qemu_put_be16s(f,&s->divider);
     qemu_put_8s(f,&s->rbr);
     qemu_put_8s(f,&s->ier);
@@ -682,6 +757,8 @@ static void serial_reset(void *opaque)
 {
     SerialState *s = opaque;
 
+    serial_flush_xmit(s);
+
     s->rbr = 0;
     s->ier = 0;
     s->iir = UART_IIR_NO_INT;
@@ -717,6 +794,8 @@ static void serial_init_core(SerialState *s, qemu_irq irq, int baudbase,
 
     s->fifo_timeout_timer = qemu_new_timer(vm_clock, (QEMUTimerCB *) fifo_timeout_int, s);
     s->transmit_timer = qemu_new_timer(vm_clock, (QEMUTimerCB *) serial_xmit, s);
+    s->flush_timer = qemu_new_timer(vm_clock, serial_flush_xmit, s);
+    qemu_add_vm_change_state_handler(serial_vm_state_change, s);
 
     qemu_register_reset(serial_reset, s);
     serial_reset(s);
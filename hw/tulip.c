@@ -0,0 +1,1116 @@
+/*
+ * QEMU DEC 21143 (Tulip) emulation
+ *
+ * Copyright (c) 2009 AdaCore
+ *
+ * This work is licensed under the GNU GPL license version 2 or later.
+ *
+ * This models the 21143 as found on the DE500-BA and on the es40 PCI
+ * slots: the CSR file, the descriptor rings, the serial ROM, an MII PHY
+ * on the management interface and the CSR11 interrupt mitigation logic.
+ *
+ * The rings are walked in batches: a transmit poll demand (CSR1) sends
+ * every frame handed to the chip before returning, and the receive side
+ * only rescans the ring once it has been found empty and a receive poll
+ * demand (CSR2) or a new frame arrives.  Transmit buffers are mapped and
+ * passed to the VLAN as an iovec, so that the common case involves no
+ * intermediate copy.
+ */
+#include "hw.h"
+#include "pci.h"
+#include "net.h"
+#include "qemu-timer.h"
+#include "eeprom93xx.h"
+
+//#define DEBUG_TULIP
+
+#ifdef DEBUG_TULIP
+#define DPRINTF(fmt, ...) \
+    do { fprintf(stderr, "tulip: " fmt , ## __VA_ARGS__); } while (0)
+#else
+#define DPRINTF(fmt, ...) do { } while (0)
+#endif
+
+#define PCI_DEVICE_ID_DEC_21143  0x0019
+
+/* 16 CSRs, quadword aligned.  */
+#define TULIP_CSR_SIZE  0x80
+
+#define TULIP_MAX_FRAME 1536
+#define TULIP_MAX_FRAGS 32
+/* Descriptors walked per transmit poll; bounds the walk when the ring is
+   in memory where the chip cannot clear the OWN bit.  */
+#define TULIP_MAX_TX_DESC 1024
+#define TULIP_SROM_WORDS 64
+
+/* CSR0: bus mode.  */
+#define CSR0_SWR        (1 << 0)
+#define CSR0_DSL_SHIFT  2
+#define CSR0_DSL_MASK   0x1f
+
+/* CSR5: status, CSR7: interrupt enable.  */
+#define CSR5_TI         (1 << 0)
+#define CSR5_TPS        (1 << 1)
+#define CSR5_TU         (1 << 2)
+#define CSR5_RI         (1 << 6)
+#define CSR5_RU         (1 << 7)
+#define CSR5_RPS        (1 << 8)
+#define CSR5_GTE        (1 << 11)
+#define CSR5_LNF        (1 << 12)
+#define CSR5_ERI        (1 << 14)
+#define CSR5_AIS        (1 << 15)
+#define CSR5_NIS        (1 << 16)
+#define CSR5_RS_SHIFT   17
+#define CSR5_TS_SHIFT   20
+#define CSR5_GPI        (1 << 26)
+#define CSR5_LC         (1 << 27)
+#define CSR5_W1C        (0x0001ffff | CSR5_GPI | CSR5_LC)
+#define CSR5_NORMAL     (CSR5_TI | CSR5_TU | CSR5_RI | CSR5_ERI)
+#define CSR5_ABNORMAL   (0x00007fff & ~CSR5_NORMAL)
+
+/* Process states reported in CSR5.  */
+#define RS_STOPPED      0
+#define RS_WAIT         3
+#define RS_SUSPENDED    4
+#define TS_STOPPED      0
+#define TS_SUSPENDED    6
+
+/* CSR6: operation mode.  */
+#define CSR6_HP         (1 << 0)
+#define CSR6_SR         (1 << 1)
+#define CSR6_HO         (1 << 2)
+#define CSR6_IF         (1 << 4)
+#define CSR6_PR         (1 << 6)
+#define CSR6_PM         (1 << 7)
+#define CSR6_ST         (1 << 13)
+
+/* CSR9: serial ROM and MII management.  */
+#define CSR9_SR_CS      (1 << 0)
+#define CSR9_SR_SK      (1 << 1)
+#define CSR9_SR_DI      (1 << 2)
+#define CSR9_SR_DO      (1 << 3)
+#define CSR9_SR         (1 << 11)
+#define CSR9_MDC        (1 << 16)
+#define CSR9_MDO        (1 << 17)
+#define CSR9_MII        (1 << 18)
+#define CSR9_MDI        (1 << 19)
+
+/* CSR11: general purpose timer and interrupt mitigation.  */
+#define CSR11_CS        (1U << 31)
+#define CSR11_TT(v)     (((v) >> 27) & 0xf)
+#define CSR11_NTP(v)    (((v) >> 24) & 0x7)
+#define CSR11_RT(v)     (((v) >> 20) & 0xf)
+#define CSR11_NRP(v)    (((v) >> 17) & 0x7)
+#define CSR11_CON       (1 << 16)
+#define CSR11_TIMER(v)  ((v) & 0xffff)
+
+/* Descriptor word 0.  */
+#define DES0_OWN        (1U << 31)
+#define RDES0_FL_SHIFT  16
+#define RDES0_ES        (1 << 15)
+#define RDES0_FS        (1 << 9)
+#define RDES0_LS        (1 << 8)
+#define RDES0_MF        (1 << 10)
+#define RDES0_FT        (1 << 5)
+
+/* Descriptor word 1.  */
+#define TDES1_IC        (1U << 31)
+#define TDES1_LS        (1 << 30)
+#define TDES1_FS        (1 << 29)
+#define TDES1_SET       (1 << 27)
+#define DES1_ER         (1 << 25)
+#define DES1_CH         (1 << 24)
+#define DES1_BS2(v)     (((v) >> 11) & 0x7ff)
+#define DES1_BS1(v)     ((v) & 0x7ff)
+
+/* The mitigation timers count in units of 16 cycles.  Cycle times are
+   those of the 100Mb/s mode, the only one we report through the PHY.  */
+#define TULIP_MIT_UNIT_NS(csr11) ((((csr11) & CSR11_CS) ? 81920 : 5120) * 16)
+#define TULIP_GPT_UNIT_NS        81920
+
+struct tulip_frag {
+    uint32_t addr;
+    int len;
+};
+
+struct tulip_desc {
+    uint32_t status;
+    uint32_t control;
+    uint32_t buf1;
+    uint32_t buf2;
+};
+
+typedef struct TulipState {
+    PCIDevice dev;
+    VLANClientState *vc;
+    NICInfo *nd;
+    int mmio_index;
+    eeprom_t *eeprom;
+
+    uint32_t csr[16];
+    uint32_t cur_rx;
+    uint32_t cur_tx;
+    int rx_state;
+    int tx_state;
+
+    /* Address filter, loaded by setup frames.  */
+    uint8_t perfect[16][6];
+    uint8_t hash[64];
+
+    /* Interrupt mitigation: frames completed but not yet signalled.  */
+    int rx_pending;
+    int tx_pending;
+    QEMUTimer *rx_mit_timer;
+    QEMUTimer *tx_mit_timer;
+    QEMUTimer *gp_timer;
+
+    /* MII management frame decoder.  */
+    int mii_ones;
+    int mii_bits;
+    int mii_state;
+    uint32_t mii_cmd;
+    uint32_t mii_out;
+    uint16_t mii_regs[32];
+
+    /* Only used when a transmit buffer cannot be mapped.  */
+    uint8_t tx_buf[TULIP_MAX_FRAME];
+} TulipState;
+
+enum { MII_IDLE, MII_CMD, MII_READ, MII_WRITE };
+
+#define TULIP_PHY_ADDR  1
+
+static const uint16_t tulip_mii_init[32] = {
+    [0] = 0x3100,               /* BMCR: 100Mb/s, autoneg, full duplex */
+    [1] = 0x786d,               /* BMSR: link up, autoneg complete */
+    [2] = 0x0013,               /* PHYID */
+    [3] = 0x78e2,
+    [4] = 0x01e1,               /* ANAR */
+    [5] = 0x45e1,               /* ANLPAR */
+    [6] = 0x0001,               /* ANER */
+};
+
+static void tulip_dma_read(TulipState *s, uint32_t addr, void *buf, int len)
+{
+    cpu_physical_memory_read(addr, buf, len);
+}
+
+static void tulip_dma_write(TulipState *s, uint32_t addr,
+                            const void *buf, int len)
+{
+    cpu_physical_memory_write(addr, buf, len);
+}
+
+static void tulip_desc_read(TulipState *s, uint32_t addr,
+                            struct tulip_desc *d)
+{
+    tulip_dma_read(s, addr, d, sizeof(*d));
+    d->status = le32_to_cpu(d->status);
+    d->control = le32_to_cpu(d->control);
+    d->buf1 = le32_to_cpu(d->buf1);
+    d->buf2 = le32_to_cpu(d->buf2);
+}
+
+static void tulip_desc_set_status(TulipState *s, uint32_t addr,
+                                  uint32_t status)
+{
+    uint32_t val = cpu_to_le32(status);
+
+    tulip_dma_write(s, addr, &val, 4);
+}
+
+static uint32_t tulip_next_desc(TulipState *s, uint32_t addr,
+                                const struct tulip_desc *d, uint32_t base)
+{
+    if (d->control & DES1_ER)
+        return base;
+    if (d->control & DES1_CH)
+        return d->buf2;
+    return addr + sizeof(*d)
+        + ((s->csr[0] >> CSR0_DSL_SHIFT) & CSR0_DSL_MASK) * 4;
+}
+
+static void tulip_update_irq(TulipState *s)
+{
+    uint32_t pending = s->csr[5] & s->csr[7];
+    int level = 0;
+
+    s->csr[5] &= ~(CSR5_NIS | CSR5_AIS);
+    if (pending & CSR5_NORMAL) {
+        s->csr[5] |= CSR5_NIS;
+        if (s->csr[7] & CSR5_NIS)
+            level = 1;
+    }
+    if (pending & CSR5_ABNORMAL) {
+        s->csr[5] |= CSR5_AIS;
+        if (s->csr[7] & CSR5_AIS)
+            level = 1;
+    }
+    s->csr[5] = (s->csr[5] & ~((7 << CSR5_RS_SHIFT) | (7 << CSR5_TS_SHIFT)))
+        | (s->rx_state << CSR5_RS_SHIFT) | (s->tx_state << CSR5_TS_SHIFT);
+
+    qemu_set_irq(s->dev.irq[0], level);
+}
+
+/* Interrupt mitigation.  A completion is only signalled once NRP (NTP)
+   frames are pending or RT (TT) has elapsed since the first of them, so
+   that the interrupt rate seen by the guest is bounded by the timers
+   rather than by the packet rate.  */
+
+static void tulip_rx_done(TulipState *s)
+{
+    uint32_t csr11 = s->csr[11];
+    int nrp = CSR11_NRP(csr11);
+    int rt = CSR11_RT(csr11);
+
+    if (!nrp && !rt) {
+        s->csr[5] |= CSR5_RI;
+        return;
+    }
+    if (nrp && ++s->rx_pending >= nrp) {
+        s->rx_pending = 0;
+        qemu_del_timer(s->rx_mit_timer);
+        s->csr[5] |= CSR5_RI;
+    } else if (rt && !qemu_timer_pending(s->rx_mit_timer)) {
+        qemu_mod_timer(s->rx_mit_timer, qemu_get_clock(vm_clock)
+                       + (int64_t)rt * TULIP_MIT_UNIT_NS(csr11));
+    }
+}
+
+static void tulip_tx_done(TulipState *s)
+{
+    uint32_t csr11 = s->csr[11];
+    int ntp = CSR11_NTP(csr11);
+    int tt = CSR11_TT(csr11);
+
+    if (!ntp && !tt) {
+        s->csr[5] |= CSR5_TI;
+        return;
+    }
+    if (ntp && ++s->tx_pending >= ntp) {
+        s->tx_pending = 0;
+        qemu_del_timer(s->tx_mit_timer);
+        s->csr[5] |= CSR5_TI;
+    } else if (tt && !qemu_timer_pending(s->tx_mit_timer)) {
+        qemu_mod_timer(s->tx_mit_timer, qemu_get_clock(vm_clock)
+                       + (int64_t)tt * TULIP_MIT_UNIT_NS(csr11));
+    }
+}
+
+static void tulip_rx_mit_timer(void *opaque)
+{
+    TulipState *s = opaque;
+
+    s->rx_pending = 0;
+    s->csr[5] |= CSR5_RI;
+    tulip_update_irq(s);
+}
+
+static void tulip_tx_mit_timer(void *opaque)
+{
+    TulipState *s = opaque;
+
+    s->tx_pending = 0;
+    s->csr[5] |= CSR5_TI;
+    tulip_update_irq(s);
+}
+
+static void tulip_gp_timer_start(TulipState *s)
+{
+    uint32_t count = CSR11_TIMER(s->csr[11]);
+
+    if (count)
+        qemu_mod_timer(s->gp_timer, qemu_get_clock(vm_clock)
+                       + (int64_t)count * TULIP_GPT_UNIT_NS);
+    else
+        qemu_del_timer(s->gp_timer);
+}
+
+static void tulip_gp_timer(void *opaque)
+{
+    TulipState *s = opaque;
+
+    s->csr[5] |= CSR5_GTE;
+    if (s->csr[11] & CSR11_CON)
+        tulip_gp_timer_start(s);
+    tulip_update_irq(s);
+}
+
+/* Receive filter.  */
+
+static uint32_t tulip_crc_le(const uint8_t *p, int len)
+{
+    uint32_t crc = 0xffffffff;
+    int i;
+
+    while (len--) {
+        crc ^= *p++;
+        for (i = 0; i < 8; i++)
+            crc = (crc >> 1) ^ (crc & 1 ? 0xedb88320 : 0);
+    }
+    return crc;
+}
+
+static int tulip_hash_match(TulipState *s, const uint8_t *addr)
+{
+    int bit = tulip_crc_le(addr, 6) & 0x1ff;
+
+    return (s->hash[bit >> 3] >> (bit & 7)) & 1;
+}
+
+static int tulip_filter(TulipState *s, const uint8_t *buf)
+{
+    uint32_t csr6 = s->csr[6];
+    int i, match;
+
+    if (csr6 & CSR6_PR)
+        return 1;
+    if ((buf[0] & 1) && (csr6 & CSR6_PM))
+        return 1;
+    if (!memcmp(buf, "\xff\xff\xff\xff\xff\xff", 6))
+        return 1;
+
+    if (csr6 & CSR6_HP) {
+        if ((buf[0] & 1) || (csr6 & CSR6_HO))
+            return tulip_hash_match(s, buf);
+        /* Imperfect filtering keeps a single perfect unicast address.  */
+        return !memcmp(buf, s->perfect[0], 6);
+    }
+
+    match = 0;
+    for (i = 0; i < 16; i++)
+        if (!memcmp(buf, s->perfect[i], 6)) {
+            match = 1;
+            break;
+        }
+    return (csr6 & CSR6_IF) ? !match : match;
+}
+
+static void tulip_setup_frame(TulipState *s, const struct tulip_desc *d)
+{
+    uint8_t buf[192];
+    int i;
+
+    if (DES1_BS1(d->control) < sizeof(buf))
+        return;
+    tulip_dma_read(s, d->buf1, buf, sizeof(buf));
+
+    if (s->csr[6] & CSR6_HP) {
+        /* 512 bit hash table in the low words of the first 32 longwords,
+           followed by the physical address in longwords 39-41.  */
+        for (i = 0; i < 32; i++) {
+            s->hash[i * 2] = buf[i * 4];
+            s->hash[i * 2 + 1] = buf[i * 4 + 1];
+        }
+        for (i = 0; i < 3; i++) {
+            s->perfect[0][i * 2] = buf[156 + i * 4];
+            s->perfect[0][i * 2 + 1] = buf[156 + i * 4 + 1];
+        }
+    } else {
+        for (i = 0; i < 16 * 3; i++) {
+            s->perfect[i / 3][(i % 3) * 2] = buf[i * 4];
+            s->perfect[i / 3][(i % 3) * 2 + 1] = buf[i * 4 + 1];
+        }
+    }
+}
+
+/* Transmit.  */
+
+static void tulip_send(TulipState *s, const struct tulip_frag *frags,
+                       int nfrags)
+{
+    struct iovec iov[TULIP_MAX_FRAGS];
+    target_phys_addr_t len;
+    int i, n, size;
+
+    if (nfrags == 0)
+        return;
+
+    /* Map every fragment.  If one of them is not plain RAM (or the
+       bounce buffer is busy), fall back to gathering the frame.  */
+    for (n = 0; n < nfrags; n++) {
+        len = frags[n].len;
+        iov[n].iov_base = cpu_physical_memory_map(frags[n].addr, &len, 0);
+        iov[n].iov_len = len;
+        if (!iov[n].iov_base)
+            break;
+        if (len != frags[n].len) {
+            n++;
+            break;
+        }
+    }
+
+    if (n > 0 && n == nfrags && iov[n - 1].iov_len == frags[n - 1].len) {
+        qemu_sendv_packet(s->vc, iov, nfrags);
+    } else {
+        size = 0;
+        for (i = 0; i < nfrags; i++) {
+            tulip_dma_read(s, frags[i].addr, s->tx_buf + size, frags[i].len);
+            size += frags[i].len;
+        }
+        qemu_send_packet(s->vc, s->tx_buf, size);
+    }
+
+    for (i = 0; i < n; i++)
+        cpu_physical_memory_unmap(iov[i].iov_base, iov[i].iov_len, 0,
+                                  iov[i].iov_len);
+}
+
+static void tulip_add_frag(struct tulip_frag *frags, int *nfrags, int *size,
+                           uint32_t addr, int len)
+{
+    if (!len || *nfrags >= TULIP_MAX_FRAGS
+        || *size + len > TULIP_MAX_FRAME)
+        return;
+    frags[*nfrags].addr = addr;
+    frags[*nfrags].len = len;
+    (*nfrags)++;
+    *size += len;
+}
+
+/* Send every frame owned by the chip, then report all completions with a
+   single interrupt update.  */
+static void tulip_xmit(TulipState *s)
+{
+    struct tulip_desc d;
+    struct tulip_frag frags[TULIP_MAX_FRAGS];
+    int nfrags = 0;
+    int size = 0;
+    int in_frame = 0;
+    int n;
+
+    if (!(s->csr[6] & CSR6_ST))
+        return;
+
+    for (n = 0; ; n++) {
+        tulip_desc_read(s, s->cur_tx, &d);
+        if (!(d.status & DES0_OWN) || n >= TULIP_MAX_TX_DESC) {
+            s->tx_state = TS_SUSPENDED;
+            s->csr[5] |= CSR5_TU;
+            break;
+        }
+
+        if (d.control & TDES1_SET) {
+            tulip_setup_frame(s, &d);
+        } else {
+            if (d.control & TDES1_FS) {
+                nfrags = 0;
+                size = 0;
+                in_frame = 1;
+            }
+            if (in_frame) {
+                tulip_add_frag(frags, &nfrags, &size,
+                               d.buf1, DES1_BS1(d.control));
+                if (!(d.control & DES1_CH))
+                    tulip_add_frag(frags, &nfrags, &size,
+                                   d.buf2, DES1_BS2(d.control));
+            }
+            if ((d.control & TDES1_LS) && in_frame) {
+                DPRINTF("xmit %d bytes in %d fragments\n", size, nfrags);
+                if (s->vc)
+                    tulip_send(s, frags, nfrags);
+                in_frame = 0;
+                if (d.control & TDES1_IC)
+                    tulip_tx_done(s);
+            }
+        }
+
+        tulip_desc_set_status(s, s->cur_tx, 0);
+        s->cur_tx = tulip_next_desc(s, s->cur_tx, &d, s->csr[4]);
+    }
+
+    tulip_update_irq(s);
+}
+
+/* Receive.  */
+
+static int tulip_rx_ready(TulipState *s)
+{
+    uint32_t status;
+
+    if (!(s->csr[6] & CSR6_SR))
+        return 0;
+    tulip_dma_read(s, s->cur_rx, &status, 4);
+    if (le32_to_cpu(status) & DES0_OWN) {
+        s->rx_state = RS_WAIT;
+        return 1;
+    }
+    return 0;
+}
+
+static int tulip_can_receive(void *opaque)
+{
+    TulipState *s = opaque;
+
+    /* A suspended receiver rechecks its current descriptor when a frame
+       shows up, exactly like the chip does.  */
+    return tulip_rx_ready(s);
+}
+
+static void tulip_receive(void *opaque, const uint8_t *buf, int size)
+{
+    TulipState *s = opaque;
+    static const uint8_t pad[60];
+    struct tulip_desc d[TULIP_MAX_FRAGS];
+    uint32_t addr[TULIP_MAX_FRAGS + 1];
+    uint32_t status;
+    int i, b, n, ndesc, room, frame_len, done;
+
+    if (!(s->csr[6] & CSR6_SR) || size < 14)
+        return;
+    if (!tulip_filter(s, buf))
+        return;
+
+    /* Runt frames are padded to the minimum length, and the CRC is
+       accounted in the reported length.  */
+    frame_len = size < 60 ? 60 : size;
+
+    /* Collect enough descriptors for the whole frame before touching any
+       of them, so that a lack of buffers never leaves a partial frame in
+       the ring.  */
+    addr[0] = s->cur_rx;
+    room = 0;
+    for (ndesc = 0; room < frame_len; ndesc++) {
+        if (ndesc == TULIP_MAX_FRAGS)
+            return;
+        tulip_desc_read(s, addr[ndesc], &d[ndesc]);
+        if (!(d[ndesc].status & DES0_OWN)) {
+            /* Out of buffers: the frame is lost.  */
+            s->rx_state = RS_SUSPENDED;
+            s->csr[5] |= CSR5_RU;
+            s->csr[8] = (s->csr[8] & ~0xffff) | ((s->csr[8] + 1) & 0xffff);
+            tulip_update_irq(s);
+            return;
+        }
+        room += DES1_BS1(d[ndesc].control);
+        if (!(d[ndesc].control & DES1_CH))
+            room += DES1_BS2(d[ndesc].control);
+        addr[ndesc + 1] = tulip_next_desc(s, addr[ndesc], &d[ndesc],
+                                          s->csr[3]);
+    }
+
+    done = 0;
+    for (i = 0; i < ndesc; i++) {
+        for (b = 0; b < 2 && done < frame_len; b++) {
+            uint32_t baddr = b ? d[i].buf2 : d[i].buf1;
+            int bsize = b ? DES1_BS2(d[i].control) : DES1_BS1(d[i].control);
+
+            if (b == 1 && (d[i].control & DES1_CH))
+                break;
+            n = frame_len - done;
+            if (n > bsize)
+                n = bsize;
+            if (done + n <= size) {
+                tulip_dma_write(s, baddr, buf + done, n);
+            } else if (done < size) {
+                tulip_dma_write(s, baddr, buf + done, size - done);
+                tulip_dma_write(s, baddr + size - done, pad, done + n - size);
+            } else {
+                tulip_dma_write(s, baddr, pad, n);
+            }
+            done += n;
+        }
+
+        status = i == 0 ? RDES0_FS : 0;
+        if (i == ndesc - 1) {
+            status |= RDES0_LS | ((frame_len + 4) << RDES0_FL_SHIFT);
+            if (buf[0] & 1)
+                status |= RDES0_MF;
+            if (((buf[12] << 8) | buf[13]) > 1500)
+                status |= RDES0_FT;
+        }
+        tulip_desc_set_status(s, addr[i], status);
+    }
+
+    s->cur_rx = addr[ndesc];
+    tulip_rx_done(s);
+    tulip_update_irq(s);
+}
+
+/* Serial ROM.  The layout follows the DEC SROM format, version 3, with a
+   single MII PHY info leaf.  */
+
+static void tulip_srom_init(TulipState *s)
+{
+    uint16_t *srom = eeprom93xx_data(s->eeprom);
+    uint8_t buf[TULIP_SROM_WORDS * 2];
+    uint32_t crc;
+    int i;
+
+    memset(buf, 0, sizeof(buf));
+    buf[0] = PCI_VENDOR_ID_DEC & 0xff;      /* Subsystem vendor */
+    buf[1] = PCI_VENDOR_ID_DEC >> 8;
+    buf[2] = 0x0b;                          /* Subsystem (DE500-BA) */
+    buf[3] = 0x50;
+    buf[18] = 3;                            /* SROM format version */
+    buf[19] = 1;                            /* Controller count */
+    memcpy(&buf[20], s->nd->macaddr, 6);
+    buf[26] = 0;                            /* Device number */
+    buf[27] = 30;                           /* Info leaf offset */
+    buf[28] = 0;
+
+    /* Info leaf: autosense, one extended block of type 3 (21143 MII).  */
+    buf[30] = 0x00;
+    buf[31] = 0x08;
+    buf[32] = 1;
+    buf[33] = 0x80 | 13;
+    buf[34] = 3;
+    buf[35] = 0;                            /* PHY number */
+    buf[36] = 0;                            /* GP sequence length */
+    buf[37] = 0;                            /* Reset sequence length */
+    buf[38] = 0x00;                         /* Media capabilities */
+    buf[39] = 0x78;
+    buf[40] = 0xe1;                         /* Nway advertisement */
+    buf[41] = 0x01;
+    buf[42] = 0x00;                         /* FDX bit map */
+    buf[43] = 0x50;
+    buf[44] = 0x00;                         /* TTM bit map */
+    buf[45] = 0x18;
+    buf[46] = 0;                            /* MII interrupt */
+
+    crc = ~tulip_crc_le(buf, 126);
+    buf[126] = crc & 0xff;
+    buf[127] = (crc >> 8) & 0xff;
+
+    for (i = 0; i < TULIP_SROM_WORDS; i++)
+        srom[i] = buf[i * 2] | (buf[i * 2 + 1] << 8);
+}
+
+/* MII management interface.  Frames are clocked on the rising edge of
+   MDC: a preamble of at least 32 ones, start (01), opcode, PHY address,
+   register address, turnaround, then 16 data bits.  */
+
+static void tulip_mii_clock(TulipState *s, int mdo)
+{
+    int phy, reg;
+
+    switch (s->mii_state) {
+    case MII_IDLE:
+        if (mdo) {
+            s->mii_ones++;
+        } else {
+            if (s->mii_ones >= 32) {
+                s->mii_state = MII_CMD;
+                s->mii_cmd = 0;
+                s->mii_bits = 0;
+            }
+            s->mii_ones = 0;
+        }
+        break;
+    case MII_CMD:
+        /* Start bit 1, opcode, PHY and register: 13 bits.  */
+        s->mii_cmd = (s->mii_cmd << 1) | mdo;
+        if (++s->mii_bits < 13)
+            break;
+        phy = (s->mii_cmd >> 5) & 0x1f;
+        reg = s->mii_cmd & 0x1f;
+        s->mii_bits = 0;
+        if (((s->mii_cmd >> 10) & 7) == 6) {
+            /* Read: turnaround (Z, 0), data, idle.  */
+            s->mii_out = 0x40001;
+            if (phy == TULIP_PHY_ADDR)
+                s->mii_out |= s->mii_regs[reg] << 1;
+            else
+                s->mii_out |= 0xffff << 1;
+            s->mii_state = MII_READ;
+        } else if (((s->mii_cmd >> 10) & 7) == 5) {
+            s->mii_state = MII_WRITE;
+        } else {
+            s->mii_state = MII_IDLE;
+        }
+        break;
+    case MII_READ:
+        if (++s->mii_bits >= 19) {
+            s->mii_state = MII_IDLE;
+            s->mii_ones = 0;
+        }
+        break;
+    case MII_WRITE:
+        s->mii_out = (s->mii_out << 1) | mdo;
+        if (++s->mii_bits < 18)
+            break;
+        phy = (s->mii_cmd >> 5) & 0x1f;
+        reg = s->mii_cmd & 0x1f;
+        if (phy == TULIP_PHY_ADDR && reg != 1 && reg != 2 && reg != 3
+            && reg != 5) {
+            s->mii_regs[reg] = s->mii_out & 0xffff;
+            /* Self-clearing reset and restart-autoneg bits.  */
+            if (reg == 0)
+                s->mii_regs[0] &= ~0x8200;
+        }
+        s->mii_state = MII_IDLE;
+        s->mii_ones = 0;
+        break;
+    }
+}
+
+static uint32_t tulip_csr9_read(TulipState *s)
+{
+    uint32_t val = s->csr[9] & ~(CSR9_SR_DO | CSR9_MDI);
+
+    if ((s->csr[9] & CSR9_SR) && eeprom93xx_read(s->eeprom))
+        val |= CSR9_SR_DO;
+    if (s->mii_state == MII_READ
+        && ((s->mii_out >> (18 - s->mii_bits)) & 1))
+        val |= CSR9_MDI;
+    else if (s->mii_state != MII_READ)
+        val |= CSR9_MDI;
+    return val;
+}
+
+static void tulip_csr9_write(TulipState *s, uint32_t val)
+{
+    uint32_t old = s->csr[9];
+
+    s->csr[9] = val;
+    if (val & CSR9_SR) {
+        eeprom93xx_write(s->eeprom, (val & CSR9_SR_CS) != 0,
+                         (val & CSR9_SR_SK) != 0, (val & CSR9_SR_DI) != 0);
+        return;
+    }
+    if ((val & CSR9_MDC) && !(old & CSR9_MDC))
+        tulip_mii_clock(s, (val & CSR9_MII) ? 1 : (val & CSR9_MDO) != 0);
+}
+
+/* Reset and CSR access.  */
+
+static void tulip_reset(void *opaque)
+{
+    TulipState *s = opaque;
+
+    memset(s->csr, 0, sizeof(s->csr));
+    s->csr[0] = 0xfe000000;
+    s->csr[5] = 0xf0000000;
+    s->csr[6] = 0x32000040;
+    s->csr[7] = 0xf3fe0000;
+    s->csr[8] = 0xe0000000;
+    s->csr[9] = 0xfff483ff;
+    s->csr[11] = 0xfffe0000;
+    s->csr[12] = 0x000050c0 | (s->mii_regs[5] << 16);
+    s->csr[13] = 0xffff0000;
+    s->csr[14] = 0xffffffff;
+    s->csr[15] = 0x8ff00000;
+    s->cur_rx = 0;
+    s->cur_tx = 0;
+    s->rx_state = RS_STOPPED;
+    s->tx_state = TS_STOPPED;
+    s->rx_pending = 0;
+    s->tx_pending = 0;
+    s->mii_state = MII_IDLE;
+    s->mii_ones = 0;
+    qemu_del_timer(s->rx_mit_timer);
+    qemu_del_timer(s->tx_mit_timer);
+    qemu_del_timer(s->gp_timer);
+    tulip_update_irq(s);
+}
+
+static uint32_t tulip_csr_read(TulipState *s, int reg)
+{
+    uint32_t val;
+
+    switch (reg) {
+    case 8:
+        /* Missed frame counters clear on read.  */
+        val = s->csr[8];
+        s->csr[8] &= ~0x1fffffff;
+        break;
+    case 9:
+        val = tulip_csr9_read(s);
+        break;
+    case 12:
+        /* SIA status: 100Mb/s link pass, autonegotiation complete.  */
+        val = (s->mii_regs[5] << 16) | (1 << 15) | (5 << 12) | 0xc0;
+        break;
+    default:
+        val = s->csr[reg];
+        break;
+    }
+    DPRINTF("read  csr%d = %08x\n", reg, val);
+    return val;
+}
+
+static void tulip_csr_write(TulipState *s, int reg, uint32_t val)
+{
+    DPRINTF("write csr%d = %08x\n", reg, val);
+
+    switch (reg) {
+    case 0:
+        if (val & CSR0_SWR) {
+            tulip_reset(s);
+            break;
+        }
+        s->csr[0] = val;
+        break;
+    case 1:
+        /* Transmit poll demand.  */
+        if (s->csr[6] & CSR6_ST) {
+            s->tx_state = TS_SUSPENDED;
+            tulip_xmit(s);
+        }
+        break;
+    case 2:
+        /* Receive poll demand.  */
+        if (tulip_rx_ready(s))
+            tulip_update_irq(s);
+        break;
+    case 3:
+        s->csr[3] = val & ~3;
+        s->cur_rx = s->csr[3];
+        break;
+    case 4:
+        s->csr[4] = val & ~3;
+        s->cur_tx = s->csr[4];
+        break;
+    case 5:
+        s->csr[5] &= ~(val & CSR5_W1C);
+        tulip_update_irq(s);
+        break;
+    case 6:
+        s->csr[6] = val;
+        if (val & CSR6_SR) {
+            if (!tulip_rx_ready(s))
+                s->rx_state = RS_SUSPENDED;
+        } else {
+            s->rx_state = RS_STOPPED;
+            s->csr[5] |= CSR5_RPS;
+        }
+        if (val & CSR6_ST) {
+            if (s->tx_state == TS_STOPPED)
+                tulip_xmit(s);
+        } else if (s->tx_state != TS_STOPPED) {
+            s->tx_state = TS_STOPPED;
+            s->csr[5] |= CSR5_TPS;
+        }
+        tulip_update_irq(s);
+        break;
+    case 7:
+        s->csr[7] = val;
+        tulip_update_irq(s);
+        break;
+    case 9:
+        tulip_csr9_write(s, val);
+        break;
+    case 11:
+        s->csr[11] = val;
+        if (!CSR11_NRP(val) && !CSR11_RT(val) && s->rx_pending) {
+            qemu_del_timer(s->rx_mit_timer);
+            tulip_rx_mit_timer(s);
+        }
+        if (!CSR11_NTP(val) && !CSR11_TT(val) && s->tx_pending) {
+            qemu_del_timer(s->tx_mit_timer);
+            tulip_tx_mit_timer(s);
+        }
+        tulip_gp_timer_start(s);
+        break;
+    case 8:
+    case 12:
+        break;
+    default:
+        s->csr[reg] = val;
+        break;
+    }
+}
+
+static void tulip_ioport_writel(void *opaque, uint32_t addr, uint32_t val)
+{
+    TulipState *s = opaque;
+
+    tulip_csr_write(s, (addr >> 3) & 0xf, val);
+}
+
+static uint32_t tulip_ioport_readl(void *opaque, uint32_t addr)
+{
+    TulipState *s = opaque;
+
+    return tulip_csr_read(s, (addr >> 3) & 0xf);
+}
+
+static void tulip_ioport_map(PCIDevice *pci_dev, int region_num,
+                             uint32_t addr, uint32_t size, int type)
+{
+    TulipState *s = (TulipState *)pci_dev;
+
+    register_ioport_write(addr, TULIP_CSR_SIZE, 4, tulip_ioport_writel, s);
+    register_ioport_read(addr, TULIP_CSR_SIZE, 4, tulip_ioport_readl, s);
+}
+
+static void tulip_mmio_writel(void *opaque, target_phys_addr_t addr,
+                              uint32_t val)
+{
+    TulipState *s = opaque;
+
+#ifdef TARGET_WORDS_BIGENDIAN
+    val = bswap32(val);
+#endif
+    tulip_csr_write(s, (addr >> 3) & 0xf, val);
+}
+
+static uint32_t tulip_mmio_readl(void *opaque, target_phys_addr_t addr)
+{
+    TulipState *s = opaque;
+    uint32_t val;
+
+    val = tulip_csr_read(s, (addr >> 3) & 0xf);
+#ifdef TARGET_WORDS_BIGENDIAN
+    val = bswap32(val);
+#endif
+    return val;
+}
+
+static void tulip_mmio_writex(void *opaque, target_phys_addr_t addr,
+                              uint32_t val)
+{
+    DPRINTF("unsupported sub-longword write at %x\n", (int)addr);
+}
+
+static uint32_t tulip_mmio_readx(void *opaque, target_phys_addr_t addr)
+{
+    DPRINTF("unsupported sub-longword read at %x\n", (int)addr);
+    return 0;
+}
+
+static CPUWriteMemoryFunc *tulip_mmio_write[] = {
+    tulip_mmio_writex,
+    tulip_mmio_writex,
+    tulip_mmio_writel,
+};
+
+static CPUReadMemoryFunc *tulip_mmio_read[] = {
+    tulip_mmio_readx,
+    tulip_mmio_readx,
+    tulip_mmio_readl,
+};
+
+static void tulip_mmio_map(PCIDevice *pci_dev, int region_num,
+                           uint32_t addr, uint32_t size, int type)
+{
+    TulipState *s = (TulipState *)pci_dev;
+
+    cpu_register_physical_memory(addr, TULIP_CSR_SIZE, s->mmio_index);
+}
+
+static void tulip_save(QEMUFile *f, void *opaque)
+{
+    TulipState *s = opaque;
+    int i;
+
+    pci_device_save(&s->dev, f);
+
+    for (i = 0; i < 16; i++)
+        qemu_put_be32s(f, &s->csr[i]);
+    qemu_put_be32s(f, &s->cur_rx);
+    qemu_put_be32s(f, &s->cur_tx);
+    qemu_put_sbe32(f, s->rx_state);
+    qemu_put_sbe32(f, s->tx_state);
+    qemu_put_buffer(f, &s->perfect[0][0], sizeof(s->perfect));
+    qemu_put_buffer(f, s->hash, sizeof(s->hash));
+    qemu_put_sbe32(f, s->rx_pending);
+    qemu_put_sbe32(f, s->tx_pending);
+    qemu_put_timer(f, s->rx_mit_timer);
+    qemu_put_timer(f, s->tx_mit_timer);
+    qemu_put_timer(f, s->gp_timer);
+    for (i = 0; i < 32; i++)
+        qemu_put_be16s(f, &s->mii_regs[i]);
+}
+
+static int tulip_load(QEMUFile *f, void *opaque, int version_id)
+{
+    TulipState *s = opaque;
+    int i, ret;
+
+    if (version_id != 1)
+        return -EINVAL;
+
+    ret = pci_device_load(&s->dev, f);
+    if (ret < 0)
+        return ret;
+
+    for (i = 0; i < 16; i++)
+        qemu_get_be32s(f, &s->csr[i]);
+    qemu_get_be32s(f, &s->cur_rx);
+    qemu_get_be32s(f, &s->cur_tx);
+    s->rx_state = qemu_get_sbe32(f);
+    s->tx_state = qemu_get_sbe32(f);
+    qemu_get_buffer(f, &s->perfect[0][0], sizeof(s->perfect));
+    qemu_get_buffer(f, s->hash, sizeof(s->hash));
+    s->rx_pending = qemu_get_sbe32(f);
+    s->tx_pending = qemu_get_sbe32(f);
+    qemu_get_timer(f, s->rx_mit_timer);
+    qemu_get_timer(f, s->tx_mit_timer);
+    qemu_get_timer(f, s->gp_timer);
+    for (i = 0; i < 32; i++)
+        qemu_get_be16s(f, &s->mii_regs[i]);
+    s->mii_state = MII_IDLE;
+    s->mii_ones = 0;
+
+    return 0;
+}
+
+static int pci_tulip_uninit(PCIDevice *dev)
+{
+    TulipState *s = (TulipState *)dev;
+
+    cpu_unregister_io_memory(s->mmio_index);
+    qemu_del_timer(s->rx_mit_timer);
+    qemu_free_timer(s->rx_mit_timer);
+    qemu_del_timer(s->tx_mit_timer);
+    qemu_free_timer(s->tx_mit_timer);
+    qemu_del_timer(s->gp_timer);
+    qemu_free_timer(s->gp_timer);
+    eeprom93xx_free(s->eeprom);
+    qemu_del_vlan_client(s->vc);
+    return 0;
+}
+
+PCIDevice *pci_tulip_init(PCIBus *bus, NICInfo *nd, int devfn)
+{
+    TulipState *s;
+    uint8_t *pci_conf;
+
+    s = (TulipState *)pci_register_device(bus, "Tulip", sizeof(TulipState),
+                                          devfn, NULL, NULL);
+    if (!s)
+        return NULL;
+
+    pci_conf = s->dev.config;
+    pci_config_set_vendor_id(pci_conf, PCI_VENDOR_ID_DEC);
+    pci_config_set_device_id(pci_conf, PCI_DEVICE_ID_DEC_21143);
+    pci_conf[0x08] = 0x41;              /* Revision: 21143-PD */
+    pci_config_set_class(pci_conf, PCI_CLASS_NETWORK_ETHERNET);
+    pci_conf[0x0d] = 0x20;              /* Latency timer */
+    pci_conf[0x2c] = PCI_VENDOR_ID_DEC & 0xff;
+    pci_conf[0x2d] = PCI_VENDOR_ID_DEC >> 8;
+    pci_conf[0x2e] = 0x0b;              /* Subsystem: DE500-BA */
+    pci_conf[0x2f] = 0x50;
+    pci_conf[0x3d] = 1;                 /* Interrupt pin A */
+    pci_conf[0x3e] = 0x14;              /* Min_Gnt */
+    pci_conf[0x3f] = 0x28;              /* Max_Lat */
+
+    s->mmio_index = cpu_register_io_memory(0, tulip_mmio_read,
+                                           tulip_mmio_write, s);
+    pci_register_io_region(&s->dev, 0, TULIP_CSR_SIZE,
+                           PCI_ADDRESS_SPACE_IO, tulip_ioport_map);
+    pci_register_io_region(&s->dev, 1, TULIP_CSR_SIZE,
+                           PCI_ADDRESS_SPACE_MEM, tulip_mmio_map);
+
+    s->nd = nd;
+    s->eeprom = eeprom93xx_new(TULIP_SROM_WORDS);
+    tulip_srom_init(s);
+    memcpy(s->mii_regs, tulip_mii_init, sizeof(s->mii_regs));
+    memcpy(s->perfect[0], nd->macaddr, 6);
+
+    s->rx_mit_timer = qemu_new_timer(vm_clock, tulip_rx_mit_timer, s);
+    s->tx_mit_timer = qemu_new_timer(vm_clock, tulip_tx_mit_timer, s);
+    s->gp_timer = qemu_new_timer(vm_clock, tulip_gp_timer, s);
+
+    s->vc = qemu_new_vlan_client(nd->vlan, nd->model, nd->name,
+                                 tulip_receive, tulip_can_receive, s);
+    qemu_format_nic_info_str(s->vc, nd->macaddr);
+
+    tulip_reset(s);
+    qemu_register_reset(tulip_reset, s);
+    register_savevm("tulip", -1, 1, tulip_save, tulip_load, s);
+    s->dev.unregister = pci_tulip_uninit;
+
+    return &s->dev;
+}
@@ -377,6 +377,35 @@ static void do_info_jit(Monitor *mon)
     dump_exec_info((FILE *)mon, monitor_fprintf);
 }
 
+static void do_tbprof(Monitor *mon, const char *cmd)
+{
+    if (!strcmp(cmd, "on")) {
+        tb_prof_enable(1);
+    } else if (!strcmp(cmd, "off")) {
+        tb_prof_enable(0);
+    } else if (!strcmp(cmd, "reset")) {
+        tb_prof_reset();
+    } else {
+        help_cmd(mon, "tbprof");
+    }
+}
+
+static void do_info_tbprof(Monitor *mon)
+{
+    dump_tb_profile((FILE *)mon, monitor_fprintf, 30);
+}
+
+static void do_sysmap(Monitor *mon, const char *filename)
+{
+    int n;
+
+    n = load_symbol_map(filename);
+    if (n < 0)
+        monitor_printf(mon, "could not read '%s'\n", filename);
+    else
+        monitor_printf(mon, "%d symbols loaded\n", n);
+}
+
 static void do_info_history(Monitor *mon)
 {
     int i;
@@ -1637,6 +1666,10 @@ static const mon_cmd_t mon_cmds[] = {
       "filename", "output logs to 'filename'" },
     { "log", "s", do_log,
       "item1[,...]", "activate logging of the specified items to '/tmp/qemu.log'" },
+    { "tbprof", "s", do_tbprof,
+      "on|off|reset", "start, stop or clear the execution profile of the translated code" },
+    { "sysmap", "F", do_sysmap,
+      "filename", "load guest symbols from a System.map file" },
     { "savevm", "s?", do_savevm,
       "tag|id", "save a VM snapshot. If no tag or id are provided, a new snapshot is created" },
     { "loadvm", "s", do_loadvm,
@@ -1766,6 +1799,8 @@ static const mon_cmd_t info_cmds[] = {
 #endif
     { "jit", "", do_info_jit,
       "", "show dynamic compiler info", },
+    { "tbprof", "", do_info_tbprof,
+      "", "show the guest code where most time is spent (see 'tbprof')", },
     { "kqemu", "", do_info_kqemu,
       "", "show KQEMU information", },
     { "kvm", "", do_info_kvm,
@@ -118,6 +118,7 @@
 #include "qemu-char.h"
 #include "audio/audio.h"
 #include "qemu_socket.h"
+#include "replay.h"
 
 #if defined(CONFIG_SLIRP)
 #include "libslirp.h"
@@ -383,6 +384,22 @@ VLANClientState *qemu_find_vlan_client(VLANState *vlan, void *opaque)
     return NULL;
 }
 
+VLANClientState *qemu_find_vlan_client_by_name(int vlan_id, const char *name)
+{
+    VLANState *vlan;
+    VLANClientState *vc;
+
+    for (vlan = first_vlan; vlan; vlan = vlan->next) {
+        if (vlan->id != vlan_id)
+            continue;
+        for (vc = vlan->first_client; vc; vc = vc->next) {
+            if (vc->name && !strcmp(vc->name, name))
+                return vc;
+        }
+    }
+    return NULL;
+}
+
 int qemu_can_send_packet(VLANClientState *vc1)
 {
     VLANState *vlan = vc1->vlan;
@@ -404,6 +421,10 @@ void qemu_send_packet(VLANClientState *vc1, const uint8_t *buf, int size)
 
     if (vc1->link_down)
         return;
+    /* Packets sent from file descriptor handlers come from the host.  */
+    if (replay_mode != REPLAY_NONE && replay_phase == REPLAY_PHASE_IO
+        && replay_net_send(vc1, buf, size))
+        return;
 
 #ifdef DEBUG_NET
     printf("vlan %d send:\n", vlan->id);
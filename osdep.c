@@ -44,6 +44,10 @@
 #include <malloc.h>
 #endif
 
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
 #include "qemu-common.h"
 #include "sysemu.h"
 #include "qemu_socket.h"
@@ -67,6 +71,16 @@ void qemu_vfree(void *ptr)
     VirtualFree(ptr, 0, MEM_RELEASE);
 }
 
+void *qemu_vmalloc_lazy(size_t size)
+{
+    return qemu_vmalloc(size);
+}
+
+void qemu_vmalloc_discard(void *ptr, size_t size)
+{
+    VirtualAlloc(ptr, size, MEM_RESET, PAGE_READWRITE);
+}
+
 #else
 
 #if defined(USE_KQEMU)
@@ -213,6 +227,40 @@ void qemu_vfree(void *ptr)
     free(ptr);
 }
 
+/* Reserve address space for guest RAM.  Host pages are only committed
+   when the guest first touches them.  The area is never freed.  */
+void *qemu_vmalloc_lazy(size_t size)
+{
+    void *ptr;
+
+#if defined(USE_KQEMU)
+    if (kqemu_allowed)
+        return kqemu_vmalloc(size);
+#endif
+#ifdef MAP_NORESERVE
+    ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ptr != MAP_FAILED)
+        return ptr;
+#endif
+    return qemu_vmalloc(size);
+}
+
+/* Give the host pages backing [ptr, ptr + size) back to the system.  The
+   range reads as zero (or as the backing file) when next touched.  */
+void qemu_vmalloc_discard(void *ptr, size_t size)
+{
+#ifdef MADV_DONTNEED
+    unsigned long page_size = getpagesize();
+    unsigned long start, end;
+
+    start = ((unsigned long)ptr + page_size - 1) & ~(page_size - 1);
+    end = ((unsigned long)ptr + size) & ~(page_size - 1);
+    if (end > start)
+        madvise((void *)start, end - start, MADV_DONTNEED);
+#endif
+}
+
 #endif
 
 int qemu_create_pidfile(const char *filename)
@@ -78,6 +78,8 @@
 void *qemu_memalign(size_t alignment, size_t size);
 void *qemu_vmalloc(size_t size);
 void qemu_vfree(void *ptr);
+void *qemu_vmalloc_lazy(size_t size);
+void qemu_vmalloc_discard(void *ptr, size_t size);
 
 int qemu_create_pidfile(const char *filename);
 
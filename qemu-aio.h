@@ -29,6 +29,11 @@ void qemu_aio_flush(void);
  * primative when simulating synchronous IO based on asynchronous IO. */
 void qemu_aio_wait(void);
 
+/* Like qemu_aio_wait(), but only waits on the AIO file descriptors and
+ * never runs bottom halves.  Returns 0 without waiting if there are no
+ * outstanding AIO requests. */
+int qemu_aio_wait_fds(void);
+
 /* Register a file descriptor and associated callbacks.  Behaves very similarly
  * to qemu_set_fd_handler2.  Unlike qemu_set_fd_handler2, these callbacks will
  * be invoked when using either qemu_aio_wait() or qemu_aio_flush().
@@ -28,6 +28,7 @@
 #include "sysemu.h"
 #include "qemu-timer.h"
 #include "qemu-char.h"
+#include "replay.h"
 #include "block.h"
 #include "hw/usb.h"
 #include "hw/baum.h"
@@ -165,6 +166,10 @@ int qemu_chr_can_read(CharDriverState *s)
 
 void qemu_chr_read(CharDriverState *s, uint8_t *buf, int len)
 {
+    /* The monitor is not part of the recorded machine.  */
+    if (replay_mode != REPLAY_NONE && strcmp(s->label, "monitor") != 0
+        && replay_chr_read(s, buf, len))
+        return;
     s->chr_read(s->handler_opaque, buf, len);
 }
 
@@ -2228,6 +2233,32 @@ void qemu_chr_close(CharDriverState *chr)
     qemu_free(chr);
 }
 
+/* Chardevs are created in command line order, so their index identifies
+   them across runs.  */
+int qemu_chr_index(CharDriverState *s)
+{
+    CharDriverState *chr;
+    int index = 0;
+
+    TAILQ_FOREACH(chr, &chardevs, next) {
+        if (chr == s)
+            return index;
+        index++;
+    }
+    return -1;
+}
+
+CharDriverState *qemu_chr_find(int index)
+{
+    CharDriverState *chr;
+
+    TAILQ_FOREACH(chr, &chardevs, next) {
+        if (index-- == 0)
+            return chr;
+    }
+    return NULL;
+}
+
 void qemu_chr_info(Monitor *mon)
 {
     CharDriverState *chr;
@@ -83,6 +83,8 @@ int qemu_chr_can_read(CharDriverState *s);
 void qemu_chr_read(CharDriverState *s, uint8_t *buf, int len);
 void qemu_chr_accept_input(CharDriverState *s);
 void qemu_chr_info(Monitor *mon);
+int qemu_chr_index(CharDriverState *s);
+CharDriverState *qemu_chr_find(int index);
 
 extern int term_escape_char;
 
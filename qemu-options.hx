@@ -228,6 +228,28 @@ a suffix of ``M'' or ``G'' can be used to signify a value in megabytes or
 gigabytes respectively.
 ETEXI
 
+#ifndef _WIN32
+DEF("mem-path", HAS_ARG, QEMU_OPTION_mempath,
+    "-mem-path FILE  provide backing storage for guest RAM\n")
+#endif
+STEXI
+@item -mem-path @var{path}
+Allocate guest RAM from @var{path}.  If @var{path} is a directory, for
+instance a hugetlbfs mount point, a temporary file is created in it.
+Otherwise @var{path} must be an existing file at least as large as
+guest RAM.  It is opened read-only and mapped privately, so that several
+instances using the same file share the pages they do not modify.
+ETEXI
+
+#ifndef _WIN32
+DEF("mem-prealloc", 0, QEMU_OPTION_mem_prealloc,
+    "-mem-prealloc   preallocate guest memory (use with -mem-path)\n")
+#endif
+STEXI
+@item -mem-prealloc
+Fault in all of guest RAM at startup when used with @option{-mem-path}.
+ETEXI
+
 #ifndef _WIN32
 DEF("k", HAS_ARG, QEMU_OPTION_k,
     "-k language     use keyboard layout (for example 'fr' for French)\n")
@@ -732,7 +754,7 @@ Qemu can emulate several different models of network card.
 Valid values for @var{type} are
 @code{i82551}, @code{i82557b}, @code{i82559er},
 @code{ne2k_pci}, @code{ne2k_isa}, @code{pcnet}, @code{rtl8139},
-@code{e1000}, @code{smc91c111}, @code{lance} and @code{mcf_fec}.
+@code{e1000}, @code{tulip}, @code{smc91c111}, @code{lance} and @code{mcf_fec}.
 Not all devices are supported on all targets.  Use -net nic,model=?
 for a list of available devices for your target.
 
@@ -1382,6 +1404,31 @@ order cores with complex cache hierarchies.  The number of instructions
 executed often has little or no correlation with actual performance.
 ETEXI
 
+DEF("record", HAS_ARG, QEMU_OPTION_record, \
+    "-record file    record the inputs of the run in 'file'\n")
+STEXI
+@item -record @var{file}
+Record in @var{file} everything the guest receives from the host: serial
+and other character device input, network packets, disk request
+completions and the date read at startup, together with the points in
+the instruction stream where they arrive.  Interrupts raised by the
+Alpha Typhoon chipset are recorded too, to check replays against.
+Implies @option{-icount 3} unless a fixed @option{-icount} is given.
+ETEXI
+
+DEF("replay", HAS_ARG, QEMU_OPTION_replay, \
+    "-replay file    replay a run recorded with -record\n")
+STEXI
+@item -replay @var{file}
+Run the machine again on the inputs recorded in @var{file} instead of
+live ones, so that it executes exactly the same instructions as the
+recorded run.  The command line must be the same as when recording,
+except that the disk images must be in the state they were in when the
+recording started (use @option{-snapshot} for both runs).  The monitor
+keeps working and must not share a character device with the guest.
+When the log ends, the machine stops.
+ETEXI
+
 DEF("echr", HAS_ARG, QEMU_OPTION_echr, \
     "-echr chr       set terminal escape character instead of ctrl-a\n")
 STEXI
@@ -1418,6 +1465,64 @@ DEF("tb-size", HAS_ARG, QEMU_OPTION_tb_size, \
 STEXI
 ETEXI
 
+DEF("tb-cache", HAS_ARG, QEMU_OPTION_tb_cache, \
+    "-tb-cache file  keep translated code in 'file' across runs\n")
+STEXI
+@item -tb-cache @var{file}
+Load translated code from @var{file} at startup and save it back at exit.
+Translations are reused only if the guest code they come from is
+unchanged, and the whole cache is discarded when the QEMU executable,
+the machine or the CPU model change.  Supported on Linux hosts.
+ETEXI
+
+DEF("no-tcg-opt", 0, QEMU_OPTION_no_tcg_opt, \
+    "-no-tcg-opt     disable constant and copy propagation in the code generator\n")
+STEXI
+@item -no-tcg-opt
+Translate guest code without running the TCG optimizer, which folds
+constants, propagates copies and drops redundant extensions.  Useful to
+compare the generated code and the speed with and without it.
+ETEXI
+
+DEF("tb-trace", HAS_ARG, QEMU_OPTION_tb_trace, \
+    "-tb-trace n     form superblocks from blocks entered n times (Alpha)\n")
+STEXI
+@item -tb-trace @var{n}
+Once a translated block has been entered @var{n} times, translate it
+again together with the blocks that most often follow it, so that the
+hot path runs without going back to the main loop at each branch.  Only
+the Alpha target forms superblocks; 0 (the default) disables them.
+ETEXI
+
+DEF("perfmap", 0, QEMU_OPTION_perfmap, \
+    "-perfmap        describe the translated code in /tmp/perf-<pid>.map\n")
+STEXI
+@item -perfmap
+Write @file{/tmp/perf-<pid>.map}, which tells the @command{perf} host
+profiler which guest code each translated block comes from, so that
+host samples are attributed to guest addresses and symbols (see
+@option{-sysmap}).  The file only describes the code currently in the
+translation buffer.  Supported on Linux hosts.
+ETEXI
+
+DEF("jitdump", 0, QEMU_OPTION_jitdump, \
+    "-jitdump        record the translated code in /tmp/jit-<pid>.dump\n")
+STEXI
+@item -jitdump
+Record each translated block, with its code, in the jitdump file
+@file{/tmp/jit-<pid>.dump}.  Run @command{perf record -k 1} and then
+@command{perf inject --jit} to profile translated code that changes
+during the run.  Supported on Linux hosts.
+ETEXI
+
+DEF("sysmap", HAS_ARG, QEMU_OPTION_sysmap, \
+    "-sysmap file    name guest code after the symbols of a System.map file\n")
+STEXI
+@item -sysmap @var{file}
+Load the text symbols of the Linux @file{System.map} @var{file}, used to
+name guest addresses in logs, @option{-perfmap} and @code{info tbprof}.
+ETEXI
+
 DEF("incoming", HAS_ARG, QEMU_OPTION_incoming, \
     "-incoming p     prepare for incoming migration, listen on port p\n")
 STEXI
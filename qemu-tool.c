@@ -15,6 +15,7 @@
 #include "monitor.h"
 #include "sysemu.h"
 #include "qemu-timer.h"
+#include "replay.h"
 
 #include <sys/time.h>
 
@@ -70,6 +71,20 @@ void qemu_bh_delete(QEMUBH *bh)
     qemu_free(bh);
 }
 
+int replay_mode = REPLAY_NONE;
+
+void replay_block_submit(ReplayBlockReq *req)
+{
+}
+
+void replay_block_done(ReplayBlockReq *req)
+{
+}
+
+void replay_block_cancel(ReplayBlockReq *req)
+{
+}
+
 int qemu_set_fd_handler2(int fd,
                          IOCanRWHandler *fd_read_poll,
                          IOHandler *fd_read,
@@ -0,0 +1,575 @@
+/*
+ * QEMU deterministic record/replay
+ *
+ * Copyright (c) 2009 The QEMU Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <time.h>
+
+#include "qemu-common.h"
+#include "qemu-char.h"
+#include "net.h"
+#include "block.h"
+#include "sysemu.h"
+#include "replay.h"
+
+/* The log is a header followed by a list of events:
+
+     header:  be32 magic, be32 version, be32 icount shift
+     event:   u8 kind, u8 phase, be64 icount, be64 id, be32 value,
+              be16 name length, name, be32 data length, data
+
+   Asynchronous events are inputs that the main loop delivers between two
+   runs of the CPU: the replaying CPU is stopped at their icount and they
+   are delivered at the same phase of the main loop.  Synchronous events
+   are values that the guest asks for; they are returned in log order and
+   their icount is only used to detect divergence.  */
+
+#define REPLAY_MAGIC    0x51525031      /* "QRP1" */
+#define REPLAY_VERSION  1
+
+enum {
+    /* Asynchronous.  */
+    EVENT_CHAR,         /* id: chardev index.  */
+    EVENT_NET,          /* id: VLAN, name: sending client.  */
+    EVENT_BLOCK,        /* id: request, value: return code.  */
+    EVENT_BH,           /* Bottom halves ran.  */
+    EVENT_END,
+    /* Synchronous.  */
+    EVENT_TIMEDATE,     /* data: struct tm fields.  */
+    EVENT_IRQ,          /* id: line, value: level.  */
+};
+
+#define EVENT_IS_ASYNC(kind) ((kind) <= EVENT_END)
+
+typedef struct ReplayEvent ReplayEvent;
+struct ReplayEvent {
+    int kind;
+    int phase;
+    int64_t icount;
+    uint64_t id;
+    int32_t value;
+    char *name;
+    uint8_t *data;
+    int len;
+    TAILQ_ENTRY(ReplayEvent) node;
+};
+
+int replay_mode = REPLAY_NONE;
+int replay_phase = REPLAY_PHASE_CPU;
+
+static FILE *replay_file;
+static const char *replay_filename;
+static int replay_diverged;
+/* Set while a logged packet is sent, so that it is not dropped as a live
+   one.  */
+static int replay_delivering;
+
+/* Replay: events read ahead of the current icount.  The queue always
+   holds the next asynchronous event, if there is one.  */
+static TAILQ_HEAD(, ReplayEvent) replay_events =
+    TAILQ_HEAD_INITIALIZER(replay_events);
+static int replay_async_queued;
+static int replay_eof;
+
+/* Block requests whose completion has not been delivered yet.  When
+   recording, completed requests move to replay_block_done_list, in the
+   order they completed, until the next BH checkpoint.  */
+static TAILQ_HEAD(ReplayBlockHead, ReplayBlockReq) replay_block_pending =
+    TAILQ_HEAD_INITIALIZER(replay_block_pending);
+static struct ReplayBlockHead replay_block_done_list =
+    TAILQ_HEAD_INITIALIZER(replay_block_done_list);
+static uint64_t replay_block_id;
+
+/***********************************************************/
+/* log file access */
+
+static void put_be16(FILE *f, unsigned int v)
+{
+    fputc(v >> 8, f);
+    fputc(v, f);
+}
+
+static void put_be32(FILE *f, unsigned int v)
+{
+    put_be16(f, v >> 16);
+    put_be16(f, v);
+}
+
+static void put_be64(FILE *f, uint64_t v)
+{
+    put_be32(f, v >> 32);
+    put_be32(f, v);
+}
+
+static int get_byte(FILE *f)
+{
+    int c = fgetc(f);
+    if (c == EOF)
+        replay_eof = 1;
+    return c & 0xff;
+}
+
+static unsigned int get_be16(FILE *f)
+{
+    unsigned int v = get_byte(f) << 8;
+    return v | get_byte(f);
+}
+
+static unsigned int get_be32(FILE *f)
+{
+    unsigned int v = get_be16(f) << 16;
+    return v | get_be16(f);
+}
+
+static uint64_t get_be64(FILE *f)
+{
+    uint64_t v = (uint64_t)get_be32(f) << 32;
+    return v | get_be32(f);
+}
+
+static void replay_put_event(int kind, uint64_t id, int32_t value,
+                             const char *name, const uint8_t *data, int len)
+{
+    int name_len = name ? strlen(name) : 0;
+
+    fputc(kind, replay_file);
+    fputc(replay_phase, replay_file);
+    put_be64(replay_file, replay_get_icount());
+    put_be64(replay_file, id);
+    put_be32(replay_file, value);
+    put_be16(replay_file, name_len);
+    fwrite(name, 1, name_len, replay_file);
+    put_be32(replay_file, len);
+    fwrite(data, 1, len, replay_file);
+}
+
+static ReplayEvent *replay_get_event(void)
+{
+    ReplayEvent *ev;
+    int name_len;
+
+    ev = qemu_mallocz(sizeof(*ev));
+    ev->kind = get_byte(replay_file);
+    ev->phase = get_byte(replay_file);
+    ev->icount = get_be64(replay_file);
+    ev->id = get_be64(replay_file);
+    ev->value = get_be32(replay_file);
+    name_len = get_be16(replay_file);
+    ev->name = qemu_mallocz(name_len + 1);
+    if (fread(ev->name, 1, name_len, replay_file) != name_len)
+        replay_eof = 1;
+    ev->len = get_be32(replay_file);
+    if (!replay_eof && ev->len > 0) {
+        ev->data = qemu_malloc(ev->len);
+        if (fread(ev->data, 1, ev->len, replay_file) != ev->len)
+            replay_eof = 1;
+    }
+    if (replay_eof) {
+        qemu_free(ev->data);
+        qemu_free(ev->name);
+        qemu_free(ev);
+        return NULL;
+    }
+    return ev;
+}
+
+static void replay_free_event(ReplayEvent *ev)
+{
+    TAILQ_REMOVE(&replay_events, ev, node);
+    if (EVENT_IS_ASYNC(ev->kind))
+        replay_async_queued--;
+    qemu_free(ev->data);
+    qemu_free(ev->name);
+    qemu_free(ev);
+}
+
+/* Read ahead up to and including the next asynchronous event.  */
+static void replay_fill(void)
+{
+    ReplayEvent *ev;
+
+    while (!replay_async_queued && !replay_eof) {
+        ev = replay_get_event();
+        if (!ev) {
+            fprintf(stderr, "replay: %s: unexpected end of log\n",
+                    replay_filename);
+            break;
+        }
+        TAILQ_INSERT_TAIL(&replay_events, ev, node);
+        if (EVENT_IS_ASYNC(ev->kind))
+            replay_async_queued++;
+    }
+}
+
+static void replay_diverge(const char *what)
+{
+    if (!replay_diverged) {
+        fprintf(stderr, "replay: execution diverged from the log (%s) "
+                "at icount %" PRId64 "\n", what, replay_get_icount());
+        replay_diverged = 1;
+    }
+}
+
+/***********************************************************/
+/* control */
+
+int replay_open(const char *filename, int mode, int icount_shift)
+{
+    unsigned int magic, version, shift;
+
+    replay_filename = filename;
+    if (mode == REPLAY_RECORD) {
+        replay_file = fopen(filename, "wb");
+        if (!replay_file) {
+            fprintf(stderr, "replay: could not create '%s'\n", filename);
+            return -1;
+        }
+        put_be32(replay_file, REPLAY_MAGIC);
+        put_be32(replay_file, REPLAY_VERSION);
+        put_be32(replay_file, icount_shift);
+    } else {
+        replay_file = fopen(filename, "rb");
+        if (!replay_file) {
+            fprintf(stderr, "replay: could not open '%s'\n", filename);
+            return -1;
+        }
+        magic = get_be32(replay_file);
+        version = get_be32(replay_file);
+        shift = get_be32(replay_file);
+        if (replay_eof || magic != REPLAY_MAGIC) {
+            fprintf(stderr, "replay: '%s' is not a replay log\n", filename);
+            return -1;
+        }
+        if (version != REPLAY_VERSION) {
+            fprintf(stderr, "replay: '%s': unsupported version %u\n",
+                    filename, version);
+            return -1;
+        }
+        if (shift != icount_shift) {
+            fprintf(stderr, "replay: '%s' was recorded with -icount %u\n",
+                    filename, shift);
+            return -1;
+        }
+        replay_fill();
+    }
+    replay_mode = mode;
+    return 0;
+}
+
+void replay_close(void)
+{
+    if (replay_mode == REPLAY_RECORD) {
+        replay_put_event(EVENT_END, 0, 0, NULL, NULL, 0);
+        fclose(replay_file);
+        replay_file = NULL;
+    }
+}
+
+/* Complete the requests that were held back for the log.  */
+static void replay_block_flush(void)
+{
+    ReplayBlockReq *req, *next;
+
+    for (req = TAILQ_FIRST(&replay_block_pending); req; req = next) {
+        next = TAILQ_NEXT(req, node);
+        if (req->done) {
+            TAILQ_REMOVE(&replay_block_pending, req, node);
+            req->complete(req);
+        }
+    }
+}
+
+/* The log is exhausted: let the machine run on live inputs.  */
+static void replay_end(void)
+{
+    fprintf(stderr, "replay: end of log at icount %" PRId64 "\n",
+            replay_get_icount());
+    replay_mode = REPLAY_NONE;
+    fclose(replay_file);
+    replay_file = NULL;
+    replay_block_flush();
+    vm_stop(0);
+}
+
+int64_t replay_next_event(void)
+{
+    ReplayEvent *ev;
+
+    TAILQ_FOREACH(ev, &replay_events, node) {
+        if (EVENT_IS_ASYNC(ev->kind))
+            return ev->icount;
+    }
+    return INT64_MAX;
+}
+
+static void replay_deliver(ReplayEvent *ev)
+{
+    CharDriverState *chr;
+    VLANClientState *vc;
+    ReplayBlockReq *req;
+
+    switch (ev->kind) {
+    case EVENT_CHAR:
+        chr = qemu_chr_find(ev->id);
+        if (!chr) {
+            replay_diverge("no such chardev");
+            break;
+        }
+        if (chr->chr_read)
+            chr->chr_read(chr->handler_opaque, ev->data, ev->len);
+        break;
+    case EVENT_NET:
+        vc = qemu_find_vlan_client_by_name(ev->id, ev->name);
+        if (!vc) {
+            replay_diverge("no such network client");
+            break;
+        }
+        replay_delivering = 1;
+        qemu_send_packet(vc, ev->data, ev->len);
+        replay_delivering = 0;
+        break;
+    case EVENT_BLOCK:
+        TAILQ_FOREACH(req, &replay_block_pending, node) {
+            if (req->id == ev->id)
+                break;
+        }
+        if (!req) {
+            replay_diverge("no such block request");
+            break;
+        }
+        /* Bottom halves only run from the log, so a completion that
+           comes from one has already been delivered by its EVENT_BH.  */
+        while (!req->done) {
+            if (!qemu_aio_wait_fds())
+                break;
+        }
+        if (!req->done) {
+            replay_diverge("block request cannot complete");
+            break;
+        }
+        TAILQ_REMOVE(&replay_block_pending, req, node);
+        req->complete(req);
+        break;
+    case EVENT_BH:
+        qemu_bh_poll();
+        break;
+    }
+}
+
+void replay_checkpoint(int phase)
+{
+    ReplayEvent *ev;
+    ReplayBlockReq *req;
+    int64_t now;
+
+    replay_phase = phase;
+    if (replay_mode == REPLAY_RECORD) {
+        if (phase != REPLAY_PHASE_BH)
+            return;
+        while ((req = TAILQ_FIRST(&replay_block_done_list))) {
+            TAILQ_REMOVE(&replay_block_done_list, req, node);
+            replay_put_event(EVENT_BLOCK, req->id, req->ret, NULL, NULL, 0);
+            req->complete(req);
+        }
+        return;
+    }
+    if (replay_mode != REPLAY_PLAY)
+        return;
+
+    now = replay_get_icount();
+    while ((ev = TAILQ_FIRST(&replay_events))) {
+        if (!EVENT_IS_ASYNC(ev->kind)) {
+            if (ev->icount >= now)
+                break;
+            /* The guest did not ask for this value when it was due.  */
+            replay_diverge("missed synchronous event");
+            replay_free_event(ev);
+            replay_fill();
+            continue;
+        }
+        if (ev->icount < now) {
+            replay_diverge("missed asynchronous event");
+        } else if (ev->icount > now
+                   || (ev->phase != phase && ev->kind != EVENT_END)) {
+            break;
+        }
+        if (ev->kind == EVENT_END) {
+            replay_free_event(ev);
+            replay_end();
+            return;
+        }
+        TAILQ_REMOVE(&replay_events, ev, node);
+        replay_async_queued--;
+        replay_fill();
+        replay_deliver(ev);
+        qemu_free(ev->data);
+        qemu_free(ev->name);
+        qemu_free(ev);
+    }
+}
+
+/* Bottom halves may be scheduled from the CPU, and they run when the
+   main loop next gets control, which depends on host events.  Record
+   when they ran; the replay runs them from the log.  */
+void replay_bh_poll(void)
+{
+    switch (replay_mode) {
+    case REPLAY_NONE:
+        qemu_bh_poll();
+        break;
+    case REPLAY_RECORD:
+        if (qemu_bh_poll())
+            replay_put_event(EVENT_BH, 0, 0, NULL, NULL, 0);
+        break;
+    }
+}
+
+/***********************************************************/
+/* asynchronous inputs */
+
+/* These return nonzero if the live input must be dropped because the
+   replay takes it from the log.  */
+
+int replay_chr_read(CharDriverState *s, const uint8_t *buf, int len)
+{
+    if (replay_mode == REPLAY_RECORD) {
+        replay_put_event(EVENT_CHAR, qemu_chr_index(s), 0, NULL, buf, len);
+        return 0;
+    }
+    return 1;
+}
+
+int replay_net_send(VLANClientState *vc, const uint8_t *buf, int size)
+{
+    if (replay_delivering)
+        return 0;
+    if (replay_mode == REPLAY_RECORD) {
+        replay_put_event(EVENT_NET, vc->vlan->id, 0, vc->name, buf, size);
+        return 0;
+    }
+    return 1;
+}
+
+void replay_block_submit(ReplayBlockReq *req)
+{
+    req->id = replay_block_id++;
+    req->done = 0;
+    TAILQ_INSERT_TAIL(&replay_block_pending, req, node);
+}
+
+void replay_block_done(ReplayBlockReq *req)
+{
+    if (replay_mode == REPLAY_NONE) {
+        TAILQ_REMOVE(&replay_block_pending, req, node);
+        req->complete(req);
+        return;
+    }
+    req->done = 1;
+    if (replay_mode == REPLAY_RECORD) {
+        TAILQ_REMOVE(&replay_block_pending, req, node);
+        TAILQ_INSERT_TAIL(&replay_block_done_list, req, node);
+    }
+}
+
+void replay_block_cancel(ReplayBlockReq *req)
+{
+    if (req->done && replay_mode == REPLAY_RECORD)
+        TAILQ_REMOVE(&replay_block_done_list, req, node);
+    else
+        TAILQ_REMOVE(&replay_block_pending, req, node);
+}
+
+/***********************************************************/
+/* synchronous inputs */
+
+/* Return the next event if it is a synchronous one of KIND.  */
+static ReplayEvent *replay_sync_event(int kind, const char *what)
+{
+    ReplayEvent *ev = TAILQ_FIRST(&replay_events);
+
+    if (!ev || ev->kind != kind) {
+        replay_diverge(what);
+        return NULL;
+    }
+    if (ev->icount != replay_get_icount())
+        replay_diverge(what);
+    return ev;
+}
+
+void replay_timedate(struct tm *tm)
+{
+    uint8_t buf[9 * 4];
+    int fields[9], i;
+    ReplayEvent *ev;
+
+    if (replay_mode == REPLAY_RECORD) {
+        fields[0] = tm->tm_sec;
+        fields[1] = tm->tm_min;
+        fields[2] = tm->tm_hour;
+        fields[3] = tm->tm_mday;
+        fields[4] = tm->tm_mon;
+        fields[5] = tm->tm_year;
+        fields[6] = tm->tm_wday;
+        fields[7] = tm->tm_yday;
+        fields[8] = tm->tm_isdst;
+        for (i = 0; i < 9; i++)
+            cpu_to_be32wu((uint32_t *)(buf + i * 4), fields[i]);
+        replay_put_event(EVENT_TIMEDATE, 0, 0, NULL, buf, sizeof(buf));
+    } else if (replay_mode == REPLAY_PLAY) {
+        ev = replay_sync_event(EVENT_TIMEDATE, "date read");
+        if (!ev)
+            return;
+        if (ev->len == sizeof(buf)) {
+            for (i = 0; i < 9; i++)
+                fields[i] = be32_to_cpupu((const uint32_t *)(ev->data + i * 4));
+            tm->tm_sec = fields[0];
+            tm->tm_min = fields[1];
+            tm->tm_hour = fields[2];
+            tm->tm_mday = fields[3];
+            tm->tm_mon = fields[4];
+            tm->tm_year = fields[5];
+            tm->tm_wday = fields[6];
+            tm->tm_yday = fields[7];
+            tm->tm_isdst = fields[8];
+        }
+        replay_free_event(ev);
+        replay_fill();
+    }
+}
+
+/* Interrupts are a function of the guest state, so they are not inputs:
+   they are logged to check that the replay follows the recording.  */
+void replay_irq(int line, int level)
+{
+    ReplayEvent *ev;
+
+    if (replay_mode == REPLAY_RECORD) {
+        replay_put_event(EVENT_IRQ, line, level, NULL, NULL, 0);
+    } else if (replay_mode == REPLAY_PLAY) {
+        ev = replay_sync_event(EVENT_IRQ, "interrupt");
+        if (!ev)
+            return;
+        if (ev->id != line || ev->value != level)
+            replay_diverge("interrupt");
+        replay_free_event(ev);
+        replay_fill();
+    }
+}
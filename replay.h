@@ -0,0 +1,62 @@
+#ifndef QEMU_REPLAY_H
+#define QEMU_REPLAY_H
+
+#include "sys-queue.h"
+
+/* Deterministic record/replay.  With a fixed -icount shift everything
+   the guest observes is a function of the instruction count, except for
+   the inputs that come from the host: they are logged, keyed by icount,
+   and fed back at the same points when replaying.  */
+
+enum {
+    REPLAY_NONE,
+    REPLAY_RECORD,
+    REPLAY_PLAY,
+};
+
+/* Where the main loop stands.  Asynchronous inputs are delivered between
+   two runs of the CPU, so they are keyed by icount and by phase.  */
+enum {
+    REPLAY_PHASE_CPU,       /* Running guest code.  */
+    REPLAY_PHASE_IO,        /* File descriptor handlers.  */
+    REPLAY_PHASE_TIMERS,    /* Virtual clock timers.  */
+    REPLAY_PHASE_BH,        /* Real time timers and bottom halves.  */
+};
+
+extern int replay_mode;
+extern int replay_phase;
+
+/* An asynchronous block request, embedded in the block layer's AIOCB.
+   The block layer sets RET and calls replay_block_done when the request
+   completes; COMPLETE is called when the completion is delivered.  */
+typedef struct ReplayBlockReq ReplayBlockReq;
+struct ReplayBlockReq {
+    uint64_t id;
+    int done;
+    int ret;
+    void (*complete)(ReplayBlockReq *req);
+    TAILQ_ENTRY(ReplayBlockReq) node;
+};
+
+struct VLANClientState;
+struct tm;
+
+int replay_open(const char *filename, int mode, int icount_shift);
+void replay_close(void);
+int64_t replay_next_event(void);
+void replay_checkpoint(int phase);
+void replay_bh_poll(void);
+
+int replay_chr_read(CharDriverState *s, const uint8_t *buf, int len);
+int replay_net_send(struct VLANClientState *vc, const uint8_t *buf, int size);
+void replay_timedate(struct tm *tm);
+void replay_irq(int line, int level);
+
+void replay_block_submit(ReplayBlockReq *req);
+void replay_block_done(ReplayBlockReq *req);
+void replay_block_cancel(ReplayBlockReq *req);
+
+/* vl.c */
+int64_t replay_get_icount(void);
+
+#endif
@@ -35,6 +35,10 @@
 
 #define TARGET_HAS_ICE 1
 
+#define TARGET_HAS_SUPERBLOCKS 1
+
+#define TARGET_HAS_PC_MAP 1
+
 #define ELF_MACHINE     EM_ALPHA
 
 #define ICACHE_LINE_SIZE 32
@@ -3,106 +3,106 @@
 DEF_HELPER_0(tb_flush, void)
 
 DEF_HELPER_2(excp, void, int, int)
-DEF_HELPER_0(load_pcc, i64)
-DEF_HELPER_0(rc, i64)
-DEF_HELPER_0(rs, i64)
-
-DEF_HELPER_2(addqv, i64, i64, i64)
-DEF_HELPER_2(addlv, i64, i64, i64)
-DEF_HELPER_2(subqv, i64, i64, i64)
-DEF_HELPER_2(sublv, i64, i64, i64)
-DEF_HELPER_2(mullv, i64, i64, i64)
-DEF_HELPER_2(mulqv, i64, i64, i64)
-DEF_HELPER_2(umulh, i64, i64, i64)
-
-DEF_HELPER_1(ctpop, i64, i64)
-DEF_HELPER_1(ctlz, i64, i64)
-DEF_HELPER_1(cttz, i64, i64)
-
-DEF_HELPER_2(mskbl, i64, i64, i64)
-DEF_HELPER_2(insbl, i64, i64, i64)
-DEF_HELPER_2(mskwl, i64, i64, i64)
-DEF_HELPER_2(inswl, i64, i64, i64)
-DEF_HELPER_2(mskll, i64, i64, i64)
-DEF_HELPER_2(insll, i64, i64, i64)
-DEF_HELPER_2(zap, i64, i64, i64)
-DEF_HELPER_2(zapnot, i64, i64, i64)
-DEF_HELPER_2(mskql, i64, i64, i64)
-DEF_HELPER_2(insql, i64, i64, i64)
-DEF_HELPER_2(mskwh, i64, i64, i64)
-DEF_HELPER_2(inswh, i64, i64, i64)
-DEF_HELPER_2(msklh, i64, i64, i64)
-DEF_HELPER_2(inslh, i64, i64, i64)
-DEF_HELPER_2(mskqh, i64, i64, i64)
-DEF_HELPER_2(insqh, i64, i64, i64)
-
-DEF_HELPER_2(cmpbge, i64, i64, i64)
-
-DEF_HELPER_0(load_fpcr, i64)
-DEF_HELPER_1(store_fpcr, void, i64)
-
-DEF_HELPER_1(f_to_memory, i32, i64)
-DEF_HELPER_1(memory_to_f, i64, i32)
-DEF_HELPER_2(addf, i64, i64, i64)
-DEF_HELPER_2(subf, i64, i64, i64)
-DEF_HELPER_2(mulf, i64, i64, i64)
-DEF_HELPER_2(divf, i64, i64, i64)
-DEF_HELPER_1(sqrtf, i64, i64)
-
-DEF_HELPER_1(g_to_memory, i64, i64)
-DEF_HELPER_1(memory_to_g, i64, i64)
-DEF_HELPER_2(addg, i64, i64, i64)
-DEF_HELPER_2(subg, i64, i64, i64)
-DEF_HELPER_2(mulg, i64, i64, i64)
-DEF_HELPER_2(divg, i64, i64, i64)
-DEF_HELPER_1(sqrtg, i64, i64)
-
-DEF_HELPER_1(s_to_memory, i32, i64)
-DEF_HELPER_1(memory_to_s, i64, i32)
-DEF_HELPER_2(adds, i64, i64, i64)
-DEF_HELPER_2(subs, i64, i64, i64)
-DEF_HELPER_2(muls, i64, i64, i64)
-DEF_HELPER_2(divs, i64, i64, i64)
-DEF_HELPER_1(sqrts, i64, i64)
-
-DEF_HELPER_2(addt, i64, i64, i64)
-DEF_HELPER_2(subt, i64, i64, i64)
-DEF_HELPER_2(mult, i64, i64, i64)
-DEF_HELPER_2(divt, i64, i64, i64)
-DEF_HELPER_1(sqrtt, i64, i64)
-
-DEF_HELPER_2(cmptun, i64, i64, i64)
-DEF_HELPER_2(cmpteq, i64, i64, i64)
-DEF_HELPER_2(cmptle, i64, i64, i64)
-DEF_HELPER_2(cmptlt, i64, i64, i64)
-DEF_HELPER_2(cmpgeq, i64, i64, i64)
-DEF_HELPER_2(cmpgle, i64, i64, i64)
-DEF_HELPER_2(cmpglt, i64, i64, i64)
-
-DEF_HELPER_1(cmpfeq, i64, i64)
-DEF_HELPER_1(cmpfne, i64, i64)
-DEF_HELPER_1(cmpflt, i64, i64)
-DEF_HELPER_1(cmpfle, i64, i64)
-DEF_HELPER_1(cmpfgt, i64, i64)
-DEF_HELPER_1(cmpfge, i64, i64)
-
-DEF_HELPER_2(cpys, i64, i64, i64)
-DEF_HELPER_2(cpysn, i64, i64, i64)
-DEF_HELPER_2(cpyse, i64, i64, i64)
-
-DEF_HELPER_1(cvtts, i64, i64)
-DEF_HELPER_1(cvtst, i64, i64)
-DEF_HELPER_1(cvttq, i64, i64)
-DEF_HELPER_1(cvtqs, i64, i64)
-DEF_HELPER_1(cvtqt, i64, i64)
-DEF_HELPER_1(cvtqf, i64, i64)
-DEF_HELPER_1(cvtgf, i64, i64)
-DEF_HELPER_1(cvtgq, i64, i64)
-DEF_HELPER_1(cvtqg, i64, i64)
-DEF_HELPER_1(cvtlq, i64, i64)
-DEF_HELPER_1(cvtql, i64, i64)
-DEF_HELPER_1(cvtqlv, i64, i64)
-DEF_HELPER_1(cvtqlsv, i64, i64)
+DEF_HELPER_FLAGS_0(load_pcc, TCG_CALL_NO_READ_GLOBALS, i64)
+DEF_HELPER_FLAGS_0(rc, TCG_CALL_NO_READ_GLOBALS, i64)
+DEF_HELPER_FLAGS_0(rs, TCG_CALL_NO_READ_GLOBALS, i64)
+
+DEF_HELPER_FLAGS_2(addqv, TCG_CALL_NO_WRITE_GLOBALS, i64, i64, i64)
+DEF_HELPER_FLAGS_2(addlv, TCG_CALL_NO_WRITE_GLOBALS, i64, i64, i64)
+DEF_HELPER_FLAGS_2(subqv, TCG_CALL_NO_WRITE_GLOBALS, i64, i64, i64)
+DEF_HELPER_FLAGS_2(sublv, TCG_CALL_NO_WRITE_GLOBALS, i64, i64, i64)
+DEF_HELPER_FLAGS_2(mullv, TCG_CALL_NO_WRITE_GLOBALS, i64, i64, i64)
+DEF_HELPER_FLAGS_2(mulqv, TCG_CALL_NO_WRITE_GLOBALS, i64, i64, i64)
+DEF_HELPER_FLAGS_2(umulh, TCG_CALL_CONST, i64, i64, i64)
+
+DEF_HELPER_FLAGS_1(ctpop, TCG_CALL_CONST, i64, i64)
+DEF_HELPER_FLAGS_1(ctlz, TCG_CALL_CONST, i64, i64)
+DEF_HELPER_FLAGS_1(cttz, TCG_CALL_CONST, i64, i64)
+
+DEF_HELPER_FLAGS_2(mskbl, TCG_CALL_CONST, i64, i64, i64)
+DEF_HELPER_FLAGS_2(insbl, TCG_CALL_CONST, i64, i64, i64)
+DEF_HELPER_FLAGS_2(mskwl, TCG_CALL_CONST, i64, i64, i64)
+DEF_HELPER_FLAGS_2(inswl, TCG_CALL_CONST, i64, i64, i64)
+DEF_HELPER_FLAGS_2(mskll, TCG_CALL_CONST, i64, i64, i64)
+DEF_HELPER_FLAGS_2(insll, TCG_CALL_CONST, i64, i64, i64)
+DEF_HELPER_FLAGS_2(zap, TCG_CALL_CONST, i64, i64, i64)
+DEF_HELPER_FLAGS_2(zapnot, TCG_CALL_CONST, i64, i64, i64)
+DEF_HELPER_FLAGS_2(mskql, TCG_CALL_CONST, i64, i64, i64)
+DEF_HELPER_FLAGS_2(insql, TCG_CALL_CONST, i64, i64, i64)
+DEF_HELPER_FLAGS_2(mskwh, TCG_CALL_CONST, i64, i64, i64)
+DEF_HELPER_FLAGS_2(inswh, TCG_CALL_CONST, i64, i64, i64)
+DEF_HELPER_FLAGS_2(msklh, TCG_CALL_CONST, i64, i64, i64)
+DEF_HELPER_FLAGS_2(inslh, TCG_CALL_CONST, i64, i64, i64)
+DEF_HELPER_FLAGS_2(mskqh, TCG_CALL_CONST, i64, i64, i64)
+DEF_HELPER_FLAGS_2(insqh, TCG_CALL_CONST, i64, i64, i64)
+
+DEF_HELPER_FLAGS_2(cmpbge, TCG_CALL_CONST, i64, i64, i64)
+
+DEF_HELPER_FLAGS_0(load_fpcr, TCG_CALL_NO_READ_GLOBALS, i64)
+DEF_HELPER_FLAGS_1(store_fpcr, TCG_CALL_NO_READ_GLOBALS, void, i64)
+
+DEF_HELPER_FLAGS_1(f_to_memory, TCG_CALL_CONST, i32, i64)
+DEF_HELPER_FLAGS_1(memory_to_f, TCG_CALL_CONST, i64, i32)
+DEF_HELPER_FLAGS_2(addf, TCG_CALL_NO_WRITE_GLOBALS, i64, i64, i64)
+DEF_HELPER_FLAGS_2(subf, TCG_CALL_NO_WRITE_GLOBALS, i64, i64, i64)
+DEF_HELPER_FLAGS_2(mulf, TCG_CALL_NO_WRITE_GLOBALS, i64, i64, i64)
+DEF_HELPER_FLAGS_2(divf, TCG_CALL_NO_WRITE_GLOBALS, i64, i64, i64)
+DEF_HELPER_FLAGS_1(sqrtf, TCG_CALL_NO_WRITE_GLOBALS, i64, i64)
+
+DEF_HELPER_FLAGS_1(g_to_memory, TCG_CALL_CONST, i64, i64)
+DEF_HELPER_FLAGS_1(memory_to_g, TCG_CALL_CONST, i64, i64)
+DEF_HELPER_FLAGS_2(addg, TCG_CALL_NO_WRITE_GLOBALS, i64, i64, i64)
+DEF_HELPER_FLAGS_2(subg, TCG_CALL_NO_WRITE_GLOBALS, i64, i64, i64)
+DEF_HELPER_FLAGS_2(mulg, TCG_CALL_NO_WRITE_GLOBALS, i64, i64, i64)
+DEF_HELPER_FLAGS_2(divg, TCG_CALL_NO_WRITE_GLOBALS, i64, i64, i64)
+DEF_HELPER_FLAGS_1(sqrtg, TCG_CALL_NO_WRITE_GLOBALS, i64, i64)
+
+DEF_HELPER_FLAGS_1(s_to_memory, TCG_CALL_CONST, i32, i64)
+DEF_HELPER_FLAGS_1(memory_to_s, TCG_CALL_CONST, i64, i32)
+DEF_HELPER_FLAGS_2(adds, TCG_CALL_NO_READ_GLOBALS, i64, i64, i64)
+DEF_HELPER_FLAGS_2(subs, TCG_CALL_NO_READ_GLOBALS, i64, i64, i64)
+DEF_HELPER_FLAGS_2(muls, TCG_CALL_NO_READ_GLOBALS, i64, i64, i64)
+DEF_HELPER_FLAGS_2(divs, TCG_CALL_NO_READ_GLOBALS, i64, i64, i64)
+DEF_HELPER_FLAGS_1(sqrts, TCG_CALL_NO_READ_GLOBALS, i64, i64)
+
+DEF_HELPER_FLAGS_2(addt, TCG_CALL_NO_READ_GLOBALS, i64, i64, i64)
+DEF_HELPER_FLAGS_2(subt, TCG_CALL_NO_READ_GLOBALS, i64, i64, i64)
+DEF_HELPER_FLAGS_2(mult, TCG_CALL_NO_READ_GLOBALS, i64, i64, i64)
+DEF_HELPER_FLAGS_2(divt, TCG_CALL_NO_READ_GLOBALS, i64, i64, i64)
+DEF_HELPER_FLAGS_1(sqrtt, TCG_CALL_NO_READ_GLOBALS, i64, i64)
+
+DEF_HELPER_FLAGS_2(cmptun, TCG_CALL_CONST, i64, i64, i64)
+DEF_HELPER_FLAGS_2(cmpteq, TCG_CALL_NO_READ_GLOBALS, i64, i64, i64)
+DEF_HELPER_FLAGS_2(cmptle, TCG_CALL_NO_READ_GLOBALS, i64, i64, i64)
+DEF_HELPER_FLAGS_2(cmptlt, TCG_CALL_NO_READ_GLOBALS, i64, i64, i64)
+DEF_HELPER_FLAGS_2(cmpgeq, TCG_CALL_NO_WRITE_GLOBALS, i64, i64, i64)
+DEF_HELPER_FLAGS_2(cmpgle, TCG_CALL_NO_WRITE_GLOBALS, i64, i64, i64)
+DEF_HELPER_FLAGS_2(cmpglt, TCG_CALL_NO_WRITE_GLOBALS, i64, i64, i64)
+
+DEF_HELPER_FLAGS_1(cmpfeq, TCG_CALL_CONST, i64, i64)
+DEF_HELPER_FLAGS_1(cmpfne, TCG_CALL_CONST, i64, i64)
+DEF_HELPER_FLAGS_1(cmpflt, TCG_CALL_CONST, i64, i64)
+DEF_HELPER_FLAGS_1(cmpfle, TCG_CALL_CONST, i64, i64)
+DEF_HELPER_FLAGS_1(cmpfgt, TCG_CALL_CONST, i64, i64)
+DEF_HELPER_FLAGS_1(cmpfge, TCG_CALL_CONST, i64, i64)
+
+DEF_HELPER_FLAGS_2(cpys, TCG_CALL_CONST, i64, i64, i64)
+DEF_HELPER_FLAGS_2(cpysn, TCG_CALL_CONST, i64, i64, i64)
+DEF_HELPER_FLAGS_2(cpyse, TCG_CALL_CONST, i64, i64, i64)
+
+DEF_HELPER_FLAGS_1(cvtts, TCG_CALL_NO_READ_GLOBALS, i64, i64)
+DEF_HELPER_FLAGS_1(cvtst, TCG_CALL_NO_READ_GLOBALS, i64, i64)
+DEF_HELPER_FLAGS_1(cvttq, TCG_CALL_NO_READ_GLOBALS, i64, i64)
+DEF_HELPER_FLAGS_1(cvtqs, TCG_CALL_NO_READ_GLOBALS, i64, i64)
+DEF_HELPER_FLAGS_1(cvtqt, TCG_CALL_NO_READ_GLOBALS, i64, i64)
+DEF_HELPER_FLAGS_1(cvtqf, TCG_CALL_NO_READ_GLOBALS, i64, i64)
+DEF_HELPER_FLAGS_1(cvtgf, TCG_CALL_NO_WRITE_GLOBALS, i64, i64)
+DEF_HELPER_FLAGS_1(cvtgq, TCG_CALL_NO_WRITE_GLOBALS, i64, i64)
+DEF_HELPER_FLAGS_1(cvtqg, TCG_CALL_NO_READ_GLOBALS, i64, i64)
+DEF_HELPER_FLAGS_1(cvtlq, TCG_CALL_CONST, i64, i64)
+DEF_HELPER_FLAGS_1(cvtql, TCG_CALL_CONST, i64, i64)
+DEF_HELPER_FLAGS_1(cvtqlv, TCG_CALL_NO_WRITE_GLOBALS, i64, i64)
+DEF_HELPER_FLAGS_1(cvtqlsv, TCG_CALL_NO_WRITE_GLOBALS, i64, i64)
 
 #if !defined (CONFIG_USER_ONLY)
 DEF_HELPER_0(hw_rei, void)
@@ -110,18 +110,20 @@ DEF_HELPER_1(hw_ret, void, i64)
 DEF_HELPER_2(mfpr, i64, int, i64)
 DEF_HELPER_2(mtpr, void, int, i64)
 
-DEF_HELPER_2(21264_hw_ldq, i64, i64, i32)
-DEF_HELPER_2(21264_hw_ldl, i64, i64, i32)
-DEF_HELPER_3(21264_hw_stq, void, i64, i64, i32)
-DEF_HELPER_3(21264_hw_stl, void, i64, i64, i32)
-DEF_HELPER_1(ldl_phys, i64, i64)
-DEF_HELPER_1(ldq_phys, i64, i64)
+DEF_HELPER_FLAGS_2(21264_hw_ldq, TCG_CALL_NO_WRITE_GLOBALS, i64, i64, i32)
+DEF_HELPER_FLAGS_2(21264_hw_ldl, TCG_CALL_NO_WRITE_GLOBALS, i64, i64, i32)
+DEF_HELPER_FLAGS_3(21264_hw_stq, TCG_CALL_NO_WRITE_GLOBALS,
+                   void, i64, i64, i32)
+DEF_HELPER_FLAGS_3(21264_hw_stl, TCG_CALL_NO_WRITE_GLOBALS,
+                   void, i64, i64, i32)
+DEF_HELPER_FLAGS_1(ldl_phys, TCG_CALL_NO_WRITE_GLOBALS, i64, i64)
+DEF_HELPER_FLAGS_1(ldq_phys, TCG_CALL_NO_WRITE_GLOBALS, i64, i64)
 DEF_HELPER_1(ldl_l_phys, i64, i64)
 DEF_HELPER_1(ldq_l_phys, i64, i64)
-DEF_HELPER_1(ldl_data, i64, i64)
-DEF_HELPER_1(ldq_data, i64, i64)
-DEF_HELPER_2(stl_phys, void, i64, i64)
-DEF_HELPER_2(stq_phys, void, i64, i64)
+DEF_HELPER_FLAGS_1(ldl_data, TCG_CALL_NO_WRITE_GLOBALS, i64, i64)
+DEF_HELPER_FLAGS_1(ldq_data, TCG_CALL_NO_WRITE_GLOBALS, i64, i64)
+DEF_HELPER_FLAGS_2(stl_phys, TCG_CALL_NO_WRITE_GLOBALS, void, i64, i64)
+DEF_HELPER_FLAGS_2(stq_phys, TCG_CALL_NO_WRITE_GLOBALS, void, i64, i64)
 DEF_HELPER_2(stl_c_phys, i64, i64, i64)
 DEF_HELPER_2(stq_c_phys, i64, i64, i64)
 #endif
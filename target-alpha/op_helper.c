@@ -1119,7 +1119,7 @@ uint64_t helper_21264_hw_ld##S (uint64_t va, uint32_t v2p_flags)        \
         mmu_idx = env->a21264.altmode;                                  \
     else                                                                \
         mmu_idx = v2p_flags & ALPHA_HW_MMUIDX_MASK;                     \
-    index = (va >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);              \
+    index = tlb_index(env, mmu_idx, va);                                \
     tlb_addr = env->tlb_table[mmu_idx][index].addr_read;                \
     if ((va & TARGET_PAGE_MASK) ==                                      \
         (tlb_addr & (TARGET_PAGE_MASK | TLB_INVALID_MASK))) {           \
@@ -1147,7 +1147,7 @@ void helper_21264_hw_st##S(uint64_t va, uint64_t val,                   \
         mmu_idx = env->a21264.altmode;                                  \
     else                                                                \
         mmu_idx = v2p_flags & ALPHA_HW_MMUIDX_MASK;                     \
-    index = (va >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);              \
+    index = tlb_index(env, mmu_idx, va);                                \
     tlb_addr = env->tlb_table[mmu_idx][index].addr_write;               \
     if ((va & TARGET_PAGE_MASK) ==                                      \
         (tlb_addr & (TARGET_PAGE_MASK | TLB_INVALID_MASK))) {           \
@@ -54,6 +54,13 @@ struct DisasContext {
     int fen;
     CPUAlphaState *env;
     uint32_t amask;
+    /* superblock: first pc, number of guest blocks, index of the
+       current one and, in bit n, whether block n follows its taken
+       branch (see tb_trace_profile()) */
+    uint64_t trace_pc;
+    int trace_blocks;
+    int trace_block;
+    uint32_t trace_taken;
 };
 
 /* global register indexes */
@@ -98,6 +105,14 @@ static void alpha_translate_init(void)
     cpu_lock = tcg_global_mem_new_i64(TCG_AREG0,
                                       offsetof(CPUState, lock), "lock");
 
+    /* keep the busiest integer registers in host registers across TBs:
+       sp, ra, gp, v0 and a0, as far as the host has registers for them */
+    tcg_global_pin_i64(cpu_ir[IR_SP]);
+    tcg_global_pin_i64(cpu_ir[IR_RA]);
+    tcg_global_pin_i64(cpu_ir[IR_GP]);
+    tcg_global_pin_i64(cpu_ir[IR_V0]);
+    tcg_global_pin_i64(cpu_ir[IR_A0]);
+
     /* register helpers */
 #define GEN_HELPER 2
 #include "helper.h"
@@ -349,44 +364,89 @@ static always_inline void gen_store_mem (DisasContext *ctx,
     tcg_temp_free(addr);
 }
 
-static always_inline void gen_bcond (DisasContext *ctx,
-                                     TCGCond cond,
-                                     int ra, int32_t disp, int mask)
+/* In a superblock, tell whether translation goes on at 'dest' after
+   the branch ending the current guest block.  */
+static always_inline int gen_trace_follow (DisasContext *ctx, uint64_t dest)
+{
+    if (ctx->trace_block + 1 >= ctx->trace_blocks ||
+        dest <= ctx->trace_pc ||
+        (dest & TARGET_PAGE_MASK) != (ctx->trace_pc & TARGET_PAGE_MASK))
+        return 0;
+    ctx->trace_block++;
+    return 1;
+}
+
+/* Return 0 if translation goes on at the new ctx->pc.  */
+static always_inline int gen_bdirect (DisasContext *ctx, uint64_t dest)
 {
+    if (gen_trace_follow(ctx, dest)) {
+        ctx->pc = dest;
+        return 0;
+    }
+    tcg_gen_movi_i64(cpu_pc, dest);
+    return 1;
+}
+
+static always_inline int gen_bcond_internal (DisasContext *ctx,
+                                             TCGCond cond, TCGv val,
+                                             int32_t disp)
+{
+    uint64_t dest = ctx->pc + (int64_t)(disp << 2);
+    int taken = (ctx->trace_taken >> ctx->trace_block) & 1;
     int l1, l2;
 
     l1 = gen_new_label();
+    if (gen_trace_follow(ctx, taken ? dest : ctx->pc)) {
+        /* only the side leaving the superblock exits the TB */
+        tcg_gen_brcondi_i64(taken ? cond : tcg_invert_cond(cond),
+                            val, 0, l1);
+        tcg_gen_movi_i64(cpu_pc, taken ? ctx->pc : dest);
+        tcg_gen_exit_tb(0);
+        gen_set_label(l1);
+        if (taken)
+            ctx->pc = dest;
+        return 0;
+    }
     l2 = gen_new_label();
+    tcg_gen_brcondi_i64(cond, val, 0, l1);
+    tcg_gen_movi_i64(cpu_pc, ctx->pc);
+    tcg_gen_br(l2);
+    gen_set_label(l1);
+    tcg_gen_movi_i64(cpu_pc, dest);
+    gen_set_label(l2);
+    return 1;
+}
+
+static always_inline int gen_bcond (DisasContext *ctx,
+                                    TCGCond cond,
+                                    int ra, int32_t disp, int mask)
+{
+    int ret;
+
     if (likely(ra != 31)) {
         if (mask) {
             TCGv tmp = tcg_temp_new();
             tcg_gen_andi_i64(tmp, cpu_ir[ra], 1);
-            tcg_gen_brcondi_i64(cond, tmp, 0, l1);
+            ret = gen_bcond_internal(ctx, cond, tmp, disp);
             tcg_temp_free(tmp);
         } else
-            tcg_gen_brcondi_i64(cond, cpu_ir[ra], 0, l1);
+            ret = gen_bcond_internal(ctx, cond, cpu_ir[ra], disp);
     } else {
         /* Very uncommon case - Do not bother to optimize.  */
         TCGv tmp = tcg_const_i64(0);
-        tcg_gen_brcondi_i64(cond, tmp, 0, l1);
+        ret = gen_bcond_internal(ctx, cond, tmp, disp);
         tcg_temp_free(tmp);
     }
-    tcg_gen_movi_i64(cpu_pc, ctx->pc);
-    tcg_gen_br(l2);
-    gen_set_label(l1);
-    tcg_gen_movi_i64(cpu_pc, ctx->pc + (int64_t)(disp << 2));
-    gen_set_label(l2);
+    return ret;
 }
 
-static always_inline void gen_fbcond (DisasContext *ctx, int opc,
-                                      int ra, int32_t disp16)
+static always_inline int gen_fbcond (DisasContext *ctx, int opc,
+                                     int ra, int32_t disp16)
 {
-    int l1, l2;
     TCGv tmp;
     TCGv src;
+    int ret;
 
-    l1 = gen_new_label();
-    l2 = gen_new_label();
     if (ra != 31) {
         tmp = tcg_temp_new();
         src = cpu_fir[ra];
@@ -416,12 +476,9 @@ static always_inline void gen_fbcond (DisasContext *ctx, int opc,
     default:
         abort();
     }
-    tcg_gen_brcondi_i64(TCG_COND_NE, tmp, 0, l1);
-    tcg_gen_movi_i64(cpu_pc, ctx->pc);
-    tcg_gen_br(l2);
-    gen_set_label(l1);
-    tcg_gen_movi_i64(cpu_pc, ctx->pc + (int64_t)(disp16 << 2));
-    gen_set_label(l2);
+    ret = gen_bcond_internal(ctx, TCG_COND_NE, tmp, disp16);
+    tcg_temp_free(tmp);
+    return ret;
 }
 
 static always_inline void gen_cmov (TCGCond inv_cond,
@@ -2340,71 +2397,59 @@ static always_inline int translate_one (DisasContext *ctx, uint32_t insn)
         /* BR */
         if (ra != 31)
             tcg_gen_movi_i64(cpu_ir[ra], ctx->pc);
-        tcg_gen_movi_i64(cpu_pc, ctx->pc + (int64_t)(disp21 << 2));
-        ret = 1;
+        ret = gen_bdirect(ctx, ctx->pc + (int64_t)(disp21 << 2));
         break;
     case 0x31: /* FBEQ */
     case 0x32: /* FBLT */
     case 0x33: /* FBLE */
         if (!ctx->fen)
             goto fp_disabled;
-        gen_fbcond(ctx, opc, ra, disp16);
-        ret = 1;
+        ret = gen_fbcond(ctx, opc, ra, disp16);
         break;
     case 0x34:
         /* BSR */
         if (ra != 31)
             tcg_gen_movi_i64(cpu_ir[ra], ctx->pc);
-        tcg_gen_movi_i64(cpu_pc, ctx->pc + (int64_t)(disp21 << 2));
-        ret = 1;
+        ret = gen_bdirect(ctx, ctx->pc + (int64_t)(disp21 << 2));
         break;
     case 0x35: /* FBNE */
     case 0x36: /* FBGE */
     case 0x37: /* FBGT */
         if (!ctx->fen)
             goto fp_disabled;
-        gen_fbcond(ctx, opc, ra, disp16);
-        ret = 1;
+        ret = gen_fbcond(ctx, opc, ra, disp16);
         break;
     case 0x38:
         /* BLBC */
-        gen_bcond(ctx, TCG_COND_EQ, ra, disp21, 1);
-        ret = 1;
+        ret = gen_bcond(ctx, TCG_COND_EQ, ra, disp21, 1);
         break;
     case 0x39:
         /* BEQ */
-        gen_bcond(ctx, TCG_COND_EQ, ra, disp21, 0);
-        ret = 1;
+        ret = gen_bcond(ctx, TCG_COND_EQ, ra, disp21, 0);
         break;
     case 0x3A:
         /* BLT */
-        gen_bcond(ctx, TCG_COND_LT, ra, disp21, 0);
-        ret = 1;
+        ret = gen_bcond(ctx, TCG_COND_LT, ra, disp21, 0);
         break;
     case 0x3B:
         /* BLE */
-        gen_bcond(ctx, TCG_COND_LE, ra, disp21, 0);
-        ret = 1;
+        ret = gen_bcond(ctx, TCG_COND_LE, ra, disp21, 0);
         break;
     case 0x3C:
         /* BLBS */
-        gen_bcond(ctx, TCG_COND_NE, ra, disp21, 1);
-        ret = 1;
+        ret = gen_bcond(ctx, TCG_COND_NE, ra, disp21, 1);
         break;
     case 0x3D:
         /* BNE */
-        gen_bcond(ctx, TCG_COND_NE, ra, disp21, 0);
-        ret = 1;
+        ret = gen_bcond(ctx, TCG_COND_NE, ra, disp21, 0);
         break;
     case 0x3E:
         /* BGE */
-        gen_bcond(ctx, TCG_COND_GE, ra, disp21, 0);
-        ret = 1;
+        ret = gen_bcond(ctx, TCG_COND_GE, ra, disp21, 0);
         break;
     case 0x3F:
         /* BGT */
-        gen_bcond(ctx, TCG_COND_GT, ra, disp21, 0);
-        ret = 1;
+        ret = gen_bcond(ctx, TCG_COND_GT, ra, disp21, 0);
         break;
     invalid_opc:
         gen_excp(ctx, EXCP_GEN_OPCDEC, 0);
@@ -2427,7 +2472,7 @@ static always_inline void gen_intermediate_code_internal (CPUState *env,
     static int insn_count;
 #endif
     DisasContext ctx, *ctxp = &ctx;
-    target_ulong pc_start;
+    target_ulong pc_start, pc_end;
     uint32_t insn;
     uint16_t *gen_opc_end;
     CPUBreakpoint *bp;
@@ -2435,12 +2480,19 @@ static always_inline void gen_intermediate_code_internal (CPUState *env,
     int ret;
     int num_insns;
     int max_insns;
+    target_ulong code_page;
+    uint8_t *code_ptr;
 
     pc_start = tb->pc;
     gen_opc_end = gen_opc_buf + OPC_MAX_SIZE;
+    pc_end = pc_start;
     ctx.pc = pc_start;
     ctx.amask = env->amask;
     ctx.env = env;
+    ctx.trace_pc = pc_start;
+    ctx.trace_blocks = tb->trace_blocks;
+    ctx.trace_block = 0;
+    ctx.trace_taken = tb->trace_taken;
 #if defined (CONFIG_USER_ONLY)
     ctx.mem_idx = 0;
 #else
@@ -2456,6 +2508,8 @@ static always_inline void gen_intermediate_code_internal (CPUState *env,
     }
 #endif
     ctx.fen = env->fen;
+    code_page = -1;
+    code_ptr = NULL;
     num_insns = 0;
     max_insns = tb->cflags & CF_COUNT_MASK;
     if (max_insns == 0)
@@ -2471,17 +2525,16 @@ static always_inline void gen_intermediate_code_internal (CPUState *env,
                 }
             }
         }
-        if (search_pc) {
-            j = gen_opc_ptr - gen_opc_buf;
-            if (lj < j) {
-                lj++;
-                while (lj < j)
-                    gen_opc_instr_start[lj++] = 0;
-            }
-            gen_opc_pc[lj] = ctx.pc;
-            gen_opc_instr_start[lj] = 1;
-            gen_opc_icount[lj] = num_insns;
+        /* recorded even when !search_pc for the pc map of the TB */
+        j = gen_opc_ptr - gen_opc_buf;
+        if (lj < j) {
+            lj++;
+            while (lj < j)
+                gen_opc_instr_start[lj++] = 0;
         }
+        gen_opc_pc[lj] = ctx.pc;
+        gen_opc_instr_start[lj] = 1;
+        gen_opc_icount[lj] = num_insns;
         if (num_insns + 1 == max_insns && (tb->cflags & CF_LAST_IO))
             gen_io_start();
 #if defined ALPHA_DEBUG_DISAS
@@ -2489,13 +2542,25 @@ static always_inline void gen_intermediate_code_internal (CPUState *env,
         LOG_DISAS("pc " TARGET_FMT_lx " mem_idx %d\n",
                   ctx.pc, ctx.mem_idx);
 #endif
-        insn = ldl_code(ctx.pc);
+        /* Look the code page up once, then read from it directly.  A
+           superblock may continue on any page, not just the next one.  */
+        if ((ctx.pc & TARGET_PAGE_MASK) != code_page) {
+            insn = ldl_code(ctx.pc);
+            code_page = ctx.pc & TARGET_PAGE_MASK;
+            code_ptr = get_host_addr_code(env, ctx.pc);
+        } else if (likely(code_ptr != NULL)) {
+            insn = ldl_p(code_ptr + (ctx.pc & ~TARGET_PAGE_MASK));
+        } else {
+            insn = ldl_code(ctx.pc);
+        }
 #if defined ALPHA_DEBUG_DISAS
         insn_count++;
         LOG_DISAS("opcode %08x %d\n", insn, insn_count);
 #endif
         num_insns++;
         ctx.pc += 4;
+        if (ctx.pc > pc_end)
+            pc_end = ctx.pc;
         ret = translate_one(ctxp, insn);
         if (ret != 0)
             break;
@@ -2528,13 +2593,13 @@ static always_inline void gen_intermediate_code_internal (CPUState *env,
     tcg_gen_exit_tb(0);
     gen_icount_end(tb, num_insns);
     *gen_opc_ptr = INDEX_op_end;
-    if (search_pc) {
-        j = gen_opc_ptr - gen_opc_buf;
-        lj++;
-        while (lj <= j)
-            gen_opc_instr_start[lj++] = 0;
-    } else {
-        tb->size = ctx.pc - pc_start;
+    j = gen_opc_ptr - gen_opc_buf;
+    lj++;
+    while (lj <= j)
+        gen_opc_instr_start[lj++] = 0;
+    if (!search_pc) {
+        /* a superblock covers every guest block it was built from */
+        tb->size = pc_end - pc_start;
         tb->icount = num_insns;
     }
 #if defined ALPHA_DEBUG_DISAS
@@ -2542,7 +2607,7 @@ static always_inline void gen_intermediate_code_internal (CPUState *env,
     if (qemu_loglevel_mask(CPU_LOG_TB_IN_ASM)) {
         qemu_log("IN: %s%s\n", lookup_symbol(pc_start),
                  search_pc ? " [search_pc]" : "");
-        log_target_disas(pc_start, ctx.pc - pc_start, 1);
+        log_target_disas(pc_start, pc_end - pc_start, 1);
         qemu_log("\n");
     }
 #endif
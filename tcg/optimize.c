@@ -0,0 +1,856 @@
+/*
+ * Optimizations for Tiny Code Generator for QEMU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "config.h"
+#include "qemu-common.h"
+
+#define NO_CPU_IO_DEFS
+#include "cpu.h"
+
+#include "tcg-op.h"
+
+/* The optimizer works on the op stream of one TB, between its
+   generation by the front end and the liveness analysis.  It folds
+   constants, propagates copies, simplifies algebraic identities and
+   drops sign/zero extensions of values that are already extended.
+   Ops are only ever replaced by shorter ones, so the arguments are
+   compacted in place and the op indexes (used by
+   gen_intermediate_code_pc()) do not move. */
+
+int tcg_optimize_enabled = 1;
+
+#if TCG_TARGET_REG_BITS == 64
+#define CASE_OP_32_64(x)                        \
+        glue(glue(case INDEX_op_, x), _i32):    \
+        glue(glue(case INDEX_op_, x), _i64)
+#else
+#define CASE_OP_32_64(x)                        \
+        glue(glue(case INDEX_op_, x), _i32)
+#endif
+
+typedef enum {
+    TCG_TEMP_UNDEF = 0,
+    TCG_TEMP_CONST,
+    TCG_TEMP_COPY,
+} TCGTempState;
+
+typedef struct TCGTempInfo {
+    TCGTempState state;
+    /* circular list of the temps holding the same value */
+    uint16_t prev_copy;
+    uint16_t next_copy;
+    tcg_target_ulong val;  /* value of a TCG_TEMP_CONST temp */
+    tcg_target_ulong mask; /* bits which may be set in the value */
+    int sext;              /* the value is the sign extension of its
+                              'sext' low order bits */
+} TCGTempInfo;
+
+static TCGTempInfo temps[TCG_MAX_TEMPS];
+
+static inline int temp_bits(TCGContext *s, TCGArg arg)
+{
+#if TCG_TARGET_REG_BITS == 64
+    if (s->temps[arg].type == TCG_TYPE_I64)
+        return 64;
+#endif
+    return 32;
+}
+
+static inline tcg_target_ulong width_mask(int bits)
+{
+#if TCG_TARGET_REG_BITS == 64
+    if (bits == 64)
+        return -1;
+#endif
+    return 0xffffffffu;
+}
+
+/* Values of 32 bit temps are kept sign extended so that they compare
+   equal whatever the host word size is. */
+static inline tcg_target_ulong normalize(tcg_target_ulong val, int bits)
+{
+#if TCG_TARGET_REG_BITS == 64
+    if (bits == 32)
+        val = (int32_t)val;
+#endif
+    return val;
+}
+
+/* smallest n such that 'val' is the sign extension of its n low bits */
+static int const_sext(tcg_target_ulong val, int bits)
+{
+    tcg_target_long v = normalize(val, bits);
+    int n, sh;
+
+    for (n = 1; n < bits; n++) {
+        sh = TCG_TARGET_REG_BITS - n;
+        if ((tcg_target_long)((tcg_target_ulong)v << sh) >> sh == v)
+            break;
+    }
+    return n;
+}
+
+/* a value whose sign bit is known to be clear is the sign extension of
+   its significant bits plus one */
+static int mask_sext(tcg_target_ulong mask, int bits)
+{
+    int n;
+
+    mask &= width_mask(bits);
+    if ((mask >> (bits - 1)) & 1)
+        return bits;
+    for (n = 1; mask != 0; n++)
+        mask >>= 1;
+    return n;
+}
+
+static void reset_temp(TCGContext *s, TCGArg arg)
+{
+    TCGTempInfo *ti = &temps[arg];
+
+    if (ti->state == TCG_TEMP_COPY) {
+        temps[ti->next_copy].prev_copy = ti->prev_copy;
+        temps[ti->prev_copy].next_copy = ti->next_copy;
+        /* the last member left is not a copy of anything */
+        if (ti->next_copy == ti->prev_copy)
+            temps[ti->next_copy].state = TCG_TEMP_UNDEF;
+    }
+    ti->state = TCG_TEMP_UNDEF;
+    ti->mask = -1;
+    ti->sext = temp_bits(s, arg);
+}
+
+static void reset_all_temps(TCGContext *s)
+{
+    int i;
+
+    for (i = 0; i < s->nb_temps; i++) {
+        temps[i].state = TCG_TEMP_UNDEF;
+        temps[i].mask = -1;
+        temps[i].sext = temp_bits(s, i);
+    }
+}
+
+static void reset_globals(TCGContext *s)
+{
+    int i;
+
+    for (i = 0; i < s->nb_globals; i++)
+        reset_temp(s, i);
+}
+
+/* record what is known about the value of 'dst' after it was written */
+static void set_info(TCGContext *s, TCGArg dst, tcg_target_ulong mask,
+                     int sext)
+{
+    int bits = temp_bits(s, dst);
+    int n;
+
+    reset_temp(s, dst);
+    temps[dst].mask = mask & width_mask(bits);
+    n = mask_sext(mask, bits);
+    temps[dst].sext = sext < n ? sext : n;
+}
+
+static void set_const(TCGContext *s, TCGArg dst, tcg_target_ulong val)
+{
+    int bits = temp_bits(s, dst);
+
+    val = normalize(val, bits);
+    set_info(s, dst, val, const_sext(val, bits));
+    temps[dst].state = TCG_TEMP_CONST;
+    temps[dst].val = val;
+}
+
+/* 'dst' was just reset and now holds the value of 'src' */
+static void make_copy(TCGContext *s, TCGArg dst, TCGArg src)
+{
+    if (temps[src].state != TCG_TEMP_COPY) {
+        temps[src].state = TCG_TEMP_COPY;
+        temps[src].prev_copy = src;
+        temps[src].next_copy = src;
+    }
+    temps[dst].state = TCG_TEMP_COPY;
+    temps[dst].prev_copy = src;
+    temps[dst].next_copy = temps[src].next_copy;
+    temps[temps[src].next_copy].prev_copy = dst;
+    temps[src].next_copy = dst;
+    temps[dst].mask = temps[src].mask;
+    temps[dst].sext = temps[src].sext;
+}
+
+/* Among the temps holding the same value, prefer globals and then
+   local temps: they are the most likely to be already in a register
+   and to stay alive. */
+static TCGArg find_better_copy(TCGContext *s, TCGArg arg)
+{
+    TCGArg i;
+
+    if (arg < s->nb_globals)
+        return arg;
+    for (i = temps[arg].next_copy; i != arg; i = temps[i].next_copy) {
+        if (i < s->nb_globals)
+            return i;
+    }
+    if (s->temps[arg].temp_local)
+        return arg;
+    for (i = temps[arg].next_copy; i != arg; i = temps[i].next_copy) {
+        if (s->temps[i].temp_local)
+            return i;
+    }
+    return arg;
+}
+
+static int temps_are_copies(TCGContext *s, TCGArg a, TCGArg b)
+{
+    TCGArg i;
+
+    if (a == b)
+        return 1;
+    if (temps[a].state == TCG_TEMP_CONST && temps[b].state == TCG_TEMP_CONST)
+        return s->temps[a].type == s->temps[b].type &&
+            temps[a].val == temps[b].val;
+    if (temps[a].state != TCG_TEMP_COPY || temps[b].state != TCG_TEMP_COPY)
+        return 0;
+    for (i = temps[a].next_copy; i != a; i = temps[i].next_copy) {
+        if (i == b)
+            return 1;
+    }
+    return 0;
+}
+
+/* The front ends sometimes use a 32 bit temp as the input of a 64 bit
+   op (see tcg_gen_extu_i32_i64()).  Its high part is then undefined,
+   so nothing is assumed about it. */
+static inline int arg_fits(TCGContext *s, TCGArg arg, int bits)
+{
+    return temp_bits(s, arg) == bits;
+}
+
+static inline int is_const(TCGContext *s, TCGArg arg, int bits)
+{
+    return temps[arg].state == TCG_TEMP_CONST && arg_fits(s, arg, bits);
+}
+
+static inline tcg_target_ulong temp_mask(TCGContext *s, TCGArg arg, int bits)
+{
+    return arg_fits(s, arg, bits) ? temps[arg].mask : (tcg_target_ulong)-1;
+}
+
+static inline int temp_sext(TCGContext *s, TCGArg arg, int bits)
+{
+    return arg_fits(s, arg, bits) ? temps[arg].sext : bits;
+}
+
+/* The functions below replace the current op, at 'opc' with its
+   arguments at 'gen_args', and return the number of arguments the new
+   op uses. */
+
+static int tcg_opt_gen_movi(TCGContext *s, uint16_t *opc, TCGArg *gen_args,
+                            TCGArg dst, tcg_target_ulong val, int bits)
+{
+    val = normalize(val, bits);
+    if (is_const(s, dst, bits) && temps[dst].val == val) {
+        *opc = INDEX_op_nop;
+        return 0;
+    }
+#if TCG_TARGET_REG_BITS == 64
+    *opc = bits == 64 ? INDEX_op_movi_i64 : INDEX_op_movi_i32;
+#else
+    *opc = INDEX_op_movi_i32;
+#endif
+    gen_args[0] = dst;
+    gen_args[1] = val;
+    set_const(s, dst, val);
+    return 2;
+}
+
+static int tcg_opt_gen_mov(TCGContext *s, uint16_t *opc, TCGArg *gen_args,
+                           TCGArg dst, TCGArg src, int bits)
+{
+    if (temps_are_copies(s, dst, src)) {
+        *opc = INDEX_op_nop;
+        return 0;
+    }
+    if (temps[src].state == TCG_TEMP_CONST)
+        return tcg_opt_gen_movi(s, opc, gen_args, dst, temps[src].val, bits);
+#if TCG_TARGET_REG_BITS == 64
+    *opc = bits == 64 ? INDEX_op_mov_i64 : INDEX_op_mov_i32;
+#else
+    *opc = INDEX_op_mov_i32;
+#endif
+    gen_args[0] = dst;
+    gen_args[1] = src;
+    reset_temp(s, dst);
+    /* a mov_i32 from a 64 bit temp truncates it */
+    if (s->temps[dst].type == s->temps[src].type)
+        make_copy(s, dst, src);
+    return 2;
+}
+
+static tcg_target_ulong do_constant_folding_2(int op, tcg_target_ulong x,
+                                              tcg_target_ulong y)
+{
+    switch (op) {
+    CASE_OP_32_64(add):
+        return x + y;
+    CASE_OP_32_64(sub):
+        return x - y;
+    CASE_OP_32_64(mul):
+        return x * y;
+    CASE_OP_32_64(and):
+        return x & y;
+    CASE_OP_32_64(or):
+        return x | y;
+    CASE_OP_32_64(xor):
+        return x ^ y;
+    case INDEX_op_shl_i32:
+        return (uint32_t)x << (y & 31);
+    case INDEX_op_shr_i32:
+        return (uint32_t)x >> (y & 31);
+    case INDEX_op_sar_i32:
+        return (int32_t)x >> (y & 31);
+#ifdef TCG_TARGET_HAS_rot_i32
+    case INDEX_op_rotl_i32:
+        y &= 31;
+        return y ? ((uint32_t)x << y) | ((uint32_t)x >> (32 - y)) : x;
+    case INDEX_op_rotr_i32:
+        y &= 31;
+        return y ? ((uint32_t)x >> y) | ((uint32_t)x << (32 - y)) : x;
+#endif
+#if TCG_TARGET_REG_BITS == 64
+    case INDEX_op_shl_i64:
+        return (uint64_t)x << (y & 63);
+    case INDEX_op_shr_i64:
+        return (uint64_t)x >> (y & 63);
+    case INDEX_op_sar_i64:
+        return (int64_t)x >> (y & 63);
+#ifdef TCG_TARGET_HAS_rot_i64
+    case INDEX_op_rotl_i64:
+        y &= 63;
+        return y ? ((uint64_t)x << y) | ((uint64_t)x >> (64 - y)) : x;
+    case INDEX_op_rotr_i64:
+        y &= 63;
+        return y ? ((uint64_t)x >> y) | ((uint64_t)x << (64 - y)) : x;
+#endif
+#endif
+#ifdef TCG_TARGET_HAS_not_i32
+    case INDEX_op_not_i32:
+#endif
+#ifdef TCG_TARGET_HAS_not_i64
+    case INDEX_op_not_i64:
+#endif
+        return ~x;
+#ifdef TCG_TARGET_HAS_neg_i32
+    case INDEX_op_neg_i32:
+#endif
+#ifdef TCG_TARGET_HAS_neg_i64
+    case INDEX_op_neg_i64:
+#endif
+        return -x;
+#ifdef TCG_TARGET_HAS_ext8s_i32
+    case INDEX_op_ext8s_i32:
+#endif
+#ifdef TCG_TARGET_HAS_ext8s_i64
+    case INDEX_op_ext8s_i64:
+#endif
+        return (int8_t)x;
+#ifdef TCG_TARGET_HAS_ext16s_i32
+    case INDEX_op_ext16s_i32:
+#endif
+#ifdef TCG_TARGET_HAS_ext16s_i64
+    case INDEX_op_ext16s_i64:
+#endif
+        return (int16_t)x;
+#ifdef TCG_TARGET_HAS_ext32s_i64
+    case INDEX_op_ext32s_i64:
+        return (int32_t)x;
+#endif
+    default:
+        fprintf(stderr, "Unrecognized operation %d in do_constant_folding.\n",
+                op);
+        tcg_abort();
+    }
+}
+
+static int do_constant_folding_cond(int bits, tcg_target_ulong x,
+                                    tcg_target_ulong y, int cond)
+{
+#if TCG_TARGET_REG_BITS == 64
+    if (bits == 64) {
+        switch (cond) {
+        case TCG_COND_EQ:  return x == y;
+        case TCG_COND_NE:  return x != y;
+        case TCG_COND_LT:  return (int64_t)x < (int64_t)y;
+        case TCG_COND_GE:  return (int64_t)x >= (int64_t)y;
+        case TCG_COND_LE:  return (int64_t)x <= (int64_t)y;
+        case TCG_COND_GT:  return (int64_t)x > (int64_t)y;
+        case TCG_COND_LTU: return x < y;
+        case TCG_COND_GEU: return x >= y;
+        case TCG_COND_LEU: return x <= y;
+        case TCG_COND_GTU: return x > y;
+        default:           return -1;
+        }
+    }
+#endif
+    switch (cond) {
+    case TCG_COND_EQ:  return (uint32_t)x == (uint32_t)y;
+    case TCG_COND_NE:  return (uint32_t)x != (uint32_t)y;
+    case TCG_COND_LT:  return (int32_t)x < (int32_t)y;
+    case TCG_COND_GE:  return (int32_t)x >= (int32_t)y;
+    case TCG_COND_LE:  return (int32_t)x <= (int32_t)y;
+    case TCG_COND_GT:  return (int32_t)x > (int32_t)y;
+    case TCG_COND_LTU: return (uint32_t)x < (uint32_t)y;
+    case TCG_COND_GEU: return (uint32_t)x >= (uint32_t)y;
+    case TCG_COND_LEU: return (uint32_t)x <= (uint32_t)y;
+    case TCG_COND_GTU: return (uint32_t)x > (uint32_t)y;
+    default:           return -1;
+    }
+}
+
+static int op_is_commutative(int op)
+{
+    switch (op) {
+    CASE_OP_32_64(add):
+    CASE_OP_32_64(mul):
+    CASE_OP_32_64(and):
+    CASE_OP_32_64(or):
+    CASE_OP_32_64(xor):
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static int tcg_opt_binary(TCGContext *s, uint16_t *opc, TCGArg *gen_args,
+                          int bits)
+{
+    int op = *opc;
+    TCGArg dst = gen_args[0], x = gen_args[1], y = gen_args[2];
+    tcg_target_ulong wmask = width_mask(bits);
+    tcg_target_ulong c, mx, my, mask;
+    int sx, sy, sext;
+
+    /* keep the constant second, where the backends accept immediates */
+    if (op_is_commutative(op) && is_const(s, x, bits) &&
+        !is_const(s, y, bits)) {
+        gen_args[1] = y;
+        gen_args[2] = x;
+        x = gen_args[1];
+        y = gen_args[2];
+    }
+
+    if (is_const(s, x, bits) && is_const(s, y, bits)) {
+        c = do_constant_folding_2(op, temps[x].val, temps[y].val);
+        return tcg_opt_gen_movi(s, opc, gen_args, dst, c, bits);
+    }
+
+    if (is_const(s, y, bits)) {
+        c = temps[y].val & wmask;
+        switch (op) {
+        CASE_OP_32_64(add):
+        CASE_OP_32_64(sub):
+        CASE_OP_32_64(xor):
+        CASE_OP_32_64(shl):
+        CASE_OP_32_64(shr):
+        CASE_OP_32_64(sar):
+#ifdef TCG_TARGET_HAS_rot_i32
+        case INDEX_op_rotl_i32:
+        case INDEX_op_rotr_i32:
+#endif
+#ifdef TCG_TARGET_HAS_rot_i64
+        case INDEX_op_rotl_i64:
+        case INDEX_op_rotr_i64:
+#endif
+            if (c == 0)
+                return tcg_opt_gen_mov(s, opc, gen_args, dst, x, bits);
+            break;
+        CASE_OP_32_64(or):
+            if (c == 0)
+                return tcg_opt_gen_mov(s, opc, gen_args, dst, x, bits);
+            if (c == wmask)
+                return tcg_opt_gen_movi(s, opc, gen_args, dst, -1, bits);
+            break;
+        CASE_OP_32_64(mul):
+            if (c == 1)
+                return tcg_opt_gen_mov(s, opc, gen_args, dst, x, bits);
+            if (c == 0)
+                return tcg_opt_gen_movi(s, opc, gen_args, dst, 0, bits);
+            break;
+        CASE_OP_32_64(and):
+            if (c == 0)
+                return tcg_opt_gen_movi(s, opc, gen_args, dst, 0, bits);
+            /* masking bits which are already clear */
+            if ((temp_mask(s, x, bits) & ~c & wmask) == 0)
+                return tcg_opt_gen_mov(s, opc, gen_args, dst, x, bits);
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (temps_are_copies(s, x, y)) {
+        switch (op) {
+        CASE_OP_32_64(and):
+        CASE_OP_32_64(or):
+            return tcg_opt_gen_mov(s, opc, gen_args, dst, x, bits);
+        CASE_OP_32_64(sub):
+        CASE_OP_32_64(xor):
+            return tcg_opt_gen_movi(s, opc, gen_args, dst, 0, bits);
+        default:
+            break;
+        }
+    }
+
+    /* the op is kept: track the bits of its result */
+    mx = temp_mask(s, x, bits) & wmask;
+    my = temp_mask(s, y, bits) & wmask;
+    sx = temp_sext(s, x, bits);
+    sy = temp_sext(s, y, bits);
+    mask = -1;
+    sext = bits;
+    switch (op) {
+    CASE_OP_32_64(and):
+        mask = mx & my;
+        sext = sx > sy ? sx : sy;
+        break;
+    CASE_OP_32_64(or):
+    CASE_OP_32_64(xor):
+        mask = mx | my;
+        sext = sx > sy ? sx : sy;
+        break;
+    CASE_OP_32_64(shl):
+        if (is_const(s, y, bits)) {
+            c = temps[y].val & (bits - 1);
+            mask = mx << c;
+            sext = sx + c < bits ? sx + c : bits;
+        }
+        break;
+    CASE_OP_32_64(shr):
+        if (is_const(s, y, bits))
+            mask = mx >> (temps[y].val & (bits - 1));
+        break;
+    CASE_OP_32_64(sar):
+        if (is_const(s, y, bits)) {
+            c = temps[y].val & (bits - 1);
+            sext = sx > c + 1 ? sx - c : 1;
+            if (!((mx >> (bits - 1)) & 1))
+                mask = mx >> c;
+        }
+        break;
+    default:
+        break;
+    }
+    set_info(s, dst, mask, sext);
+    return 3;
+}
+
+static int tcg_opt_unary(TCGContext *s, uint16_t *opc, TCGArg *gen_args,
+                         int bits)
+{
+    int op = *opc;
+    TCGArg dst = gen_args[0], x = gen_args[1];
+    tcg_target_ulong mx;
+    int n, sx;
+
+    if (is_const(s, x, bits)) {
+        return tcg_opt_gen_movi(s, opc, gen_args, dst,
+                                do_constant_folding_2(op, temps[x].val, 0),
+                                bits);
+    }
+
+    mx = temp_mask(s, x, bits) & width_mask(bits);
+    sx = temp_sext(s, x, bits);
+    switch (op) {
+#ifdef TCG_TARGET_HAS_ext8s_i32
+    case INDEX_op_ext8s_i32:
+#endif
+#ifdef TCG_TARGET_HAS_ext8s_i64
+    case INDEX_op_ext8s_i64:
+#endif
+        n = 8;
+        goto do_ext;
+#ifdef TCG_TARGET_HAS_ext16s_i32
+    case INDEX_op_ext16s_i32:
+#endif
+#ifdef TCG_TARGET_HAS_ext16s_i64
+    case INDEX_op_ext16s_i64:
+#endif
+        n = 16;
+        goto do_ext;
+#ifdef TCG_TARGET_HAS_ext32s_i64
+    case INDEX_op_ext32s_i64:
+        n = 32;
+        goto do_ext;
+#endif
+    do_ext:
+        /* the value is already sign extended */
+        if (sx <= n)
+            return tcg_opt_gen_mov(s, opc, gen_args, dst, x, bits);
+        if ((mx >> (n - 1)) & 1)
+            mx = -1;
+        else
+            mx &= ((tcg_target_ulong)1 << n) - 1;
+        set_info(s, dst, mx, n);
+        break;
+#ifdef TCG_TARGET_HAS_not_i32
+    case INDEX_op_not_i32:
+#endif
+#ifdef TCG_TARGET_HAS_not_i64
+    case INDEX_op_not_i64:
+#endif
+        set_info(s, dst, -1, sx);
+        break;
+    default:
+        reset_temp(s, dst);
+        break;
+    }
+    return 2;
+}
+
+/* loads tell how their result is extended */
+static void tcg_opt_load_info(TCGContext *s, int op, TCGArg dst)
+{
+    switch (op) {
+    CASE_OP_32_64(ld8u):
+    case INDEX_op_qemu_ld8u:
+        set_info(s, dst, 0xff, 9);
+        break;
+    CASE_OP_32_64(ld8s):
+    case INDEX_op_qemu_ld8s:
+        set_info(s, dst, -1, 8);
+        break;
+    CASE_OP_32_64(ld16u):
+    case INDEX_op_qemu_ld16u:
+        set_info(s, dst, 0xffff, 17);
+        break;
+    CASE_OP_32_64(ld16s):
+    case INDEX_op_qemu_ld16s:
+        set_info(s, dst, -1, 16);
+        break;
+#if TCG_TARGET_REG_BITS == 64
+    case INDEX_op_ld32u_i64:
+#endif
+    case INDEX_op_qemu_ld32u:
+        set_info(s, dst, 0xffffffffu, 33);
+        break;
+#if TCG_TARGET_REG_BITS == 64
+    case INDEX_op_ld32s_i64:
+#endif
+    case INDEX_op_qemu_ld32s:
+        set_info(s, dst, -1, 32);
+        break;
+    default:
+        break;
+    }
+}
+
+/* Optimize the ops of gen_opc_buf up to 'tcg_opc_ptr', whose arguments
+   start at 'args'.  Return the new end of the arguments. */
+TCGArg *tcg_optimize(TCGContext *s, uint16_t *tcg_opc_ptr, TCGArg *args,
+                     TCGOpDef *tcg_op_defs)
+{
+    int i, op, op_index, nb_ops, nb_args, nb_oargs, nb_iargs, nb_gen;
+    int bits, dead_code, res;
+    const TCGOpDef *def;
+    uint16_t *opc;
+    TCGArg *gen_args;
+
+    reset_all_temps(s);
+
+    nb_ops = tcg_opc_ptr - gen_opc_buf;
+    gen_args = args;
+    dead_code = 0;
+    for (op_index = 0; op_index < nb_ops; op_index++) {
+        opc = &gen_opc_buf[op_index];
+        op = *opc;
+        def = &tcg_op_defs[op];
+        if (op == INDEX_op_call) {
+            nb_oargs = args[0] >> 16;
+            nb_iargs = args[0] & 0xffff;
+            nb_args = args[nb_oargs + nb_iargs + 2];
+        } else if (op == INDEX_op_nopn) {
+            nb_oargs = nb_iargs = 0;
+            nb_args = args[0];
+        } else {
+            nb_oargs = def->nb_oargs;
+            nb_iargs = def->nb_iargs;
+            nb_args = def->nb_args;
+        }
+
+        /* nothing after an unconditional jump is reached before the
+           next label */
+        if (dead_code) {
+            if (op == INDEX_op_set_label)
+                dead_code = 0;
+            else if (op != INDEX_op_debug_insn_start)
+                op = INDEX_op_nop;
+        }
+        switch (op) {
+        case INDEX_op_nop:
+        case INDEX_op_nop1:
+        case INDEX_op_nop2:
+        case INDEX_op_nop3:
+        case INDEX_op_nopn:
+            *opc = INDEX_op_nop;
+            args += nb_args;
+            continue;
+        default:
+            break;
+        }
+
+        for (i = 0; i < nb_args; i++)
+            gen_args[i] = args[i];
+        args += nb_args;
+        nb_gen = nb_args;
+        bits = def->flags & TCG_OPF_64BIT ? 64 : 32;
+
+        /* copy propagation */
+        if (op == INDEX_op_call) {
+            for (i = nb_oargs + 1; i < nb_oargs + nb_iargs + 1; i++) {
+                if (gen_args[i] != TCG_CALL_DUMMY_ARG &&
+                    temps[gen_args[i]].state == TCG_TEMP_COPY)
+                    gen_args[i] = find_better_copy(s, gen_args[i]);
+            }
+        } else {
+            for (i = nb_oargs; i < nb_oargs + nb_iargs; i++) {
+                if (temps[gen_args[i]].state == TCG_TEMP_COPY)
+                    gen_args[i] = find_better_copy(s, gen_args[i]);
+            }
+        }
+
+        switch (op) {
+        CASE_OP_32_64(mov):
+            nb_gen = tcg_opt_gen_mov(s, opc, gen_args,
+                                     gen_args[0], gen_args[1], bits);
+            break;
+        CASE_OP_32_64(movi):
+            nb_gen = tcg_opt_gen_movi(s, opc, gen_args,
+                                      gen_args[0], gen_args[1], bits);
+            break;
+        CASE_OP_32_64(add):
+        CASE_OP_32_64(sub):
+        CASE_OP_32_64(mul):
+        CASE_OP_32_64(and):
+        CASE_OP_32_64(or):
+        CASE_OP_32_64(xor):
+        CASE_OP_32_64(shl):
+        CASE_OP_32_64(shr):
+        CASE_OP_32_64(sar):
+#ifdef TCG_TARGET_HAS_rot_i32
+        case INDEX_op_rotl_i32:
+        case INDEX_op_rotr_i32:
+#endif
+#ifdef TCG_TARGET_HAS_rot_i64
+        case INDEX_op_rotl_i64:
+        case INDEX_op_rotr_i64:
+#endif
+            nb_gen = tcg_opt_binary(s, opc, gen_args, bits);
+            break;
+#ifdef TCG_TARGET_HAS_not_i32
+        case INDEX_op_not_i32:
+#endif
+#ifdef TCG_TARGET_HAS_not_i64
+        case INDEX_op_not_i64:
+#endif
+#ifdef TCG_TARGET_HAS_neg_i32
+        case INDEX_op_neg_i32:
+#endif
+#ifdef TCG_TARGET_HAS_neg_i64
+        case INDEX_op_neg_i64:
+#endif
+#ifdef TCG_TARGET_HAS_ext8s_i32
+        case INDEX_op_ext8s_i32:
+#endif
+#ifdef TCG_TARGET_HAS_ext8s_i64
+        case INDEX_op_ext8s_i64:
+#endif
+#ifdef TCG_TARGET_HAS_ext16s_i32
+        case INDEX_op_ext16s_i32:
+#endif
+#ifdef TCG_TARGET_HAS_ext16s_i64
+        case INDEX_op_ext16s_i64:
+#endif
+#ifdef TCG_TARGET_HAS_ext32s_i64
+        case INDEX_op_ext32s_i64:
+#endif
+            nb_gen = tcg_opt_unary(s, opc, gen_args, bits);
+            break;
+        CASE_OP_32_64(brcond):
+            res = -1;
+            if (is_const(s, gen_args[0], bits) &&
+                is_const(s, gen_args[1], bits)) {
+                res = do_constant_folding_cond(bits, temps[gen_args[0]].val,
+                                               temps[gen_args[1]].val,
+                                               gen_args[2]);
+            } else if (temps_are_copies(s, gen_args[0], gen_args[1])) {
+                res = do_constant_folding_cond(bits, 0, 0, gen_args[2]);
+            }
+            if (res == 0) {
+                /* never taken: the basic block goes on */
+                *opc = INDEX_op_nop;
+                nb_gen = 0;
+                break;
+            }
+            if (res == 1) {
+                *opc = INDEX_op_br;
+                gen_args[0] = gen_args[3];
+                nb_gen = 1;
+                dead_code = 1;
+            }
+            reset_all_temps(s);
+            break;
+        case INDEX_op_call:
+            for (i = 0; i < nb_oargs; i++)
+                reset_temp(s, gen_args[i + 1]);
+            /* unless told otherwise, helpers may modify any global */
+            if (!(gen_args[nb_oargs + nb_iargs + 1] &
+                  (TCG_CALL_PURE | TCG_CALL_NO_WRITE_GLOBALS |
+                   TCG_CALL_NO_READ_GLOBALS)))
+                reset_globals(s);
+            break;
+        case INDEX_op_set_label:
+            reset_all_temps(s);
+            break;
+        case INDEX_op_discard:
+            reset_temp(s, gen_args[0]);
+            break;
+        default:
+            for (i = 0; i < nb_oargs; i++)
+                reset_temp(s, gen_args[i]);
+            if (nb_oargs == 1)
+                tcg_opt_load_info(s, op, gen_args[0]);
+            if (def->flags & TCG_OPF_BB_END) {
+                reset_all_temps(s);
+                if (op == INDEX_op_br || op == INDEX_op_jmp ||
+                    op == INDEX_op_exit_tb)
+                    dead_code = 1;
+            }
+            break;
+        }
+        gen_args += nb_gen;
+    }
+    return gen_args;
+}
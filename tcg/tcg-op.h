@@ -1790,6 +1790,7 @@ static inline void tcg_gen_rotri_i64(TCGv_i64 ret, TCGv_i64 arg1, int64_t arg2)
 #define tcg_temp_new() tcg_temp_new_i32()
 #define tcg_global_reg_new tcg_global_reg_new_i32
 #define tcg_global_mem_new tcg_global_mem_new_i32
+#define tcg_global_pin tcg_global_pin_i32
 #define tcg_temp_local_new() tcg_temp_local_new_i32()
 #define tcg_temp_free tcg_temp_free_i32
 #define tcg_gen_qemu_ldst_op tcg_gen_op3i_i32
@@ -1801,6 +1802,7 @@ static inline void tcg_gen_rotri_i64(TCGv_i64 ret, TCGv_i64 arg1, int64_t arg2)
 #define tcg_temp_new() tcg_temp_new_i64()
 #define tcg_global_reg_new tcg_global_reg_new_i64
 #define tcg_global_mem_new tcg_global_mem_new_i64
+#define tcg_global_pin tcg_global_pin_i64
 #define tcg_temp_local_new() tcg_temp_local_new_i64()
 #define tcg_temp_free tcg_temp_free_i64
 #define tcg_gen_qemu_ldst_op tcg_gen_op3i_i64
@@ -1821,8 +1823,25 @@ static inline void tcg_gen_debug_insn_start(uint64_t pc)
 #endif
 }
 
+/* increment a 64 bit counter in host memory */
+static inline void tcg_gen_prof_inc(uint64_t *counter)
+{
+    TCGv_ptr ptr;
+    TCGv_i64 t;
+
+    ptr = tcg_const_ptr((tcg_target_long)counter);
+    t = tcg_temp_new_i64();
+    tcg_gen_ld_i64(t, ptr, 0);
+    tcg_gen_addi_i64(t, t, 1);
+    tcg_gen_st_i64(t, ptr, 0);
+    tcg_temp_free_i64(t);
+    tcg_temp_free_ptr(ptr);
+}
+
 static inline void tcg_gen_exit_tb(tcg_target_long val)
 {
+    if (tcg_ctx.prof_exits)
+        tcg_gen_prof_inc(tcg_ctx.prof_exits);
     tcg_gen_op1i(INDEX_op_exit_tb, val);
 }
 
@@ -259,7 +259,12 @@ void tcg_func_start(TCGContext *s)
         s->first_free_temp[i] = -1;
     s->labels = tcg_malloc(sizeof(TCGLabel) * TCG_MAX_LABELS);
     s->nb_labels = 0;
+#ifdef TCG_TARGET_QEMU_LDST_SLOW_PATH
+    s->qemu_ldst = tcg_malloc(sizeof(TCGLdstSlowPath) * TCG_MAX_QEMU_LDST);
+#endif
     s->current_frame_offset = s->frame_start;
+    s->prof_exits = NULL;
+    s->prof_helpers = NULL;
 
     gen_opc_ptr = gen_opc_buf;
     gen_opparam_ptr = gen_opparam_buf;
@@ -392,6 +397,52 @@ TCGv_i64 tcg_global_mem_new_i64(int reg, tcg_target_long offset,
     return MAKE_TCGV_I64(idx);
 }
 
+#ifdef TCG_TARGET_NB_PIN_REGS
+/* Keep a global of env in one of the host registers reserved by the
+   target for that purpose.  The prologue loads it each time generated
+   code is entered and chained TBs pass it along in the register.  The
+   memory slot is only written where generated code may be left: before
+   helper calls, in the qemu_ld/st slow paths and at exit_tb.  The
+   register is reloaded after helpers that may write globals.  Returns 0
+   if the global cannot be pinned. */
+static int tcg_global_pin_internal(int idx)
+{
+    TCGContext *s = &tcg_ctx;
+    TCGTemp *ts = &s->temps[idx];
+    int reg;
+
+    if (s->nb_pinned >= TCG_TARGET_NB_PIN_REGS ||
+        ts->fixed_reg || ts->mem_reg != TCG_AREG0)
+        return 0;
+    reg = tcg_target_pin_regs[s->nb_pinned];
+    tcg_target_pin_offsets[s->nb_pinned] = ts->mem_offset;
+    s->pinned_temps[s->nb_pinned++] = idx;
+    ts->fixed_reg = 1;
+    ts->pinned = 1;
+    ts->reg = reg;
+    tcg_regset_set_reg(s->reserved_regs, reg);
+    return 1;
+}
+#endif
+
+int tcg_global_pin_i32(TCGv_i32 arg)
+{
+#ifdef TCG_TARGET_NB_PIN_REGS
+    return tcg_global_pin_internal(GET_TCGV_I32(arg));
+#else
+    return 0;
+#endif
+}
+
+int tcg_global_pin_i64(TCGv_i64 arg)
+{
+#if defined(TCG_TARGET_NB_PIN_REGS) && TCG_TARGET_REG_BITS == 64
+    return tcg_global_pin_internal(GET_TCGV_I64(arg));
+#else
+    return 0;
+#endif
+}
+
 static inline int tcg_temp_new_internal(TCGType type, int temp_local)
 {
     TCGContext *s = &tcg_ctx;
@@ -548,6 +599,9 @@ void tcg_gen_callN(TCGContext *s, TCGv_ptr func, unsigned int flags,
     int real_args;
     int nb_rets;
     TCGArg *nparam;
+
+    if (s->prof_helpers)
+        tcg_gen_prof_inc(s->prof_helpers);
     *gen_opc_ptr++ = INDEX_op_call;
     nparam = gen_opparam_ptr++;
     call_type = (flags & TCG_CALL_TYPE_MASK);
@@ -672,15 +726,20 @@ static void tcg_reg_alloc_start(TCGContext *s)
         ts = &s->temps[i];
         if (ts->fixed_reg) {
             ts->val_type = TEMP_VAL_REG;
+            /* a pinned global may come from a chained TB that did not
+               store it */
+            ts->mem_coherent = !ts->pinned;
         } else {
             ts->val_type = TEMP_VAL_MEM;
         }
+        ts->next_use = TCG_NO_NEXT_USE;
     }
     for(i = s->nb_globals; i < s->nb_temps; i++) {
         ts = &s->temps[i];
         ts->val_type = TEMP_VAL_DEAD;
         ts->mem_allocated = 0;
         ts->fixed_reg = 0;
+        ts->next_use = TCG_NO_NEXT_USE;
     }
     for(i = 0; i < TCG_TARGET_NB_REGS; i++) {
         s->reg_to_temp[i] = -1;
@@ -1039,22 +1098,19 @@ static inline void tcg_set_nop(TCGContext *s, uint16_t *opc_ptr,
 
 /* liveness analysis: end of function: globals are live, temps are
    dead. */
-/* XXX: at this stage, not used as there would be little gains because
-   most TBs end with a conditional jump. */
 static inline void tcg_la_func_end(TCGContext *s, uint8_t *dead_temps)
 {
     memset(dead_temps, 0, s->nb_globals);
     memset(dead_temps + s->nb_globals, 1, s->nb_temps - s->nb_globals);
 }
 
-/* liveness analysis: end of basic block: globals are live, temps are
-   dead, local temps are live. */
+/* liveness analysis: end of basic block: temps are dead, local temps
+   are live. The globals are handled by the caller. */
 static inline void tcg_la_bb_end(TCGContext *s, uint8_t *dead_temps)
 {
     int i;
     TCGTemp *ts;
 
-    memset(dead_temps, 0, s->nb_globals);
     ts = &s->temps[s->nb_globals];
     for(i = s->nb_globals; i < s->nb_temps; i++) {
         if (ts->temp_local)
@@ -1065,15 +1121,72 @@ static inline void tcg_la_bb_end(TCGContext *s, uint8_t *dead_temps)
     }
 }
 
+/* return a copy of the dead state of the globals, or NULL if they are
+   all live */
+static uint8_t *tcg_la_dead_globals(TCGContext *s, const uint8_t *dead_temps)
+{
+    uint8_t *dead_globals;
+
+    if (!memchr(dead_temps, 1, s->nb_globals))
+        return NULL;
+    dead_globals = tcg_malloc(s->nb_globals);
+    memcpy(dead_globals, dead_temps, s->nb_globals);
+    return dead_globals;
+}
+
+/* label a basic block ending op may jump to, or -1 if it leaves the TB */
+static int tcg_op_label(int op, const TCGArg *args, const TCGOpDef *def)
+{
+    switch(op) {
+    case INDEX_op_br:
+    case INDEX_op_brcond_i32:
+#if TCG_TARGET_REG_BITS == 64
+    case INDEX_op_brcond_i64:
+#else
+    case INDEX_op_brcond2_i32:
+#endif
+        return args[def->nb_args - 1];
+    default:
+        return -1;
+    }
+}
+
+/* liveness analysis: record for each argument of an op where its value
+   is used next. Outputs are not used before this op, inputs are used
+   by it. */
+static inline void tcg_la_next_use(TCGContext *s, uint16_t *next_use,
+                                   const TCGArg *args, int nb_oargs,
+                                   int nb_iargs, int op_index)
+{
+    uint16_t *arg_next_use;
+    int i;
+    TCGArg arg;
+
+    arg_next_use = s->arg_next_use + (args - gen_opparam_buf);
+    for(i = 0; i < nb_oargs; i++) {
+        arg = args[i];
+        arg_next_use[i] = next_use[arg];
+        next_use[arg] = TCG_NO_NEXT_USE;
+    }
+    for(i = nb_oargs; i < nb_oargs + nb_iargs; i++) {
+        arg = args[i];
+        if (arg != TCG_CALL_DUMMY_ARG) {
+            arg_next_use[i] = next_use[arg];
+            next_use[arg] = op_index;
+        }
+    }
+}
+
 /* Liveness analysis : update the opc_dead_iargs array to tell if a
    given input arguments is dead. Instructions updating dead
    temporaries are removed. */
 static void tcg_liveness_analysis(TCGContext *s)
 {
-    int i, op_index, op, nb_args, nb_iargs, nb_oargs, arg, nb_ops;
+    int i, op_index, op, nb_args, nb_iargs, nb_oargs, arg, nb_ops, label;
     TCGArg *args;
     const TCGOpDef *def;
-    uint8_t *dead_temps;
+    uint8_t *dead_temps, **label_dead_globals;
+    uint16_t *next_use;
     unsigned int dead_iargs;
     
     gen_opc_ptr++; /* skip end */
@@ -1082,9 +1195,20 @@ static void tcg_liveness_analysis(TCGContext *s)
 
     /* XXX: make it really dynamic */
     s->op_dead_iargs = tcg_malloc(OPC_BUF_SIZE * sizeof(uint16_t));
+    s->op_dead_globals = tcg_malloc(OPC_BUF_SIZE * sizeof(uint8_t *));
+    s->arg_next_use = tcg_malloc((gen_opparam_ptr - gen_opparam_buf) *
+                                 sizeof(uint16_t));
     
     dead_temps = tcg_malloc(s->nb_temps);
-    memset(dead_temps, 1, s->nb_temps);
+    tcg_la_func_end(s, dead_temps);
+
+    next_use = tcg_malloc(s->nb_temps * sizeof(uint16_t));
+    memset(next_use, 0xff, s->nb_temps * sizeof(uint16_t));
+
+    /* dead globals at the start of each label, NULL until the label is
+       seen (i.e. for backward branches, all globals are live) */
+    label_dead_globals = tcg_malloc(s->nb_labels * sizeof(uint8_t *));
+    memset(label_dead_globals, 0, s->nb_labels * sizeof(uint8_t *));
 
     args = gen_opparam_ptr;
     op_index = nb_ops - 1;
@@ -1115,6 +1239,8 @@ static void tcg_liveness_analysis(TCGContext *s)
                                 args - 1, nb_args);
                 } else {
                 do_not_remove_call:
+                    tcg_la_next_use(s, next_use, args, nb_oargs, nb_iargs,
+                                    op_index);
 
                     /* output args are dead */
                     for(i = 0; i < nb_oargs; i++) {
@@ -1123,7 +1249,8 @@ static void tcg_liveness_analysis(TCGContext *s)
                     }
                     
                     /* globals are live (they may be used by the call) */
-                    memset(dead_temps, 0, s->nb_globals);
+                    if (!(call_flags & TCG_CALL_NO_READ_GLOBALS))
+                        memset(dead_temps, 0, s->nb_globals);
                     
                     /* input args are live */
                     dead_iargs = 0;
@@ -1143,8 +1270,12 @@ static void tcg_liveness_analysis(TCGContext *s)
             break;
         case INDEX_op_set_label:
             args--;
-            /* mark end of basic block */
+            /* mark end of basic block. The globals keep their state, as
+               the code after the label is reached from here. */
             tcg_la_bb_end(s, dead_temps);
+            memset(next_use, 0xff, s->nb_temps * sizeof(uint16_t));
+            s->op_dead_globals[op_index] = label_dead_globals[args[0]] =
+                tcg_la_dead_globals(s, dead_temps);
             break;
         case INDEX_op_debug_insn_start:
             args -= def->nb_args;
@@ -1157,6 +1288,7 @@ static void tcg_liveness_analysis(TCGContext *s)
             args--;
             /* mark the temporary as dead */
             dead_temps[args[0]] = 1;
+            next_use[args[0]] = TCG_NO_NEXT_USE;
             break;
         case INDEX_op_end:
             break;
@@ -1188,9 +1320,24 @@ static void tcg_liveness_analysis(TCGContext *s)
                     dead_temps[arg] = 1;
                 }
 
-                /* if end of basic block, update */
+                /* if end of basic block, update. A global is dead if it
+                   is overwritten before being read on every path
+                   leaving the block inside the TB. */
                 if (def->flags & TCG_OPF_BB_END) {
                     tcg_la_bb_end(s, dead_temps);
+                    memset(next_use, 0xff, s->nb_temps * sizeof(uint16_t));
+                    label = tcg_op_label(op, args, def);
+                    if (label < 0 || !label_dead_globals[label]) {
+                        memset(dead_temps, 0, s->nb_globals);
+                    } else if (op == INDEX_op_br) {
+                        memcpy(dead_temps, label_dead_globals[label],
+                               s->nb_globals);
+                    } else {
+                        for(i = 0; i < s->nb_globals; i++)
+                            dead_temps[i] &= label_dead_globals[label][i];
+                    }
+                    s->op_dead_globals[op_index] =
+                        tcg_la_dead_globals(s, dead_temps);
                 } else if (def->flags & TCG_OPF_CALL_CLOBBER) {
                     /* globals are live */
                     memset(dead_temps, 0, s->nb_globals);
@@ -1206,6 +1353,8 @@ static void tcg_liveness_analysis(TCGContext *s)
                     dead_temps[arg] = 0;
                 }
                 s->op_dead_iargs[op_index] = dead_iargs;
+                tcg_la_next_use(s, next_use, args, nb_oargs, nb_iargs,
+                                op_index);
             }
             break;
         }
@@ -1219,11 +1368,16 @@ static void tcg_liveness_analysis(TCGContext *s)
 /* dummy liveness analysis */
 void tcg_liveness_analysis(TCGContext *s)
 {
-    int nb_ops;
+    int nb_ops, nb_params;
     nb_ops = gen_opc_ptr - gen_opc_buf;
 
     s->op_dead_iargs = tcg_malloc(nb_ops * sizeof(uint16_t));
     memset(s->op_dead_iargs, 0, nb_ops * sizeof(uint16_t));
+    s->op_dead_globals = tcg_malloc(nb_ops * sizeof(uint8_t *));
+    memset(s->op_dead_globals, 0, nb_ops * sizeof(uint8_t *));
+    nb_params = gen_opparam_ptr - gen_opparam_buf;
+    s->arg_next_use = tcg_malloc(nb_params * sizeof(uint16_t));
+    memset(s->arg_next_use, 0xff, nb_params * sizeof(uint16_t));
 }
 #endif
 
@@ -1336,8 +1490,9 @@ static void tcg_reg_free(TCGContext *s, int reg)
 /* Allocate a register belonging to reg1 & ~reg2 */
 static int tcg_reg_alloc(TCGContext *s, TCGRegSet reg1, TCGRegSet reg2)
 {
-    int i, reg;
+    int i, reg, best_reg, cost, best_cost;
     TCGRegSet reg_ct;
+    TCGTemp *ts;
 
     tcg_regset_andnot(reg_ct, reg1, reg2);
 
@@ -1348,16 +1503,25 @@ static int tcg_reg_alloc(TCGContext *s, TCGRegSet reg1, TCGRegSet reg2)
             return reg;
     }
 
-    /* XXX: do better spill choice */
+    /* spill the register whose value is needed the latest, preferring
+       values which are already in memory */
+    best_reg = -1;
+    best_cost = -1;
     for(i = 0; i < ARRAY_SIZE(tcg_target_reg_alloc_order); i++) {
         reg = tcg_target_reg_alloc_order[i];
         if (tcg_regset_test_reg(reg_ct, reg)) {
-            tcg_reg_free(s, reg);
-            return reg;
+            ts = &s->temps[s->reg_to_temp[reg]];
+            cost = ts->next_use * 2 + ts->mem_coherent;
+            if (cost > best_cost) {
+                best_reg = reg;
+                best_cost = cost;
+            }
         }
     }
-
-    tcg_abort();
+    if (best_reg < 0)
+        tcg_abort();
+    tcg_reg_free(s, best_reg);
+    return best_reg;
 }
 
 /* save a temporary to memory. 'allocated_regs' is used in case a
@@ -1368,7 +1532,12 @@ static void temp_save(TCGContext *s, int temp, TCGRegSet allocated_regs)
     int reg;
 
     ts = &s->temps[temp];
-    if (!ts->fixed_reg) {
+    if (ts->pinned) {
+        if (!ts->mem_coherent) {
+            tcg_out_st(s, ts->type, ts->reg, ts->mem_reg, ts->mem_offset);
+            ts->mem_coherent = 1;
+        }
+    } else if (!ts->fixed_reg) {
         switch(ts->val_type) {
         case TEMP_VAL_REG:
             tcg_reg_free(s, ts->reg);
@@ -1405,9 +1574,47 @@ static void save_globals(TCGContext *s, TCGRegSet allocated_regs)
     }
 }
 
+#if defined(TCG_TARGET_NB_PIN_REGS) && defined(CONFIG_SOFTMMU)
+/* same as save_globals, for qemu_ld/st: pinned globals are stored by
+   the slow path, the only place where such an op can leave the TB. */
+static void save_unpinned_globals(TCGContext *s, TCGRegSet allocated_regs)
+{
+    int i;
+
+    for(i = 0; i < s->nb_globals; i++) {
+        if (!s->temps[i].pinned)
+            temp_save(s, i, allocated_regs);
+    }
+}
+#endif
+
+/* store globals to their canonical location but keep the registers
+   holding them valid, for helpers that do not modify globals. */
+static void sync_globals(TCGContext *s, TCGRegSet allocated_regs)
+{
+    TCGTemp *ts;
+    int i;
+
+    for(i = 0; i < s->nb_globals; i++) {
+        ts = &s->temps[i];
+        if (ts->val_type == TEMP_VAL_REG && !ts->fixed_reg) {
+            if (!ts->mem_coherent) {
+                tcg_out_st(s, ts->type, ts->reg, ts->mem_reg, ts->mem_offset);
+                ts->mem_coherent = 1;
+            }
+        } else {
+            temp_save(s, i, allocated_regs);
+        }
+    }
+}
+
 /* at the end of a basic block, we assume all temporaries are dead and
-   all globals are stored at their canonical location. */
-static void tcg_reg_alloc_bb_end(TCGContext *s, TCGRegSet allocated_regs)
+   all globals are stored at their canonical location, except those in
+   'dead_globals' which are overwritten before being read.  Pinned
+   globals stay in their register and are only stored when 'opc' leaves
+   the generated code. */
+static void tcg_reg_alloc_bb_end(TCGContext *s, TCGRegSet allocated_regs,
+                                 const uint8_t *dead_globals, int opc)
 {
     TCGTemp *ts;
     int i;
@@ -1424,7 +1631,38 @@ static void tcg_reg_alloc_bb_end(TCGContext *s, TCGRegSet allocated_regs)
         }
     }
 
-    save_globals(s, allocated_regs);
+    for(i = 0; i < s->nb_globals; i++) {
+        ts = &s->temps[i];
+        if (ts->pinned) {
+            if (opc == INDEX_op_exit_tb || opc == INDEX_op_jmp) {
+                temp_save(s, i, allocated_regs);
+            } else if (opc == INDEX_op_set_label) {
+                /* the memory slot is only known to be up to date on
+                   some of the incoming paths */
+                ts->mem_coherent = 0;
+            }
+        } else if (!dead_globals || !dead_globals[i]) {
+            temp_save(s, i, allocated_regs);
+        } else if (!ts->fixed_reg) {
+            if (ts->val_type == TEMP_VAL_REG)
+                s->reg_to_temp[ts->reg] = -1;
+            ts->val_type = TEMP_VAL_MEM;
+        }
+    }
+}
+
+/* remember where the temps of an op are used next, for spill choices */
+static inline void tcg_reg_alloc_next_use(TCGContext *s, const TCGArg *args,
+                                          int nb_args)
+{
+    const uint16_t *arg_next_use;
+    int i;
+
+    arg_next_use = s->arg_next_use + (args - gen_opparam_buf);
+    for(i = 0; i < nb_args; i++) {
+        if (args[i] != TCG_CALL_DUMMY_ARG)
+            s->temps[args[i]].next_use = arg_next_use[i];
+    }
 }
 
 #define IS_DEAD_IARG(n) ((dead_iargs >> (n)) & 1)
@@ -1436,11 +1674,13 @@ static void tcg_reg_alloc_movi(TCGContext *s, const TCGArg *args)
 
     ots = &s->temps[args[0]];
     val = args[1];
+    tcg_reg_alloc_next_use(s, args, 1);
 
     if (ots->fixed_reg) {
         /* for fixed registers, we do not do any constant
            propagation */
         tcg_out_movi(s, ots->type, ots->reg, val);
+        ots->mem_coherent = 0;
     } else {
         /* The movi is not explicitly generated here */
         if (ots->val_type == TEMP_VAL_REG)
@@ -1461,6 +1701,7 @@ static void tcg_reg_alloc_mov(TCGContext *s, const TCGOpDef *def,
     ots = &s->temps[args[0]];
     ts = &s->temps[args[1]];
     arg_ct = &def->args_ct[0];
+    tcg_reg_alloc_next_use(s, args, 2);
 
     /* XXX: always mark arg dead if IS_DEAD_IARG(0) */
     if (ts->val_type == TEMP_VAL_REG) {
@@ -1590,9 +1831,11 @@ static void tcg_reg_alloc_op(TCGContext *s,
         tcg_regset_set_reg(allocated_regs, reg);
     iarg_end: ;
     }
+    tcg_reg_alloc_next_use(s, args + nb_oargs, nb_iargs);
     
     if (def->flags & TCG_OPF_BB_END) {
-        tcg_reg_alloc_bb_end(s, allocated_regs);
+        tcg_reg_alloc_bb_end(s, allocated_regs,
+                             s->op_dead_globals[s->op_index], opc);
     } else {
         /* mark dead temporaries and free the associated registers */
         for(i = 0; i < nb_iargs; i++) {
@@ -1619,7 +1862,11 @@ static void tcg_reg_alloc_op(TCGContext *s,
             
             /* store globals and free associated registers (we assume the insn
                can modify any global. */
+#if defined(TCG_TARGET_NB_PIN_REGS) && defined(CONFIG_SOFTMMU)
+            save_unpinned_globals(s, allocated_regs);
+#else
             save_globals(s, allocated_regs);
+#endif
         }
         
         /* satisfy the output constraints */
@@ -1655,6 +1902,7 @@ static void tcg_reg_alloc_op(TCGContext *s,
         oarg_end:
             new_args[i] = reg;
         }
+        tcg_reg_alloc_next_use(s, args, nb_oargs);
     }
 
     /* emit instruction */
@@ -1664,8 +1912,11 @@ static void tcg_reg_alloc_op(TCGContext *s,
     for(i = 0; i < nb_oargs; i++) {
         ts = &s->temps[args[i]];
         reg = new_args[i];
-        if (ts->fixed_reg && ts->reg != reg) {
-            tcg_out_mov(s, ts->reg, reg);
+        if (ts->fixed_reg) {
+            if (ts->reg != reg) {
+                tcg_out_mov(s, ts->reg, reg);
+            }
+            ts->mem_coherent = 0;
         }
     }
 }
@@ -1695,6 +1946,7 @@ static int tcg_reg_alloc_call(TCGContext *s, const TCGOpDef *def,
     nb_params = nb_iargs - 1;
 
     flags = args[nb_oargs + nb_iargs];
+    tcg_reg_alloc_next_use(s, args, nb_oargs + nb_iargs);
 
     nb_regs = tcg_target_get_call_iarg_regs_count(flags);
     if (nb_regs > nb_params)
@@ -1819,9 +2071,15 @@ static int tcg_reg_alloc_call(TCGContext *s, const TCGOpDef *def,
         }
     }
     
-    /* store globals and free associated registers (we assume the call
-       can modify any global. */
-    save_globals(s, allocated_regs);
+    /* store globals and free associated registers (unless told
+       otherwise, we assume the call can modify any global) */
+    if (flags & TCG_CALL_NO_READ_GLOBALS) {
+        /* nothing to do */
+    } else if (flags & (TCG_CALL_NO_WRITE_GLOBALS | TCG_CALL_PURE)) {
+        sync_globals(s, allocated_regs);
+    } else {
+        save_globals(s, allocated_regs);
+    }
 
     tcg_out_op(s, opc, &func_arg, &const_func_arg);
     
@@ -1829,6 +2087,19 @@ static int tcg_reg_alloc_call(TCGContext *s, const TCGOpDef *def,
         tcg_out_addi(s, TCG_REG_CALL_STACK, STACK_DIR(call_stack_size));
     }
 
+#ifdef TCG_TARGET_NB_PIN_REGS
+    /* the helper may have modified any global */
+    if (!(flags & (TCG_CALL_NO_READ_GLOBALS | TCG_CALL_NO_WRITE_GLOBALS |
+                   TCG_CALL_PURE))) {
+        for(i = 0; i < s->nb_globals; i++) {
+            ts = &s->temps[i];
+            if (ts->pinned) {
+                tcg_out_ld(s, ts->type, ts->reg, ts->mem_reg, ts->mem_offset);
+            }
+        }
+    }
+#endif
+
     /* assign output registers and emit moves if needed */
     for(i = 0; i < nb_oargs; i++) {
         arg = args[i];
@@ -1839,6 +2110,7 @@ static int tcg_reg_alloc_call(TCGContext *s, const TCGOpDef *def,
             if (ts->reg != reg) {
                 tcg_out_mov(s, ts->reg, reg);
             }
+            ts->mem_coherent = 0;
         } else {
             if (ts->val_type == TEMP_VAL_REG)
                 s->reg_to_temp[ts->reg] = -1;
@@ -1885,6 +2157,17 @@ static inline int tcg_gen_code_common(TCGContext *s, uint8_t *gen_code_buf,
     }
 #endif
 
+    if (tcg_optimize_enabled) {
+#ifdef CONFIG_PROFILER
+        s->opt_time -= profile_getclock();
+#endif
+        gen_opparam_ptr = tcg_optimize(s, gen_opc_ptr, gen_opparam_buf,
+                                       tcg_op_defs);
+#ifdef CONFIG_PROFILER
+        s->opt_time += profile_getclock();
+#endif
+    }
+
 #ifdef CONFIG_PROFILER
     s->la_time -= profile_getclock();
 #endif
@@ -1902,15 +2185,21 @@ static inline int tcg_gen_code_common(TCGContext *s, uint8_t *gen_code_buf,
 #endif
 
     tcg_reg_alloc_start(s);
+    s->op_code_off = tcg_malloc((gen_opc_ptr - gen_opc_buf + 1) *
+                                sizeof(uint16_t));
 
     s->code_buf = gen_code_buf;
     s->code_ptr = gen_code_buf;
+#ifdef TCG_TARGET_QEMU_LDST_SLOW_PATH
+    s->nb_qemu_ldst = 0;
+#endif
 
     args = gen_opparam_buf;
     op_index = 0;
 
     for(;;) {
         opc = gen_opc_buf[op_index];
+        s->op_code_off[op_index] = s->code_ptr - gen_code_buf;
 #ifdef CONFIG_PROFILER
         tcg_table_op_count[opc]++;
 #endif
@@ -1958,7 +2247,9 @@ static inline int tcg_gen_code_common(TCGContext *s, uint8_t *gen_code_buf,
             }
             break;
         case INDEX_op_set_label:
-            tcg_reg_alloc_bb_end(s, s->reserved_regs);
+            tcg_reg_alloc_bb_end(s, s->reserved_regs,
+                                 s->op_dead_globals[op_index],
+                                 INDEX_op_set_label);
             tcg_out_label(s, args[0], (long)s->code_ptr);
             break;
         case INDEX_op_call:
@@ -1972,6 +2263,7 @@ static inline int tcg_gen_code_common(TCGContext *s, uint8_t *gen_code_buf,
                faster to have specialized register allocator functions for
                some common argument patterns */
             dead_iargs = s->op_dead_iargs[op_index];
+            s->op_index = op_index;
             tcg_reg_alloc_op(s, def, opc, args, dead_iargs);
             break;
         }
@@ -1986,6 +2278,19 @@ static inline int tcg_gen_code_common(TCGContext *s, uint8_t *gen_code_buf,
 #endif
     }
  the_end:
+#if defined(TCG_TARGET_QEMU_LDST_SLOW_PATH) && defined(CONFIG_SOFTMMU)
+    {
+        int i;
+
+        for (i = 0; i < s->nb_qemu_ldst; i++) {
+            s->qemu_ldst[i].code_off = s->code_ptr - gen_code_buf;
+            tcg_out_qemu_ldst_slow_path(s, &s->qemu_ldst[i]);
+            if (search_pc >= 0 && search_pc < s->code_ptr - gen_code_buf) {
+                return s->qemu_ldst[i].op_index;
+            }
+        }
+    }
+#endif
     return -1;
 }
 
@@ -2058,6 +2363,8 @@ void tcg_dump_info(FILE *f,
                 (double)s->interm_time / tot * 100.0);
     cpu_fprintf(f, "  gen_code time     %0.1f%%\n", 
                 (double)s->code_time / tot * 100.0);
+    cpu_fprintf(f, "optim./code time    %0.1f%%\n",
+                (double)s->opt_time / (s->code_time ? s->code_time : 1) * 100.0);
     cpu_fprintf(f, "liveness/code time  %0.1f%%\n", 
                 (double)s->la_time / (s->code_time ? s->code_time : 1) * 100.0);
     cpu_fprintf(f, "cpu_restore count   %" PRId64 "\n",
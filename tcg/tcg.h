@@ -78,6 +78,25 @@ typedef struct TCGLabel {
     } u;
 } TCGLabel;
 
+#ifdef TCG_TARGET_QEMU_LDST_SLOW_PATH
+/* TLB miss path of a qemu_ld/st op, emitted after the end of the TB */
+typedef struct TCGLdstSlowPath {
+    int is_ld;
+    int opc;
+    int data_reg;
+    int mem_index;
+    int op_index;       /* for tcg_gen_code_search_pc() */
+    uint16_t code_off;  /* start of the slow path in the TB */
+    uint8_t *label_ptr; /* branch to patch with the slow path address */
+    uint8_t *raddr;     /* where the fast path resumes */
+#ifdef TCG_TARGET_NB_PIN_REGS
+    int pin_dirty;      /* pinned globals to store before the call */
+#endif
+} TCGLdstSlowPath;
+
+#define TCG_MAX_QEMU_LDST 512
+#endif
+
 typedef struct TCGPool {
     struct TCGPool *next;
     int size;
@@ -178,6 +197,14 @@ typedef int TCGv_i64;
    cannot raise exceptions. Hence a call to a pure function can be
    safely suppressed if the return value is not used. */
 #define TCG_CALL_PURE           0x0010 
+/* The function does not modify globals.  They are stored to their
+   canonical location before the call but stay valid in registers. */
+#define TCG_CALL_NO_WRITE_GLOBALS 0x0020
+/* The function neither reads nor modifies globals, not even by raising
+   an exception.  Globals are left in registers across the call. */
+#define TCG_CALL_NO_READ_GLOBALS  0x0040
+/* A const function only depends on its arguments. */
+#define TCG_CALL_CONST          (TCG_CALL_PURE | TCG_CALL_NO_READ_GLOBALS)
 
 /* used to align parameters */
 #define TCG_CALL_DUMMY_TCGV     MAKE_TCGV_I32(-1)
@@ -197,6 +224,14 @@ typedef enum {
     TCG_COND_GTU,
 } TCGCond;
 
+/* conditions come in pairs of opposites */
+static inline TCGCond tcg_invert_cond(TCGCond c)
+{
+    return (TCGCond)(c ^ 1);
+}
+
+#define TCG_NO_NEXT_USE 0xffff
+
 #define TEMP_VAL_DEAD  0
 #define TEMP_VAL_REG   1
 #define TEMP_VAL_MEM   2
@@ -218,6 +253,11 @@ typedef struct TCGTemp {
                                   basic blocks. Otherwise, it is not
                                   preserved accross basic blocks. */
     unsigned int temp_allocated:1; /* never used for code gen */
+    unsigned int pinned:1; /* global kept in 'reg' across TBs, see
+                              tcg_global_pin_i32() */
+    /* index of the op reading this value next, TCG_NO_NEXT_USE if none
+       in the current basic block. Used to choose spill victims. */
+    uint16_t next_use;
     /* index of next free temp of same base type, -1 if end */
     int next_free_temp;
     const char *name;
@@ -235,6 +275,17 @@ struct TCGContext {
     TCGPool *pool_first, *pool_current;
     TCGLabel *labels;
     int nb_labels;
+
+#ifdef TCG_TARGET_QEMU_LDST_SLOW_PATH
+    TCGLdstSlowPath *qemu_ldst;
+    int nb_qemu_ldst;
+#endif
+    int op_index;       /* op being generated */
+#ifdef TCG_TARGET_NB_PIN_REGS
+    /* globals held in tcg_target_pin_regs[], in that order */
+    int nb_pinned;
+    int pinned_temps[TCG_TARGET_NB_PIN_REGS];
+#endif
     TCGTemp *temps; /* globals first, temps after */
     int nb_globals;
     int nb_temps;
@@ -250,6 +301,16 @@ struct TCGContext {
     /* liveness analysis */
     uint16_t *op_dead_iargs; /* for each operation, each bit tells if the
                                 corresponding input argument is dead */
+    uint16_t *op_code_off; /* offset of the host code of each operation */
+    uint16_t *arg_next_use; /* for each temp argument in gen_opparam_buf,
+                               index of the op using its value next */
+    uint8_t **op_dead_globals; /* for each basic block end, the globals
+                                  which need not be saved (NULL: none) */
+
+    /* if not NULL, counters incremented by the generated code at each
+       exit_tb and helper call (see tb_prof_enable()) */
+    uint64_t *prof_exits;
+    uint64_t *prof_helpers;
     
     /* tells in which temporary a given register is. It does not take
        into account fixed registers */
@@ -282,6 +343,7 @@ struct TCGContext {
     int64_t interm_time;
     int64_t code_time;
     int64_t la_time;
+    int64_t opt_time;
     int64_t restore_count;
     int64_t restore_time;
 #endif
@@ -337,10 +399,12 @@ static inline TCGv_i32 tcg_temp_local_new_i32(void)
 }
 void tcg_temp_free_i32(TCGv_i32 arg);
 char *tcg_get_arg_str_i32(TCGContext *s, char *buf, int buf_size, TCGv_i32 arg);
+int tcg_global_pin_i32(TCGv_i32 arg);
 
 TCGv_i64 tcg_global_reg_new_i64(int reg, const char *name);
 TCGv_i64 tcg_global_mem_new_i64(int reg, tcg_target_long offset,
                                 const char *name);
+int tcg_global_pin_i64(TCGv_i64 arg);
 TCGv_i64 tcg_temp_new_internal_i64(int temp_local);
 static inline TCGv_i64 tcg_temp_new_i64(void)
 {
@@ -378,6 +442,8 @@ typedef struct TCGArgConstraint {
 #define TCG_OPF_SIDE_EFFECTS 0x04 /* instruction has side effects : it
                                      cannot be removed if its output
                                      are not used */
+#define TCG_OPF_64BIT        0x08 /* instruction operates on 64 bit
+                                     values */
 
 typedef struct TCGOpDef {
     const char *name;
@@ -404,6 +470,9 @@ do {\
 
 void tcg_add_target_add_op_defs(const TCGTargetOpDef *tdefs);
 
+TCGArg *tcg_optimize(TCGContext *s, uint16_t *tcg_opc_ptr, TCGArg *args,
+                     TCGOpDef *tcg_op_defs);
+
 #if TCG_TARGET_REG_BITS == 32
 #define tcg_const_ptr tcg_const_i32
 #define tcg_add_ptr tcg_add_i32
@@ -78,6 +78,17 @@ static const int tcg_target_call_oarg_regs[2] = {
 
 static uint8_t *tb_ret_addr;
 
+/* Callee saved registers that hold pinned globals.  The prologue loads
+   them from env at the offsets recorded by tcg_global_pin_i64().  R12
+   and R15 are TCG_AREG2 and TCG_AREG1, which some targets use for their
+   own fixed globals, so they are left out. */
+static const int tcg_target_pin_regs[TCG_TARGET_NB_PIN_REGS] = {
+    TCG_REG_RBX,
+    TCG_REG_RBP,
+    TCG_REG_R13,
+};
+static tcg_target_long tcg_target_pin_offsets[TCG_TARGET_NB_PIN_REGS];
+
 static void patch_reloc(uint8_t *code_ptr, int type, 
                         tcg_target_long value, tcg_target_long addend)
 {
@@ -503,6 +514,116 @@ static void *qemu_st_helpers[4] = {
     __stl_mmu,
     __stq_mmu,
 };
+
+/* Record the TLB miss path of a qemu_ld/st op.  'label_ptr' is the rel32
+   field of the jne taken on a miss; the fast path resumes at the current
+   code pointer. */
+static void add_qemu_ldst_slow_path(TCGContext *s, int is_ld, int opc,
+                                    int data_reg, int mem_index,
+                                    uint8_t *label_ptr)
+{
+    TCGLdstSlowPath *l;
+    int i;
+
+    if (s->nb_qemu_ldst >= TCG_MAX_QEMU_LDST)
+        tcg_abort();
+    l = &s->qemu_ldst[s->nb_qemu_ldst++];
+    l->is_ld = is_ld;
+    l->opc = opc;
+    l->data_reg = data_reg;
+    l->mem_index = mem_index;
+    l->op_index = s->op_index;
+    l->label_ptr = label_ptr;
+    l->raddr = s->code_ptr;
+    l->pin_dirty = 0;
+    for (i = 0; i < s->nb_pinned; i++) {
+        if (!s->temps[s->pinned_temps[i]].mem_coherent)
+            l->pin_dirty |= 1 << i;
+    }
+}
+
+/* The guest address is in RDI, as left by the fast path. */
+static void tcg_out_qemu_ldst_slow_path(TCGContext *s, TCGLdstSlowPath *l)
+{
+    int data_reg = l->data_reg;
+    int i;
+
+    /* label1: */
+    *(uint32_t *)l->label_ptr = s->code_ptr - l->label_ptr - 4;
+
+    /* the helper may raise a guest exception: make env up to date */
+    for (i = 0; i < s->nb_pinned; i++) {
+        if (l->pin_dirty & (1 << i))
+            tcg_out_st(s, s->temps[s->pinned_temps[i]].type,
+                       tcg_target_pin_regs[i], TCG_AREG0,
+                       tcg_target_pin_offsets[i]);
+    }
+
+    if (l->is_ld) {
+        tcg_out_movi(s, TCG_TYPE_I32, TCG_REG_RSI, l->mem_index);
+        tcg_out8(s, 0xe8);
+        tcg_out32(s, (tcg_target_long)qemu_ld_helpers[l->opc & 3] -
+                  (tcg_target_long)s->code_ptr - 4);
+
+        switch(l->opc) {
+        case 0 | 4:
+            /* movsbq */
+            tcg_out_modrm(s, 0xbe | P_EXT | P_REXW, data_reg, TCG_REG_RAX);
+            break;
+        case 1 | 4:
+            /* movswq */
+            tcg_out_modrm(s, 0xbf | P_EXT | P_REXW, data_reg, TCG_REG_RAX);
+            break;
+        case 2 | 4:
+            /* movslq */
+            tcg_out_modrm(s, 0x63 | P_REXW, data_reg, TCG_REG_RAX);
+            break;
+        case 0:
+            /* movzbq */
+            tcg_out_modrm(s, 0xb6 | P_EXT | P_REXW, data_reg, TCG_REG_RAX);
+            break;
+        case 1:
+            /* movzwq */
+            tcg_out_modrm(s, 0xb7 | P_EXT | P_REXW, data_reg, TCG_REG_RAX);
+            break;
+        case 2:
+        default:
+            /* movl */
+            tcg_out_modrm(s, 0x8b, data_reg, TCG_REG_RAX);
+            break;
+        case 3:
+            tcg_out_mov(s, data_reg, TCG_REG_RAX);
+            break;
+        }
+    } else {
+        switch(l->opc) {
+        case 0:
+            /* movzbl */
+            tcg_out_modrm(s, 0xb6 | P_EXT | P_REXB, TCG_REG_RSI, data_reg);
+            break;
+        case 1:
+            /* movzwl */
+            tcg_out_modrm(s, 0xb7 | P_EXT, TCG_REG_RSI, data_reg);
+            break;
+        case 2:
+            /* movl */
+            tcg_out_modrm(s, 0x8b, TCG_REG_RSI, data_reg);
+            break;
+        default:
+        case 3:
+            tcg_out_mov(s, TCG_REG_RSI, data_reg);
+            break;
+        }
+        tcg_out_movi(s, TCG_TYPE_I32, TCG_REG_RDX, l->mem_index);
+        tcg_out8(s, 0xe8);
+        tcg_out32(s, (tcg_target_long)qemu_st_helpers[l->opc] -
+                  (tcg_target_long)s->code_ptr - 4);
+    }
+
+    /* jmp label2 */
+    tcg_out8(s, 0xe9);
+    tcg_out32(s, l->raddr - s->code_ptr - 4);
+}
 #endif
 
 static void tcg_out_qemu_ld(TCGContext *s, const TCGArg *args,
@@ -510,7 +631,7 @@ static void tcg_out_qemu_ld(TCGContext *s, const TCGArg *args,
 {
     int addr_reg, data_reg, r0, r1, mem_index, s_bits, bswap, rexw;
 #if defined(CONFIG_SOFTMMU)
-    uint8_t *label1_ptr, *label2_ptr;
+    uint8_t *label1_ptr;
 #endif
 
     data_reg = *args++;
@@ -539,8 +660,14 @@ static void tcg_out_qemu_ld(TCGContext *s, const TCGArg *args,
     tcg_out_modrm(s, 0x81 | rexw, 4, r0); /* andl $x, r0 */
     tcg_out32(s, TARGET_PAGE_MASK | ((1 << s_bits) - 1));
     
+#ifdef CPU_TLB_DYNAMIC
+    /* andl tlb_mask(env), r1 */
+    tcg_out_modrm_offset(s, 0x23, r1, TCG_AREG0,
+                         offsetof(CPUState, tlb_mask[mem_index]));
+#else
     tcg_out_modrm(s, 0x81, 4, r1); /* andl $x, r1 */
     tcg_out32(s, (CPU_TLB_SIZE - 1) << CPU_TLB_ENTRY_BITS);
+#endif
 
     /* lea offset(r1, env), r1 */
     tcg_out_modrm_offset2(s, 0x8d | P_REXW, r1, r1, TCG_AREG0, 0,
@@ -552,55 +679,11 @@ static void tcg_out_qemu_ld(TCGContext *s, const TCGArg *args,
     /* mov */
     tcg_out_modrm(s, 0x8b | rexw, r0, addr_reg);
     
-    /* je label1 */
-    tcg_out8(s, 0x70 + JCC_JE);
+    /* jne label1 */
+    tcg_out8(s, 0x0f);
+    tcg_out8(s, 0x80 + JCC_JNE);
     label1_ptr = s->code_ptr;
-    s->code_ptr++;
-
-    /* XXX: move that code at the end of the TB */
-    tcg_out_movi(s, TCG_TYPE_I32, TCG_REG_RSI, mem_index);
-    tcg_out8(s, 0xe8);
-    tcg_out32(s, (tcg_target_long)qemu_ld_helpers[s_bits] - 
-              (tcg_target_long)s->code_ptr - 4);
-
-    switch(opc) {
-    case 0 | 4:
-        /* movsbq */
-        tcg_out_modrm(s, 0xbe | P_EXT | P_REXW, data_reg, TCG_REG_RAX);
-        break;
-    case 1 | 4:
-        /* movswq */
-        tcg_out_modrm(s, 0xbf | P_EXT | P_REXW, data_reg, TCG_REG_RAX);
-        break;
-    case 2 | 4:
-        /* movslq */
-        tcg_out_modrm(s, 0x63 | P_REXW, data_reg, TCG_REG_RAX);
-        break;
-    case 0:
-        /* movzbq */
-        tcg_out_modrm(s, 0xb6 | P_EXT | P_REXW, data_reg, TCG_REG_RAX);
-        break;
-    case 1:
-        /* movzwq */
-        tcg_out_modrm(s, 0xb7 | P_EXT | P_REXW, data_reg, TCG_REG_RAX);
-        break;
-    case 2:
-    default:
-        /* movl */
-        tcg_out_modrm(s, 0x8b, data_reg, TCG_REG_RAX);
-        break;
-    case 3:
-        tcg_out_mov(s, data_reg, TCG_REG_RAX);
-        break;
-    }
-
-    /* jmp label2 */
-    tcg_out8(s, 0xeb);
-    label2_ptr = s->code_ptr;
-    s->code_ptr++;
-    
-    /* label1: */
-    *label1_ptr = s->code_ptr - label1_ptr - 1;
+    s->code_ptr += 4;
 
     /* add x(r1), r0 */
     tcg_out_modrm_offset(s, 0x03 | P_REXW, r0, r1, offsetof(CPUTLBEntry, addend) - 
@@ -684,7 +767,7 @@ static void tcg_out_qemu_ld(TCGContext *s, const TCGArg *args,
 
 #if defined(CONFIG_SOFTMMU)
     /* label2: */
-    *label2_ptr = s->code_ptr - label2_ptr - 1;
+    add_qemu_ldst_slow_path(s, 1, opc, data_reg, mem_index, label1_ptr);
 #endif
 }
 
@@ -693,7 +776,8 @@ static void tcg_out_qemu_st(TCGContext *s, const TCGArg *args,
 {
     int addr_reg, data_reg, r0, r1, mem_index, s_bits, bswap, rexw;
 #if defined(CONFIG_SOFTMMU)
-    uint8_t *label1_ptr, *label2_ptr;
+    uint8_t *label1_ptr;
+    int data_reg1;
 #endif
 
     data_reg = *args++;
@@ -723,8 +807,14 @@ static void tcg_out_qemu_st(TCGContext *s, const TCGArg *args,
     tcg_out_modrm(s, 0x81 | rexw, 4, r0); /* andl $x, r0 */
     tcg_out32(s, TARGET_PAGE_MASK | ((1 << s_bits) - 1));
     
+#ifdef CPU_TLB_DYNAMIC
+    /* andl tlb_mask(env), r1 */
+    tcg_out_modrm_offset(s, 0x23, r1, TCG_AREG0,
+                         offsetof(CPUState, tlb_mask[mem_index]));
+#else
     tcg_out_modrm(s, 0x81, 4, r1); /* andl $x, r1 */
     tcg_out32(s, (CPU_TLB_SIZE - 1) << CPU_TLB_ENTRY_BITS);
+#endif
 
     /* lea offset(r1, env), r1 */
     tcg_out_modrm_offset2(s, 0x8d | P_REXW, r1, r1, TCG_AREG0, 0,
@@ -736,42 +826,12 @@ static void tcg_out_qemu_st(TCGContext *s, const TCGArg *args,
     /* mov */
     tcg_out_modrm(s, 0x8b | rexw, r0, addr_reg);
     
-    /* je label1 */
-    tcg_out8(s, 0x70 + JCC_JE);
+    /* jne label1 */
+    tcg_out8(s, 0x0f);
+    tcg_out8(s, 0x80 + JCC_JNE);
     label1_ptr = s->code_ptr;
-    s->code_ptr++;
-
-    /* XXX: move that code at the end of the TB */
-    switch(opc) {
-    case 0:
-        /* movzbl */
-        tcg_out_modrm(s, 0xb6 | P_EXT | P_REXB, TCG_REG_RSI, data_reg);
-        break;
-    case 1:
-        /* movzwl */
-        tcg_out_modrm(s, 0xb7 | P_EXT, TCG_REG_RSI, data_reg);
-        break;
-    case 2:
-        /* movl */
-        tcg_out_modrm(s, 0x8b, TCG_REG_RSI, data_reg);
-        break;
-    default:
-    case 3:
-        tcg_out_mov(s, TCG_REG_RSI, data_reg);
-        break;
-    }
-    tcg_out_movi(s, TCG_TYPE_I32, TCG_REG_RDX, mem_index);
-    tcg_out8(s, 0xe8);
-    tcg_out32(s, (tcg_target_long)qemu_st_helpers[s_bits] - 
-              (tcg_target_long)s->code_ptr - 4);
-
-    /* jmp label2 */
-    tcg_out8(s, 0xeb);
-    label2_ptr = s->code_ptr;
-    s->code_ptr++;
-    
-    /* label1: */
-    *label1_ptr = s->code_ptr - label1_ptr - 1;
+    s->code_ptr += 4;
+    data_reg1 = data_reg;
 
     /* add x(r1), r0 */
     tcg_out_modrm_offset(s, 0x03 | P_REXW, r0, r1, offsetof(CPUTLBEntry, addend) - 
@@ -828,7 +888,7 @@ static void tcg_out_qemu_st(TCGContext *s, const TCGArg *args,
 
 #if defined(CONFIG_SOFTMMU)
     /* label2: */
-    *label2_ptr = s->code_ptr - label2_ptr - 1;
+    add_qemu_ldst_slow_path(s, 0, opc, data_reg1, mem_index, label1_ptr);
 #endif
 }
 
@@ -1202,6 +1262,7 @@ static inline void tcg_out_pop(TCGContext *s, int reg)
 void tcg_target_qemu_prologue(TCGContext *s)
 {
     int i, frame_size, push_size, stack_addend;
+    uint8_t *pin_skip[TCG_TARGET_NB_PIN_REGS];
 
     /* TB prologue */
     /* save all callee saved registers */
@@ -1217,6 +1278,28 @@ void tcg_target_qemu_prologue(TCGContext *s)
     stack_addend = frame_size - push_size;
     tcg_out_addi(s, TCG_REG_RSP, -stack_addend);
 
+    /* load the pinned globals.  The count and the offsets are read at
+       run time as globals are pinned after the prologue has been
+       generated. */
+    tcg_out_movi(s, TCG_TYPE_PTR, TCG_REG_RCX, (tcg_target_long)&s->nb_pinned);
+    tcg_out_ld(s, TCG_TYPE_I32, TCG_REG_RCX, TCG_REG_RCX, 0);
+    tcg_out_movi(s, TCG_TYPE_PTR, TCG_REG_RAX,
+                 (tcg_target_long)tcg_target_pin_offsets);
+    for(i = 0; i < TCG_TARGET_NB_PIN_REGS; i++) {
+        tgen_arithi32(s, ARITH_CMP, TCG_REG_RCX, i);
+        tcg_out8(s, 0x0f); /* jle pin_done */
+        tcg_out8(s, 0x80 + JCC_JLE);
+        pin_skip[i] = s->code_ptr;
+        s->code_ptr += 4;
+        tcg_out_ld(s, TCG_TYPE_I64, TCG_REG_RDX, TCG_REG_RAX, i * 8);
+        tcg_out_modrm(s, 0x01 | P_REXW, TCG_AREG0, TCG_REG_RDX); /* add */
+        tcg_out_ld(s, TCG_TYPE_I64, tcg_target_pin_regs[i], TCG_REG_RDX, 0);
+    }
+    /* pin_done: */
+    for(i = 0; i < TCG_TARGET_NB_PIN_REGS; i++) {
+        *(uint32_t *)pin_skip[i] = s->code_ptr - pin_skip[i] - 4;
+    }
+
     tcg_out_modrm(s, 0xff, 4, TCG_REG_RDI); /* jmp *%rdi */
     
     /* TB epilogue */
@@ -73,6 +73,12 @@ enum {
 #define TCG_TARGET_HAS_rot_i32
 #define TCG_TARGET_HAS_rot_i64
 
+/* qemu_ld/st TLB miss paths are emitted after the end of the TB */
+#define TCG_TARGET_QEMU_LDST_SLOW_PATH
+
+/* number of host registers available to tcg_global_pin_i64() */
+#define TCG_TARGET_NB_PIN_REGS 3
+
 /* Note: must be synced with dyngen-exec.h */
 #define TCG_AREG0 TCG_REG_R14
 #define TCG_AREG1 TCG_REG_R15
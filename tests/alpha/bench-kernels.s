@@ -0,0 +1,176 @@
+/* Inner loops of the ES40 micro-benchmarks (see bench.c).
+
+   They are written in assembly so that the number of instructions per
+   iteration does not depend on the compiler; bench.c knows these counts.
+   Every kernel takes the iteration count in $16 and returns a checksum
+   in $0.  */
+
+	.set	noreorder
+	.text
+
+/* long kern_int (long iters): 13 insns per iteration.  */
+	.align	4
+	.globl	kern_int
+	.ent	kern_int
+kern_int:
+	.frame	$30,0,$26
+	.prologue 0
+	lda	$0, 1($31)
+	lda	$1, 3($31)
+	lda	$2, 5($31)
+1:	addq	$0, $1, $3
+	subq	$2, $0, $4
+	mulq	$3, $4, $5
+	sll	$5, 3, $6
+	srl	$3, 7, $7
+	xor	$6, $7, $1
+	and	$1, $5, $2
+	bis	$2, $4, $3
+	cmpult	$3, $1, $4
+	s8addq	$4, $0, $0
+	addq	$0, $3, $0
+	subq	$16, 1, $16
+	bne	$16, 1b
+	ret
+	.end	kern_int
+
+/* long kern_byte (long iters, long seed): 14 insns per iteration.  */
+	.align	4
+	.globl	kern_byte
+	.ent	kern_byte
+kern_byte:
+	.frame	$30,0,$26
+	.prologue 0
+	mov	$17, $1
+1:	extbl	$1, 3, $2
+	insbl	$2, 5, $3
+	mskbl	$1, 1, $4
+	zapnot	$1, 0x0f, $5
+	cmpbge	$1, $3, $6
+	extwl	$1, 2, $7
+	extqh	$1, $2, $8
+	bis	$3, $4, $1
+	xor	$1, $5, $1
+	addq	$1, $6, $1
+	addq	$1, $7, $1
+	addq	$1, $8, $1
+	subq	$16, 1, $16
+	bne	$16, 1b
+	mov	$1, $0
+	ret
+	.end	kern_byte
+
+/* long kern_fp (long iters): 12 insns per iteration.  Both recurrences
+   converge to 2.0, so no exception is ever raised.  */
+	.align	4
+	.globl	kern_fp
+	.ent	kern_fp
+kern_fp:
+	.frame	$30,0,$26
+	.prologue 0
+	lda	$1, 1($31)
+	lda	$2, 2($31)
+	itoft	$1, $f11
+	itoft	$2, $f12
+	cvtqt	$f11, $f11		/* 1.0 */
+	cvtqt	$f12, $f12
+	divt	$f11, $f12, $f10	/* 0.5 */
+	cpys	$f12, $f12, $f13	/* x = 2.0 */
+	cpys	$f31, $f31, $f14	/* y = 0.0 */
+	cpys	$f31, $f31, $f17
+1:	mult	$f13, $f10, $f15
+	addt	$f15, $f11, $f13
+	mult	$f14, $f10, $f16
+	addt	$f16, $f11, $f14
+	subt	$f13, $f14, $f18
+	addt	$f17, $f18, $f17
+	cmptlt	$f13, $f14, $f19
+	cvttq/c	$f14, $f20
+	mult	$f13, $f13, $f21
+	divt	$f21, $f13, $f22
+	subq	$16, 1, $16
+	bne	$16, 1b
+	ftoit	$f22, $0
+	ret
+	.end	kern_fp
+
+/* long kern_branch (long iters, long seed): 12 insns and 5 branches per
+   iteration, whichever way the data-dependent branches go.  */
+	.align	4
+	.globl	kern_branch
+	.ent	kern_branch
+kern_branch:
+	.frame	$30,0,$26
+	.prologue 0
+	mov	$17, $1
+	mov	$31, $0
+1:	s4addq	$1, $1, $1
+	addq	$1, 1, $1
+	srl	$1, 17, $2
+	blbc	$2, 2f
+	addq	$0, 1, $0
+	br	$31, 3f
+2:	subq	$0, 1, $0
+	br	$31, 3f
+3:	srl	$1, 29, $2
+	blbc	$2, 4f
+	xor	$0, $1, $0
+	br	$31, 5f
+4:	addq	$0, $1, $0
+	br	$31, 5f
+5:	subq	$16, 1, $16
+	bne	$16, 1b
+	ret
+	.end	kern_branch
+
+/* long kern_walk (unsigned long base, long pages, long rounds): touch one
+   quadword in each of PAGES consecutive 8K pages from BASE, ROUNDS times.
+   5 insns per access.  */
+	.align	4
+	.globl	kern_walk
+	.ent	kern_walk
+kern_walk:
+	.frame	$30,0,$26
+	.prologue 0
+	mov	$31, $0
+1:	mov	$16, $1
+	mov	$17, $2
+2:	ldq	$3, 0($1)
+	addq	$0, $3, $0
+	lda	$1, 8192($1)
+	subq	$2, 1, $2
+	bne	$2, 2b
+	subq	$18, 1, $18
+	bne	$18, 1b
+	ret
+	.end	kern_walk
+
+/* long kern_pal (long iters): one rduniq PAL call per iteration.  */
+	.align	4
+	.globl	kern_pal
+	.ent	kern_pal
+kern_pal:
+	.frame	$30,0,$26
+	.prologue 0
+	mov	$16, $1
+1:	call_pal 0x9e
+	subq	$1, 1, $1
+	bne	$1, 1b
+	ret
+	.end	kern_pal
+
+/* long kern_mmio (unsigned long addr, long iters): one byte read of the
+   I/O register at ADDR per iteration.  */
+	.align	4
+	.globl	kern_mmio
+	.ent	kern_mmio
+kern_mmio:
+	.frame	$30,0,$26
+	.prologue 0
+	mov	$31, $0
+1:	ldbu	$1, 0($16)
+	addq	$0, $1, $0
+	subq	$17, 1, $17
+	bne	$17, 1b
+	ret
+	.end	kern_mmio
@@ -0,0 +1,264 @@
+/* Micro-benchmarks for the alpha-softmmu hot paths.
+
+   This is linked into a bare-metal ES40 image together with pal-es40.s
+   (see the "bench" target of the Makefile) and run with -M es40 by
+   run-bench.sh.  The results are printed on COM1 as
+
+     bench,ticks-per-sec,TPS
+     bench,result,NAME,OPS,UNIT,TICKS,OPS_PER_SEC
+
+   where TICKS are cycle counter ticks and TPS is the cycle counter rate
+   measured against the RTC.  */
+
+extern long write (int fd, const void *buf, unsigned long len);
+
+extern long kern_int (long iters);
+extern long kern_byte (long iters, long seed);
+extern long kern_fp (long iters);
+extern long kern_branch (long iters, long seed);
+extern long kern_walk (unsigned long base, long pages, long rounds);
+extern long kern_pal (long iters);
+extern long kern_mmio (unsigned long addr, long iters);
+
+#define KSEG		0xfffffc0000000000UL
+#define IO_BASE		(KSEG + 0x101fc000000UL)	/* Hose 0 PCI I/O.  */
+#define PAGE_SIZE	8192
+
+/* The PAL DTB miss handler maps TLB_VBASE onto TLB_PBASE (16MB).  */
+#define TLB_VBASE	0x200000000UL
+#define TLB_PBASE	0x800000UL
+
+#define COM1_LSR	0x3fd
+#define RTC_INDEX	0x70
+#define RTC_DATA	0x71
+
+/* Instructions per iteration of the kernels in bench-kernels.s.  */
+#define INT_INSNS	13
+#define BYTE_INSNS	14
+#define FP_INSNS	12
+#define BRANCH_INSNS	12
+
+/* Length of the blocks the translation benchmark rewrites.  */
+#define GEN_INSNS	64
+
+static unsigned int code_buf[PAGE_SIZE / 4] __attribute__ ((aligned (PAGE_SIZE)));
+
+static unsigned long tick_total;
+static unsigned int tick_last;
+static volatile long sink;
+
+/* The cycle counter is only 32 bits wide; extend it.  This must be
+   called more often than the counter wraps.  */
+static unsigned long
+ticks (void)
+{
+  unsigned long cc;
+  unsigned int now;
+
+  asm volatile ("rpcc %0" : "=r" (cc));
+  now = cc;
+  tick_total += (unsigned int) (now - tick_last);
+  tick_last = now;
+  return tick_total;
+}
+
+static void
+outb (unsigned int port, unsigned char val)
+{
+  *(volatile unsigned char *) (IO_BASE + port) = val;
+}
+
+static unsigned char
+inb (unsigned int port)
+{
+  return *(volatile unsigned char *) (IO_BASE + port);
+}
+
+static void
+put_str (const char *s)
+{
+  unsigned long len;
+
+  for (len = 0; s[len]; len++)
+    ;
+  write (1, s, len);
+}
+
+static void
+put_dec (unsigned long v)
+{
+  char buf[24];
+  int i = sizeof (buf);
+
+  do
+    {
+      buf[--i] = '0' + v % 10;
+      v /= 10;
+    }
+  while (v);
+  write (1, buf + i, sizeof (buf) - i);
+}
+
+static unsigned int
+rtc_seconds (void)
+{
+  outb (RTC_INDEX, 0);
+  return inb (RTC_DATA);
+}
+
+/* Count the cycle counter ticks in one RTC second.  */
+static unsigned long
+calibrate (void)
+{
+  unsigned int s;
+  unsigned long start;
+
+  s = rtc_seconds ();
+  while (rtc_seconds () == s)
+    ticks ();
+  start = ticks ();
+  s = rtc_seconds ();
+  while (rtc_seconds () == s)
+    ticks ();
+  return ticks () - start;
+}
+
+static long
+run_int (long n, long arg)
+{
+  return kern_int (n);
+}
+
+static long
+run_byte (long n, long arg)
+{
+  return kern_byte (n, arg);
+}
+
+static long
+run_fp (long n, long arg)
+{
+  return kern_fp (n);
+}
+
+static long
+run_branch (long n, long arg)
+{
+  return kern_branch (n, arg);
+}
+
+static long
+run_tlb_dtb (long n, long pages)
+{
+  return kern_walk (TLB_VBASE, pages, n);
+}
+
+static long
+run_tlb_kseg (long n, long pages)
+{
+  return kern_walk (KSEG + TLB_PBASE, pages, n);
+}
+
+static long
+run_pal (long n, long arg)
+{
+  return kern_pal (n);
+}
+
+static long
+run_mmio (long n, long reg)
+{
+  return kern_mmio (IO_BASE + reg, n);
+}
+
+/* Rewrite and call a GEN_INSNS block N times.  Every call finds the
+   block modified and has to translate it again.  */
+static long
+run_translate (long n, long arg)
+{
+  long (*fn) (long) = (long (*) (long)) code_buf;
+  long i, sum = 0;
+
+  for (i = 1; i < GEN_INSNS - 1; i++)
+    code_buf[i] = 0x40100400;			/* addq $0,$16,$0 */
+  code_buf[GEN_INSNS - 1] = 0x6bfa8001;		/* ret */
+  for (i = 0; i < n; i++)
+    {
+      code_buf[0] = 0x201f0000 | (i & 0x7fff);	/* lda $0,i($31) */
+      asm volatile ("call_pal 0x86" : : : "memory");	/* imb */
+      sum += fn (arg);
+    }
+  return sum;
+}
+
+struct bench
+{
+  const char *name;
+  const char *unit;
+  long (*run) (long n, long arg);
+  long arg;
+  long n;		/* Work per call of RUN...  */
+  long calls;		/* ...kept short so that ticks () sees every wrap.  */
+  long ops;		/* UNITs per N.  */
+};
+
+static const struct bench benches[] =
+{
+  { "int", "insn", run_int, 0, 200000, 50, INT_INSNS },
+  { "byte", "insn", run_byte, 0x0123456789abcdefL, 200000, 50, BYTE_INSNS },
+  { "fp", "insn", run_fp, 0, 100000, 50, FP_INSNS },
+  { "branch", "insn", run_branch, 12345, 100000, 50, BRANCH_INSNS },
+  { "tlb-dtb-16", "access", run_tlb_dtb, 16, 10000, 20, 16 },
+  { "tlb-dtb-128", "access", run_tlb_dtb, 128, 1250, 20, 128 },
+  { "tlb-dtb-512", "access", run_tlb_dtb, 512, 300, 20, 512 },
+  { "tlb-dtb-2048", "access", run_tlb_dtb, 2048, 80, 20, 2048 },
+  { "tlb-kseg-16", "access", run_tlb_kseg, 16, 10000, 20, 16 },
+  { "tlb-kseg-128", "access", run_tlb_kseg, 128, 1250, 20, 128 },
+  { "tlb-kseg-512", "access", run_tlb_kseg, 512, 300, 20, 512 },
+  { "tlb-kseg-2048", "access", run_tlb_kseg, 2048, 80, 20, 2048 },
+  { "pal", "call", run_pal, 0, 50000, 20, 1 },
+  { "mmio", "access", run_mmio, COM1_LSR, 20000, 20, 1 },
+  { "translate", "tb", run_translate, 1, 2000, 20, 1 },
+};
+
+int
+main (void)
+{
+  unsigned long tps, start, t, ops;
+  const struct bench *b;
+  long i;
+
+  ticks ();
+  tps = calibrate ();
+  put_str ("bench,ticks-per-sec,");
+  put_dec (tps);
+  put_str ("\n");
+
+  for (b = benches; b < benches + sizeof (benches) / sizeof (benches[0]); b++)
+    {
+      /* Warm up: translate the code and fill the TLBs.  */
+      sink += b->run (1, b->arg);
+
+      start = ticks ();
+      for (i = 0; i < b->calls; i++)
+        {
+          sink += b->run (b->n, b->arg);
+          ticks ();
+        }
+      t = ticks () - start;
+      ops = b->ops * b->n * b->calls;
+
+      put_str ("bench,result,");
+      put_str (b->name);
+      put_str (",");
+      put_dec (ops);
+      put_str (",");
+      put_str (b->unit);
+      put_str (",");
+      put_dec (t);
+      put_str (",");
+      put_dec (t ? ops * tps / t : 0);
+      put_str ("\n");
+    }
+  return 0;
+}
@@ -0,0 +1,231 @@
+/* Minimal 21264 PALcode for the ES40 benchmark images.
+
+   The image built from this file is loaded at physical address 0 with
+   -bios, so it doubles as the SRM ROM.  It only provides what the
+   benchmarks need: enable the KSEG superpage, the cycle counter and the
+   FPU, jump to the program linked at KSEG + 1MB in kernel mode, and serve
+   callsys (write, exit), rduniq/wruniq and single DTB misses.  The DTB
+   miss handler maps the window at TLB_VBASE onto physical memory at
+   TLB_PBASE so that the TLB benchmarks take real guest TLB misses.
+
+   Shadow registers are enabled, so $4-$7 and $20-$23 are free PAL
+   temporaries.  */
+
+	.set	noat
+	.set	noreorder
+
+/* 21264 PAL instructions, encoded by hand so that any assembler will do.  */
+	.macro	mfpr	ra, ipr
+	.long	(0x19 << 26) | (\ra << 21) | (31 << 16) | (\ipr << 8)
+	.endm
+	.macro	mtpr	rb, ipr
+	.long	(0x1d << 26) | (\rb << 21) | (\rb << 16) | (\ipr << 8)
+	.endm
+	.macro	hw_ret	rb
+	.long	(0x1e << 26) | (31 << 21) | (\rb << 16) | (2 << 14)
+	.endm
+	.macro	hw_ldq_p	ra, disp, rb
+	.long	(0x1b << 26) | (\ra << 21) | (\rb << 16) | (1 << 12) | (\disp & 0xfff)
+	.endm
+	.macro	hw_stq_p	ra, disp, rb
+	.long	(0x1f << 26) | (\ra << 21) | (\rb << 16) | (1 << 12) | (\disp & 0xfff)
+	.endm
+
+/* Internal processor registers.  */
+	.set	EXC_ADDR, 0x06
+	.set	IER_CM, 0x0b
+	.set	PAL_BASE, 0x10
+	.set	I_CTL, 0x11
+	.set	DTB_TAG0, 0x20
+	.set	DTB_PTE0, 0x21
+	.set	M_CTL, 0x28
+	.set	PCTX_FPE, 0x50
+	.set	CC_CTL, 0xc1
+	.set	VA, 0xc2
+
+/* I_CTL: shadow registers, KSEG superpage (43 bit), icache enabled.  */
+	.set	I_CTL_INIT, (1 << 7) | (2 << 3) | (3 << 1)
+/* M_CTL: KSEG superpage for the D-stream.  */
+	.set	M_CTL_INIT, 2 << 1
+
+/* KSEG is 0xfffffc0000000000, -(1 << 42).  The Typhoon PCI I/O space of
+   hose 0 is at physical 0x801fc000000, which KSEG reaches through the
+   physical address bit 40 -> 43 sign extension.  */
+	.set	IO_SHIFT, 26
+	.set	IO_BASE, 0x407f			/* 0x101fc000000 >> 26 */
+	.set	COM1, 0x3f8
+
+	.set	PROG_BASE, 0x10			/* 1MB, in units of 64K */
+	.set	STACK_TOP, 0x40			/* 4MB, in units of 64K */
+
+	.set	TLB_VBASE, 2			/* 0x200000000, in units of 4G */
+	.set	TLB_PBASE, 0x80			/* 8MB, in units of 64K */
+	.set	TLB_PTE_FL, 0x1100		/* KRE | KWE */
+
+/* Physical scratch quadword holding the unique value.  */
+	.set	PAL_UNIQ, 0x7ff8
+
+	.text
+	.globl	pal_base
+pal_base:
+
+	.macro	vector	offset
+	.org	\offset
+	lda	$4, \offset($31)
+	br	$31, pal_fault
+	.endm
+
+	vector	0x0200			/* FEN */
+	vector	0x0280			/* UNALIGN */
+
+	.org	0x0300	/* DTBM_SINGLE */
+	mfpr	$4, VA
+	srl	$4, 32, $5
+	cmpeq	$5, TLB_VBASE, $5
+	beq	$5, dtbm_fault
+	zapnot	$4, 0x07, $5		/* Offset in the 16MB window.  */
+	ldah	$5, TLB_PBASE($5)
+	srl	$5, 13, $5
+	sll	$5, 32, $5
+	lda	$5, TLB_PTE_FL($5)
+	mtpr	$4, DTB_TAG0
+	mtpr	$5, DTB_PTE0
+	mfpr	$4, EXC_ADDR
+	hw_ret	4
+dtbm_fault:
+	lda	$4, 0x300($31)
+	br	$31, pal_fault
+
+	vector	0x0380			/* DFAULT */
+	vector	0x0400			/* OPCDEC */
+	vector	0x0480			/* IACV */
+	vector	0x0500			/* MCHK */
+	vector	0x0580			/* ITB_MISS */
+	vector	0x0600			/* ARITH */
+	vector	0x0680			/* INTERRUPT */
+	vector	0x0700			/* MT_FPCR */
+
+	.org	0x0800
+
+/* write (fd, buf, len): copy LEN bytes at BUF to COM1.  */
+pal_write:
+	mov	$17, $5
+	addq	$17, $18, $6
+1:	cmpult	$5, $6, $4
+	beq	$4, 2f
+	ldbu	$20, 0($5)
+	bsr	$23, pal_putc
+	addq	$5, 1, $5
+	br	$31, 1b
+2:	mov	$18, $0
+	mfpr	$4, EXC_ADDR
+	hw_ret	4
+
+/* exit (status): report the status and stop.  */
+pal_exit:
+	lda	$7, exit_msg - pal_base($31)
+	bsr	$23, pal_puts
+	mov	$16, $5
+	bsr	$7, pal_puthex
+	br	$31, pal_stop
+
+/* Unexpected exception: report the vector ($4) and EXC_ADDR, and stop.  */
+pal_fault:
+	mov	$4, $5
+	lda	$7, fault_msg - pal_base($31)
+	bsr	$23, pal_puts
+	bsr	$7, pal_puthex
+	lda	$20, 44($31)		/* ',' */
+	bsr	$23, pal_putc
+	mfpr	$5, EXC_ADDR
+	bsr	$7, pal_puthex
+pal_stop:
+	lda	$20, 10($31)		/* '\n' */
+	bsr	$23, pal_putc
+1:	br	$31, 1b
+
+/* Print the NUL-terminated string at physical address $7.
+   Return through $23; clobbers $4, $20-$22.  */
+pal_puts:
+	mov	$23, $4
+1:	bic	$7, 7, $21
+	hw_ldq_p	20, 0, 21
+	extbl	$20, $7, $20
+	beq	$20, 2f
+	bsr	$23, pal_putc
+	addq	$7, 1, $7
+	br	$31, 1b
+2:	ret	$31, ($4)
+
+/* Print $5 as 16 hex digits.
+   Return through $7; clobbers $5, $6, $20-$23.  */
+pal_puthex:
+	lda	$6, 16($31)
+1:	srl	$5, 60, $20
+	sll	$5, 4, $5
+	cmpult	$20, 10, $21
+	addq	$20, 48, $20		/* '0' */
+	bne	$21, 2f
+	addq	$20, 39, $20		/* 'a' - '0' - 10 */
+2:	bsr	$23, pal_putc
+	subq	$6, 1, $6
+	bne	$6, 1b
+	ret	$31, ($7)
+
+/* Send $20 to COM1 once the transmitter holding register is empty.
+   Return through $23; clobbers $21, $22.  */
+pal_putc:
+	lda	$21, -1($31)
+	sll	$21, 42, $21
+	lda	$22, IO_BASE($31)
+	sll	$22, IO_SHIFT, $22
+	addq	$21, $22, $21
+1:	ldbu	$22, COM1 + 5($21)
+	and	$22, 0x20, $22
+	beq	$22, 1b
+	stb	$20, COM1($21)
+	ret	$31, ($23)
+
+exit_msg:
+	.asciz	"bench,exit,"
+fault_msg:
+	.asciz	"bench,fault,"
+
+	.org	0x30c0	/* callsys */
+	cmpeq	$0, 4, $4
+	bne	$4, pal_write
+	cmpeq	$0, 1, $4
+	bne	$4, pal_exit
+	lda	$0, -1($31)
+	mfpr	$4, EXC_ADDR
+	hw_ret	4
+
+	.org	0x3780	/* rduniq */
+	lda	$4, PAL_UNIQ($31)
+	hw_ldq_p	0, 0, 4
+	mfpr	$4, EXC_ADDR
+	hw_ret	4
+
+	.org	0x37c0	/* wruniq */
+	lda	$4, PAL_UNIQ($31)
+	hw_stq_p	16, 0, 4
+	mfpr	$4, EXC_ADDR
+	hw_ret	4
+
+	.org	0x8000	/* Reset.  */
+	lda	$1, I_CTL_INIT($31)
+	mtpr	$1, I_CTL
+	lda	$1, M_CTL_INIT($31)
+	mtpr	$1, M_CTL
+	mtpr	$31, IER_CM
+	lda	$1, 1($31)
+	sll	$1, 32, $1
+	mtpr	$1, CC_CTL
+	lda	$1, 4($31)
+	mtpr	$1, PCTX_FPE
+	lda	$30, -1($31)
+	sll	$30, 42, $30
+	ldah	$1, PROG_BASE($30)
+	ldah	$30, STACK_TOP($30)
+	hw_ret	1
+
@@ -0,0 +1,45 @@
+#!/bin/sh
+# Run the ES40 micro-benchmark image and print its results as CSV.
+#
+# usage: run-bench.sh [QEMU [ROM]]
+#
+# Extra emulator options can be given in QEMU_OPTS.  The exit status is
+# non-zero if the image faults or does not finish within BENCH_TIMEOUT
+# seconds.
+
+qemu=${1:-../../alpha-softmmu/qemu-system-alpha}
+rom=${2:-bench.rom}
+timeout=${BENCH_TIMEOUT:-600}
+log=${TMPDIR:-/tmp}/bench-alpha.$$
+
+: > $log
+$qemu -M es40 -L "$(dirname "$rom")" -bios "$(basename "$rom")" \
+    -nographic -monitor null -serial file:$log $QEMU_OPTS > /dev/null 2>&1 &
+pid=$!
+
+status=1
+elapsed=0
+while kill -0 $pid 2> /dev/null; do
+    if grep -q '^bench,exit,0*$' $log; then
+        status=0
+        break
+    fi
+    if grep -Eq '^bench,(exit|fault),' $log; then
+        break
+    fi
+    if [ $elapsed -ge $timeout ]; then
+        echo "run-bench: timed out after $timeout seconds" >&2
+        break
+    fi
+    sleep 1
+    elapsed=$((elapsed + 1))
+done
+kill $pid 2> /dev/null
+wait $pid 2> /dev/null
+
+sed -n 's/^bench,ticks-per-sec,/# ticks_per_sec=/p' $log
+echo "name,ops,unit,ticks,ops_per_sec"
+sed -n 's/^bench,result,//p' $log
+grep -E '^bench,(exit|fault),' $log >&2
+rm -f $log
+exit $status
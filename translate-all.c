@@ -29,7 +29,7 @@
 #include "cpu.h"
 #include "exec-all.h"
 #include "disas.h"
-#include "tcg.h"
+#include "tcg-op.h"
 
 /* code generation context */
 TCGContext tcg_ctx;
@@ -60,11 +60,107 @@ unsigned long code_gen_max_block_size(void)
 #include "tcg-opc.h"
 #undef DEF
         max *= OPC_MAX_SIZE;
+#ifdef TARGET_HAS_PC_MAP
+        max += TB_PC_MAP_MAX_SIZE;
+#endif
     }
 
     return max;
 }
 
+#ifdef TARGET_HAS_PC_MAP
+static uint8_t *encode_sleb128(uint8_t *p, long val)
+{
+    int more;
+
+    do {
+        more = val >= 64 || val < -64;
+        *p++ = (val & 0x7f) | (more << 7);
+        val >>= 7;
+    } while (more);
+    return p;
+}
+
+static const uint8_t *decode_sleb128(const uint8_t *p, long *pval)
+{
+    long val = 0;
+    int shift = 0;
+    uint8_t byte;
+
+    do {
+        byte = *p++;
+        val |= (long)(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    if (shift < sizeof(long) * 8 && (byte & 0x40))
+        val |= -1L << shift;
+    *pval = val;
+    return p;
+}
+
+/* Append one entry to the pc map at 'p', as deltas from 'prev' which is
+   updated.  Returns NULL if the map would exceed TB_PC_MAP_MAX_SIZE.  */
+static uint8_t *tb_pc_map_add(uint8_t *p, uint8_t *map, long *prev,
+                              long host_off, long pc_off, long icount)
+{
+    /* an entry takes at most 3 * 10 bytes */
+    if (p + 30 > map + TB_PC_MAP_MAX_SIZE)
+        return NULL;
+    p = encode_sleb128(p, host_off - prev[0]);
+    p = encode_sleb128(p, pc_off - prev[1]);
+    p = encode_sleb128(p, icount - prev[2]);
+    prev[0] = host_off;
+    prev[1] = pc_off;
+    prev[2] = icount;
+    return p;
+}
+
+/* Store the pc map of 'tb' right after its 'code_size' bytes of host
+   code and return its size in bytes.  */
+static int tb_gen_pc_map(TCGContext *s, TranslationBlock *tb, int code_size)
+{
+    uint8_t *map, *p;
+    long prev[3] = { 0, 0, 0 };
+    int j, nb_ops, n;
+
+    tb->pc_map = NULL;
+    tb->pc_map_size = 0;
+    map = tb->tc_ptr + code_size;
+    p = map;
+    n = 0;
+    nb_ops = gen_opc_ptr - gen_opc_buf;
+    for (j = 0; j < nb_ops; j++) {
+        if (!gen_opc_instr_start[j])
+            continue;
+        p = tb_pc_map_add(p, map, prev, s->op_code_off[j],
+                          gen_opc_pc[j] - tb->pc, gen_opc_icount[j]);
+        if (!p)
+            return 0;
+        n++;
+    }
+    if (n == 0)
+        return 0;
+#if defined(TCG_TARGET_QEMU_LDST_SLOW_PATH) && defined(CONFIG_SOFTMMU)
+    /* TLB miss paths are emitted after the end of the TB */
+    for (j = 0; j < s->nb_qemu_ldst; j++) {
+        int op_index = s->qemu_ldst[j].op_index;
+
+        while (op_index > 0 && !gen_opc_instr_start[op_index])
+            op_index--;
+        p = tb_pc_map_add(p, map, prev, s->qemu_ldst[j].code_off,
+                          gen_opc_pc[op_index] - tb->pc,
+                          gen_opc_icount[op_index]);
+        if (!p)
+            return 0;
+        n++;
+    }
+#endif
+    tb->pc_map = map;
+    tb->pc_map_size = n;
+    return p - map;
+}
+#endif
+
 void cpu_gen_init(void)
 {
     tcg_context_init(&tcg_ctx); 
@@ -72,6 +168,18 @@ void cpu_gen_init(void)
                   CPU_TEMP_BUF_NLONGS * sizeof(long));
 }
 
+/* make the code of 'tb' update its execution profile, if it has one.
+   This must be done the same way when translating the TB again to
+   restore the CPU state.  */
+static void gen_tb_prof_start(TCGContext *s, TranslationBlock *tb)
+{
+    if (tb->prof) {
+        s->prof_exits = &tb->prof->exits;
+        s->prof_helpers = &tb->prof->helpers;
+        tcg_gen_prof_inc(&tb->prof->entries);
+    }
+}
+
 /* return non zero if the very first instruction is invalid so that
    the virtual CPU can trigger an exception.
 
@@ -93,8 +201,11 @@ int cpu_gen_code(CPUState *env, TranslationBlock *tb, int *gen_code_size_ptr)
     ti = profile_getclock();
 #endif
     tcg_func_start(s);
+    gen_tb_prof_start(s, tb);
 
     gen_intermediate_code(env, tb);
+    if (tb->prof)
+        tb->prof->icount = tb->icount;
 
     /* generate machine code */
     gen_code_buf = tb->tc_ptr;
@@ -120,6 +231,9 @@ int cpu_gen_code(CPUState *env, TranslationBlock *tb, int *gen_code_size_ptr)
 #endif
     gen_code_size = tcg_gen_code(s, gen_code_buf);
     *gen_code_size_ptr = gen_code_size;
+#ifdef TARGET_HAS_PC_MAP
+    *gen_code_size_ptr += tb_gen_pc_map(s, tb, gen_code_size);
+#endif
 #ifdef CONFIG_PROFILER
     s->code_time += profile_getclock();
     s->code_in_len += tb->size;
@@ -128,8 +242,8 @@ int cpu_gen_code(CPUState *env, TranslationBlock *tb, int *gen_code_size_ptr)
 
 #ifdef DEBUG_DISAS
     if (qemu_loglevel_mask(CPU_LOG_TB_OUT_ASM)) {
-        qemu_log("OUT: [size=%d]\n", *gen_code_size_ptr);
-        log_disas(tb->tc_ptr, *gen_code_size_ptr);
+        qemu_log("OUT: [size=%d]\n", gen_code_size);
+        log_disas(tb->tc_ptr, gen_code_size);
         qemu_log("\n");
         qemu_log_flush();
     }
@@ -152,8 +266,41 @@ int cpu_restore_state(TranslationBlock *tb,
 
 #ifdef CONFIG_PROFILER
     ti = profile_getclock();
+#endif
+#ifdef TARGET_HAS_PC_MAP
+    if (tb->pc_map) {
+        const uint8_t *p = tb->pc_map;
+        long cur[3] = { 0, 0, 0 }, found[3] = { 0, 0, 0 }, delta;
+        int k;
+
+        tc_ptr = (unsigned long)tb->tc_ptr;
+        if (searched_pc < tc_ptr || searched_pc >= (unsigned long)p)
+            return -1;
+        /* last instruction starting at or before searched_pc */
+        for (j = 0; j < tb->pc_map_size; j++) {
+            for (k = 0; k < 3; k++) {
+                p = decode_sleb128(p, &delta);
+                cur[k] += delta;
+            }
+            if (j > 0 && cur[0] > searched_pc - tc_ptr)
+                break;
+            memcpy(found, cur, sizeof(found));
+        }
+        if (use_icount) {
+            env->icount_decr.u16.low += tb->icount - found[2];
+            env->can_do_io = 0;
+        }
+        gen_opc_pc[0] = tb->pc + found[1];
+        gen_pc_load(env, tb, searched_pc, 0, puc);
+#ifdef CONFIG_PROFILER
+        s->restore_time += profile_getclock() - ti;
+        s->restore_count++;
+#endif
+        return 0;
+    }
 #endif
     tcg_func_start(s);
+    gen_tb_prof_start(s, tb);
 
     gen_intermediate_code_pc(env, tb);
 
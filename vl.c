@@ -66,6 +66,7 @@
 #ifdef __linux__
 #include <pty.h>
 #include <malloc.h>
+#include <sys/vfs.h>
 #include <linux/rtc.h>
 
 /* For the benefit of older linux systems which don't supply it,
@@ -159,6 +160,7 @@ int main(int argc, char **argv)
 #include "exec-all.h"
 
 #include "qemu_socket.h"
+#include "replay.h"
 
 #if defined(CONFIG_SLIRP)
 #include "libslirp.h"
@@ -192,6 +194,7 @@ const char *bios_name = NULL;
 static void *ioport_opaque[MAX_IOPORTS];
 static IOPortReadFunc *ioport_read_table[3][MAX_IOPORTS];
 static IOPortWriteFunc *ioport_write_table[3][MAX_IOPORTS];
+static IOPortDataFunc *ioport_data_table[MAX_IOPORTS];
 /* Note: drives_table[MAX_DRIVES] is a dummy block driver if none available
    to store the VM snapshots */
 DriveInfo drives_table[MAX_DRIVES+1];
@@ -205,6 +208,8 @@ static int sdl;
 const char* keyboard_layout = NULL;
 int64_t ticks_per_sec;
 ram_addr_t ram_size;
+static const char *mem_path = NULL;
+static int mem_prealloc = 0;
 int nb_nics;
 NICInfo nd_table[MAX_NICS];
 int vm_running;
@@ -408,6 +413,24 @@ int register_ioport_write(int start, int length, int size,
     return 0;
 }
 
+/* Declare FIFO-style data ports whose accesses can be served directly
+   from the device buffer by cpu_in_data/cpu_out_data.  The read and write
+   handlers must still be registered: they are used for the accesses that
+   have side effects, such as the one that ends a transfer.  */
+int register_ioport_data(int start, int length,
+                         IOPortDataFunc *func, void *opaque)
+{
+    int i;
+
+    for(i = start; i < start + length; i++) {
+        ioport_data_table[i] = func;
+        if (ioport_opaque[i] != NULL && ioport_opaque[i] != opaque)
+            hw_error("register_ioport_data: invalid opaque");
+        ioport_opaque[i] = opaque;
+    }
+    return 0;
+}
+
 void isa_unassign_ioport(int start, int length)
 {
     int i;
@@ -421,6 +444,7 @@ void isa_unassign_ioport(int start, int length)
         ioport_write_table[1][i] = default_ioport_writew;
         ioport_write_table[2][i] = default_ioport_writel;
 
+        ioport_data_table[i] = NULL;
         ioport_opaque[i] = NULL;
     }
 }
@@ -493,6 +517,61 @@ int cpu_inl(CPUState *env, int addr)
     return val;
 }
 
+/* Streaming 16 or 32 bits accesses to data ports.  The data is a little
+   endian byte stream.  Return 0 when the access must go through
+   cpu_inw/cpu_inl (or cpu_outw/cpu_outl).  */
+static uint8_t *ioport_data_ptr(int addr, int size, uint8_t ***pcur)
+{
+    IOPortDataFunc *func;
+    uint8_t **cur, *end;
+
+    if (addr < 0 || addr >= MAX_IOPORTS)
+        return NULL;
+    func = ioport_data_table[addr];
+    if (!func)
+        return NULL;
+    cur = func(ioport_opaque[addr], addr, &end);
+    /* Leave the last access of the transfer to the device.  */
+    if (!cur || *cur + size >= end)
+        return NULL;
+    *pcur = cur;
+    return *cur;
+}
+
+int cpu_in_data(int addr, int size, uint32_t *val)
+{
+    uint8_t **cur, *p;
+
+    p = ioport_data_ptr(addr, size, &cur);
+    if (!p)
+        return 0;
+    if (size == 4)
+        *val = cpu_to_le32(*(uint32_t *)p);
+    else
+        *val = cpu_to_le16(*(uint16_t *)p);
+    *cur = p + size;
+    LOG_IOPORT("in%c : %04x %0*x\n", size == 4 ? 'l' : 'w',
+               addr, size * 2, *val);
+    return 1;
+}
+
+int cpu_out_data(int addr, int size, uint32_t val)
+{
+    uint8_t **cur, *p;
+
+    p = ioport_data_ptr(addr, size, &cur);
+    if (!p)
+        return 0;
+    LOG_IOPORT("out%c: %04x %0*x\n", size == 4 ? 'l' : 'w',
+               addr, size * 2, val);
+    if (size == 4)
+        *(uint32_t *)p = le32_to_cpu(val);
+    else
+        *(uint16_t *)p = le16_to_cpu(val);
+    *cur = p + size;
+    return 1;
+}
+
 /***********************************************************/
 void hw_error(const char *fmt, ...)
 {
@@ -807,6 +886,18 @@ static int64_t cpu_get_icount(void)
     return qemu_icount_bias + (icount << icount_time_shift);
 }
 
+/* Return the number of instructions executed so far, which is what
+   record/replay uses as its time base.  */
+int64_t replay_get_icount(void)
+{
+    CPUState *env = cpu_single_env;
+    int64_t icount = qemu_icount;
+
+    if (env)
+        icount -= (env->icount_decr.u16.low + env->icount_extra);
+    return icount;
+}
+
 /***********************************************************/
 /* guest cycle counter */
 
@@ -1823,6 +1914,7 @@ void qemu_get_timedate(struct tm *tm, int offset)
     }
 
     memcpy(tm, ret, sizeof(struct tm));
+    replay_timedate(tm);
 }
 
 int qemu_timedate_diff(struct tm *tm)
@@ -3704,6 +3796,8 @@ void main_loop_wait(int timeout)
     int ret, nfds;
     struct timeval tv;
 
+    replay_phase = REPLAY_PHASE_IO;
+
     qemu_bh_update_timeout(&timeout);
 
     host_main_loop_wait(&timeout);
@@ -3773,20 +3867,39 @@ void main_loop_wait(int timeout)
         slirp_select_poll(&rfds, &wfds, &xfds);
     }
 #endif
+    replay_checkpoint(REPLAY_PHASE_IO);
 
     /* vm time timers */
+    replay_phase = REPLAY_PHASE_TIMERS;
     if (vm_running && likely(!(cur_cpu->singlestep_enabled & SSTEP_NOTIMER)))
         qemu_run_timers(&active_timers[QEMU_TIMER_VIRTUAL],
                         qemu_get_clock(vm_clock));
 
     /* real time timers */
+    replay_phase = REPLAY_PHASE_BH;
     qemu_run_timers(&active_timers[QEMU_TIMER_REALTIME],
                     qemu_get_clock(rt_clock));
 
     /* Check bottom-halves last in case any of the earlier events triggered
        them.  */
-    qemu_bh_poll();
+    replay_bh_poll();
+    replay_checkpoint(REPLAY_PHASE_BH);
+    replay_phase = REPLAY_PHASE_CPU;
+}
+
+/* Work that must happen however we exit: the monitor "quit" command
+   calls exit() directly and never returns through main_loop().  */
+static void qemu_exit_flush(void)
+{
+    static int done;
 
+    if (done)
+        return;
+    done = 1;
+    /* Let devices push out buffered state (e.g. pending serial output) */
+    vm_stop(0);
+    tb_cache_save();
+    replay_close();
 }
 
 static int main_loop(void)
@@ -3817,6 +3930,13 @@ static int main_loop(void)
                     count = qemu_next_deadline();
                     count = (count + (1 << icount_time_shift) - 1)
                             >> icount_time_shift;
+                    /* Stop where the next recorded input arrives.  */
+                    if (replay_mode == REPLAY_PLAY
+                        && count > replay_next_event() - qemu_icount) {
+                        count = replay_next_event() - qemu_icount;
+                        if (count < 0)
+                            count = 0;
+                    }
                     qemu_icount += count;
                     decr = (count > 0xffff) ? 0xffff : count;
                     count -= decr;
@@ -3910,7 +4030,7 @@ static int main_loop(void)
                               >> icount_time_shift;
                         qemu_icount += add;
                         timeout = delta / 1000000;
-                        if (timeout < 0)
+                        if (timeout < 0 || replay_mode == REPLAY_PLAY)
                             timeout = 0;
                     }
                 } else {
@@ -4211,6 +4331,96 @@ static int qemu_uuid_parse(const char *str, uint8_t *uuid)
 
 #ifndef _WIN32
 
+#define HUGETLBFS_MAGIC       0x958458f6
+
+/* Back guest RAM with a file.  If PATH is a directory (typically a
+   hugetlbfs mount) an anonymous file is created in it, otherwise PATH
+   must be an existing file at least as large as RAM; it is opened
+   read-only and mapped privately so that instances started from the
+   same image share the pages they do not modify.  Returns NULL on
+   failure, in which case the caller falls back to qemu_vmalloc.  */
+static void *file_ram_alloc(ram_addr_t size, const char *path)
+{
+    struct stat st;
+    char *filename;
+    void *area;
+    int fd, flags, touch;
+    unsigned long page_size = getpagesize();
+#ifdef __linux__
+    struct statfs fs;
+#endif
+
+    if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+        filename = qemu_malloc(strlen(path) + 32);
+        sprintf(filename, "%s/qemu_back_mem.XXXXXX", path);
+        fd = mkstemp(filename);
+        if (fd < 0) {
+            perror("mkstemp");
+            qemu_free(filename);
+            return NULL;
+        }
+        unlink(filename);
+        qemu_free(filename);
+        flags = MAP_SHARED;
+    } else {
+        fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            perror(path);
+            return NULL;
+        }
+        flags = MAP_PRIVATE;
+    }
+
+#ifdef __linux__
+    if (fstatfs(fd, &fs) == 0 && fs.f_type == HUGETLBFS_MAGIC)
+        page_size = fs.f_bsize;
+#endif
+    size = (size + page_size - 1) & ~(ram_addr_t)(page_size - 1);
+
+    if (fstat(fd, &st) < 0) {
+        perror("fstat");
+        close(fd);
+        return NULL;
+    }
+    if (st.st_size < size) {
+        if (flags == MAP_PRIVATE) {
+            fprintf(stderr, "qemu: %s is smaller than guest RAM "
+                    "(%" PRIu64 " bytes)\n", path, (uint64_t)size);
+            close(fd);
+            return NULL;
+        }
+        if (ftruncate(fd, size) < 0) {
+            perror("ftruncate");
+            close(fd);
+            return NULL;
+        }
+    }
+
+    /* Populating a writable private mapping would break copy-on-write
+       on every page, so the image is only prefaulted for reading.  */
+    touch = mem_prealloc;
+#ifdef MAP_POPULATE
+    if (touch && flags == MAP_SHARED) {
+        flags |= MAP_POPULATE;
+        touch = 0;
+    }
+#endif
+    area = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, fd, 0);
+    close(fd);
+    if (area == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    if (touch) {
+        volatile uint8_t *p = area;
+        ram_addr_t offset;
+
+        for (offset = 0; offset < size; offset += page_size)
+            (void)p[offset];
+    }
+    return area;
+}
+
 static void termsig_handler(int signal)
 {
     qemu_system_shutdown_request();
@@ -4266,6 +4476,11 @@ int main(int argc, char **argv, char **envp)
     int usb_devices_index;
     int fds[2];
     int tb_size;
+    const char *tb_cache_file = NULL;
+    const char *replay_file = NULL;
+    int replay_file_mode = REPLAY_NONE;
+    char tb_cache_config[128];
+    int perf_map = 0, jitdump = 0;
     const char *pid_file = NULL;
     const char *incoming = NULL;
     int fd = 0;
@@ -4921,11 +5136,46 @@ int main(int argc, char **argv, char **envp)
                     }
                 }
                 break;
+#ifndef _WIN32
+            case QEMU_OPTION_mempath:
+                mem_path = optarg;
+                break;
+            case QEMU_OPTION_mem_prealloc:
+                mem_prealloc = 1;
+                break;
+#endif
             case QEMU_OPTION_tb_size:
                 tb_size = strtol(optarg, NULL, 0);
                 if (tb_size < 0)
                     tb_size = 0;
                 break;
+            case QEMU_OPTION_tb_cache:
+                tb_cache_file = optarg;
+                break;
+            case QEMU_OPTION_no_tcg_opt:
+                tcg_optimize_enabled = 0;
+                break;
+            case QEMU_OPTION_perfmap:
+                perf_map = 1;
+                break;
+            case QEMU_OPTION_jitdump:
+                jitdump = 1;
+                break;
+            case QEMU_OPTION_sysmap:
+                if (load_symbol_map(optarg) < 0) {
+                    fprintf(stderr, "Could not read symbols from %s\n",
+                            optarg);
+                    exit(1);
+                }
+                break;
+            case QEMU_OPTION_tb_trace:
+                tb_trace_threshold = strtol(optarg, NULL, 0);
+                if (tb_trace_threshold < 0) {
+                    fprintf(stderr, "Invalid superblock threshold: %s\n",
+                            optarg);
+                    exit(1);
+                }
+                break;
             case QEMU_OPTION_icount:
                 use_icount = 1;
                 if (strcmp(optarg, "auto") == 0) {
@@ -4934,6 +5184,14 @@ int main(int argc, char **argv, char **envp)
                     icount_time_shift = strtol(optarg, NULL, 0);
                 }
                 break;
+            case QEMU_OPTION_record:
+                replay_file = optarg;
+                replay_file_mode = REPLAY_RECORD;
+                break;
+            case QEMU_OPTION_replay:
+                replay_file = optarg;
+                replay_file_mode = REPLAY_PLAY;
+                break;
             case QEMU_OPTION_incoming:
                 incoming = optarg;
                 break;
@@ -5056,6 +5314,21 @@ int main(int argc, char **argv, char **envp)
         fprintf(stderr, "could not initialize alarm timer\n");
         exit(1);
     }
+    if (replay_file) {
+        if (!use_icount) {
+            use_icount = 1;
+            icount_time_shift = 3;
+        } else if (icount_time_shift < 0) {
+            fprintf(stderr, "-record and -replay need a fixed -icount\n");
+            exit(1);
+        }
+        if (smp_cpus > 1) {
+            fprintf(stderr, "-record and -replay need a single CPU\n");
+            exit(1);
+        }
+        if (replay_open(replay_file, replay_file_mode, icount_time_shift) < 0)
+            exit(1);
+    }
     if (use_icount && icount_time_shift < 0) {
         use_icount = 2;
         /* 125MIPS seems a reasonable initial guess at the guest speed.
@@ -5138,14 +5411,31 @@ int main(int argc, char **argv, char **envp)
         phys_ram_size += ram_size;
     }
 
-    phys_ram_base = qemu_vmalloc(phys_ram_size);
+    phys_ram_base = NULL;
+#ifndef _WIN32
+    if (mem_path) {
+        phys_ram_base = file_ram_alloc(phys_ram_size, mem_path);
+        if (!phys_ram_base)
+            fprintf(stderr, "qemu: could not back RAM with %s, "
+                    "using anonymous memory\n", mem_path);
+    }
+#endif
+    if (!phys_ram_base)
+        phys_ram_base = qemu_vmalloc_lazy(phys_ram_size);
     if (!phys_ram_base) {
         fprintf(stderr, "Could not allocate physical memory\n");
         exit(1);
     }
 
     /* init the dynamic translator */
+    if (tb_cache_file) {
+        snprintf(tb_cache_config, sizeof(tb_cache_config), "%s,%s,%s",
+                 TARGET_ARCH, machine->name, cpu_model ? cpu_model : "");
+        tb_cache_open(tb_cache_file, tb_cache_config);
+    }
     cpu_exec_init_all(tb_size * 1024 * 1024);
+    if (perf_map || jitdump)
+        tb_perf_open(perf_map, jitdump);
 
     bdrv_init();
     dma_helper_init();
@@ -5446,7 +5736,9 @@ int main(int argc, char **argv, char **envp)
         close(fd);
     }
 
+    atexit(qemu_exit_flush);
     main_loop();
+    qemu_exit_flush();
     quit_timers();
     net_cleanup();
 